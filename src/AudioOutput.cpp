@@ -1,5 +1,6 @@
 #include "AudioOutput.hpp"
 #include "ErrorMgr.hpp"
+#include "DSPTiming.hpp"
 #include <math.h>
 #include <stdbool.h>
 
@@ -39,6 +40,7 @@ AudioOutput::AudioOutput(){
 	_midrange = 0;
 	 
 	_pcm = NULL;
+	_samplerate = 0;
  
 }
 
@@ -60,12 +62,14 @@ bool AudioOutput::begin(unsigned int samplerate,  bool stereo){
 #define _PCM_CAPTURE_LINE_    "Line"
 
  
-bool AudioOutput::begin(unsigned int samplerate,  bool stereo,  int &error){
+bool AudioOutput::begin(unsigned int samplerate,  bool stereo,  int &error,
+								unsigned int latencyUs){
 	
 	bool success = false;
 	
 	_pcm = NULL;
 	_nchannels = stereo ? 2 : 1;
+	_samplerate = samplerate;
 	_isMuted = false;
 	_isQuiet = false;
 	
@@ -92,7 +96,7 @@ bool AudioOutput::begin(unsigned int samplerate,  bool stereo,  int &error){
 								  _nchannels,
 								  samplerate,
 								  1,               // allow soft resampling
-								  500000);         // latency in us
+								  latencyUs);      // latency in us
 	
 	if( r < 0){
 		printf("Failed to set audio parameters (error %d). Audio output will be disabled.\n", r);
@@ -177,49 +181,65 @@ void AudioOutput::stop(){
 	_isSetup = false;
 }
 
-// Encode a list of samples as signed 16-bit little-endian integers.
-void AudioOutput::samplesToInt16(const SampleVector& samples,
-											vector<uint8_t>& bytes)
-{
-	 bytes.resize(2 * samples.size());
-
-	 SampleVector::const_iterator i = samples.begin();
-	 SampleVector::const_iterator n = samples.end();
-	 vector<uint8_t>::iterator k = bytes.begin();
-
-	 while (i != n) {
-		  Sample s = *(i++);
-		  s = max(Sample(-1.0), min(Sample(1.0), s));
-		  long v = lrint(s * 32767);
-		  unsigned long u = v;
-		  *(k++) = u & 0xff;
-		  *(k++) = (u >> 8) & 0xff;
-	 }
-}
+// int16 packing and the ALSA write,  which includes waiting for room.
+// Published by PiCarMgr.
+static DSPStage s_pcm_pack("pcm_pack");
+static DSPStage s_pcm_write("pcm_write");
 
-bool AudioOutput::writeAudio(const SampleVector& samples){
+bool AudioOutput::writeAudio(const SampleVector& samples, AudioPost::levels_t &levels){
+	
+	levels = {};
 	
 	if (!_isSetup) {
 		return true; // Return success when audio is disabled
 	}
 
-	if(!(_isQuiet || _isMuted) ){
-		
+	if( _isQuiet || _isMuted )
+	{
+		return true;
+	}
+	
+	// the frames sit at the front of the block,  see AudioLineInput
+	size_t frames = samples.size();
+	size_t count = frames * _nchannels;
+	double block_secs = frames / double(_samplerate);
+	
+	DSPTimer pack(s_pcm_pack, block_secs);
+	_pcmbuf.resize(count);
+	levels = AudioPost::process((const int16_t*) samples.data(), count, 1.0, _pcmbuf.data());
+	pack.stop();
+	
 #if defined(__APPLE__)
-		
-		fprintf(stderr,"Output %ld samples\n", samples.size());
+	
+	fprintf(stderr,"Output %ld samples\n", samples.size());
+	return true;
 #else
-		// Write data.
-		
-		snd_pcm_writei(_pcm, samples.data(),  samples.size());
-		 
+	DSPTimer write(s_pcm_write, block_secs);
+	return writePCM(frames);
 #endif
+}
+
+int AudioOutput::delayFrames(){
+	
+	if (!_isSetup || _isQuiet || _isMuted) {
+		return -1;
 	}
+
+#if defined(__APPLE__)
+	return -1;
+#else
+	snd_pcm_sframes_t delay = 0;
+	
+	if(snd_pcm_delay(_pcm, &delay) < 0 || delay < 0)
+		return -1;
 	
- 	return true;
+	return (int) delay;
+#endif
 }
 
-bool AudioOutput::writeIQ(const SampleVector& samples){
+bool AudioOutput::writeIQ(const SampleVector& samples, float gain, AudioPost::levels_t &levels){
+	
+	levels = {};
 	
 	if (!_isSetup) {
 		return true; // Return success when audio is disabled
@@ -231,21 +251,35 @@ bool AudioOutput::writeIQ(const SampleVector& samples){
  	}
 	
 	
-	// Convert samples to bytes.
-	samplesToInt16(samples, _bytebuf);
+	double block_secs = samples.size() / double(_nchannels * _samplerate);
 	
+	// Gain,  metering and conversion to S16_LE.
+	DSPTimer pack(s_pcm_pack, block_secs);
+	_pcmbuf.resize(samples.size());
+	levels = AudioPost::process(samples.data(), samples.size(), gain, _pcmbuf.data());
+	pack.stop();
 	
 #if defined(__APPLE__)
 	
 	fprintf(stderr,"Output %ld samples\n", samples.size());
+	return true;
+#else
+	DSPTimer write(s_pcm_write, block_secs);
+	return writePCM(samples.size() / _nchannels);
+#endif
+}
+
+// Write frames of _pcmbuf,  false on an underrun.
+bool AudioOutput::writePCM(size_t frames){
+	
+#if defined(__APPLE__)
+	return true;
 #else
-	// Write data.
 	unsigned int p = 0;
-	unsigned int n =  (unsigned int) samples.size() / _nchannels;
-	unsigned int framesize = 2 * _nchannels;
+	unsigned int n = (unsigned int) frames;
 	
 	while (p < n) {
-		int k = snd_pcm_writei(_pcm, _bytebuf.data() + p * framesize, n - p);
+		int k = snd_pcm_writei(_pcm, _pcmbuf.data() + p * _nchannels, n - p);
 		
 		if (k < 0) {
 			// After an underrun, ALSA keeps returning error codes until we
@@ -257,10 +291,9 @@ bool AudioOutput::writeIQ(const SampleVector& samples){
 			p += k;
 		}
 	}
-#endif
-	
 	
 	return true;
+#endif
 }
 
 
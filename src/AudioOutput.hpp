@@ -18,6 +18,7 @@
 #include "CommonDefs.hpp"
 
 #include "AudioLineInput.hpp"
+#include "AudioPost.hpp"
 
 using namespace std;
 
@@ -38,12 +39,22 @@ public:
 	AudioOutput();
 	~AudioOutput();
 	
+	static constexpr unsigned int default_latencyUs = 500000;
+
 	bool begin(unsigned int samplerate = 44100,  bool stereo = true);
-	bool begin(unsigned int samplerate,  bool stereo,  int &error);
+	bool begin(unsigned int samplerate,  bool stereo,  int &error,
+				  unsigned int latencyUs = default_latencyUs);
 	void stop();
 	
-	bool writeAudio(const SampleVector& samples);
-	bool writeIQ(const SampleVector& samples);
+	// S16_LE frames as read (line in,  AirPlay),  metered on the way out.
+	// Both writes return false on an underrun.
+	bool writeAudio(const SampleVector& samples, AudioPost::levels_t &levels);
+	
+	// decoder output,  gain applied,  metered and packed in one pass
+	bool writeIQ(const SampleVector& samples, float gain, AudioPost::levels_t &levels);
+	
+	// frames written but not yet played,  -1 when nothing is playing
+	int  delayFrames();
 	
 	bool 	setVolume(double );		// 0.0 - 1.0  % of max
 	double volume();
@@ -75,6 +86,7 @@ private:
 	
 	bool						_isSetup;
 	unsigned int         _nchannels;
+	unsigned int         _samplerate;
 	struct _snd_pcm *   	_pcm;
 	
 	snd_mixer_t* 			_mixer;
@@ -91,8 +103,8 @@ private:
 	bool						_isMuted = false;
 	bool						_isQuiet= false;
 
-	vector<uint8_t>  		_bytebuf;
+	vector<int16_t>  		_pcmbuf;				// S16_LE for ALSA
 	
-	void  samplesToInt16(const SampleVector& samples, vector<uint8_t>& bytes);
+	bool writePCM(size_t frames);
 };
 
@@ -0,0 +1,79 @@
+//
+//  AudioPost.cpp
+//  carradio
+//
+
+#include "AudioPost.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+// float sums lose nothing that matters over this many samples
+static constexpr size_t chunkLength = 1024;
+
+// No branches in the loop body:  min / max and selects only,  and a
+// truncating float to int conversion,  so it turns into SIMD as it is.
+template <typename T>
+static AudioPost::levels_t postKernel(const T* in, size_t count, float scale, int16_t* out){
+
+	AudioPost::levels_t levels = {count, 0, 0, 0, 0};
+	double sum = 0;
+	double sumsq = 0;
+	float  peak = 0;
+
+	for(size_t start = 0; start < count; start += chunkLength){
+		size_t end = std::min(count, start + chunkLength);
+
+		float  csum = 0;
+		float  csumsq = 0;
+		float  cpeak = 0;
+		int    cclipped = 0;
+
+		for(size_t i = start; i < end; i++){
+			float s = float(in[i]) * scale;		// full scale is 32768
+			csum += s;
+			csumsq += s * s;
+			cpeak = std::max(cpeak, std::fabs(s));
+
+			s = std::min(std::max(s, -32768.0f), 32767.0f);
+			cclipped += (s >= 32767.0f) | (s <= -32768.0f);
+
+			// round half away from zero,  the cast truncates
+			int16_t v = int16_t(s + (s >= 0 ? 0.5f : -0.5f));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			v = int16_t(__builtin_bswap16(uint16_t(v)));
+#endif
+			out[i] = v;
+		}
+
+		sum += csum;
+		sumsq += csumsq;
+		peak = std::max(peak, cpeak);
+		levels.clipped += cclipped;
+	}
+
+	if(count > 0){
+		levels.mean = sum / count / 32768.0;
+		levels.rms  = std::sqrt(sumsq / count) / 32768.0;
+		levels.peak = peak / 32768.0;
+	}
+
+	return levels;
+}
+
+AudioPost::levels_t AudioPost::process(const Sample* in, size_t count, float gain, int16_t* out){
+	return postKernel(in, count, gain * 32768.0f, out);
+}
+
+AudioPost::levels_t AudioPost::process(const int16_t* in, size_t count, float gain, int16_t* out){
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	// comes in as S16_LE too,  swap it to host order first
+	int16_t* host = out;
+	for(size_t i = 0; i < count; i++)
+		host[i] = int16_t(__builtin_bswap16(uint16_t(in[i])));
+	in = host;
+#endif
+
+	return postKernel(in, count, gain, out);
+}
@@ -0,0 +1,38 @@
+//
+//  AudioPost.hpp
+//  carradio
+//
+//  The last thing done to audio before ALSA,  for every source:  gain,
+//  mean / RMS / peak metering,  clipping and packing into S16_LE.  One
+//  pass over the block instead of a metering pass,  a gain pass and a
+//  pack pass that went a byte at a time.
+//
+//  The loop is written so the compiler vectorizes it (-O2 -ffast-math),
+//  sums are kept in float per chunk and added up in double.  Full scale
+//  is 32768,  so S16_LE in at unity gain comes out bit for bit.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "IQSample.h"
+
+class AudioPost {
+
+public:
+	typedef struct {
+		size_t		count;				// samples,  both channels
+		double		mean;					// after gain,  1.0 is full scale
+		double		rms;
+		double		peak;					// largest |sample|,  before clipping
+		size_t		clipped;				// at or past full scale
+	} levels_t;
+
+	/** Decoder output,  count samples into out. */
+	static levels_t process(const Sample* in, size_t count, float gain, int16_t* out);
+
+	/** S16_LE that is already packed (line in,  AirPlay).  out may be in. */
+	static levels_t process(const int16_t* in, size_t count, float gain, int16_t* out);
+};
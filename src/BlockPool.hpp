@@ -0,0 +1,156 @@
+//
+//  BlockPool.hpp
+//  carradio
+//
+//  Free list of sample blocks so the radio path stops going to the heap
+//  for every block.  A block is taken with get(),  travels down the
+//  pipeline by move or swap and comes back with put() where it is done
+//  with.  Blocks keep their capacity,  so once the pool has seen the
+//  largest block of a mode nothing is allocated again.
+//
+//  The allocation counters are there to prove it:  in steady state they
+//  stop moving.
+//
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+typedef struct {
+	uint64_t		allocations;		// blocks that needed the heap
+	uint64_t		reuses;				// blocks that came from the pool
+	uint64_t		returns;
+	uint64_t		discards;			// too small,  or the pool was full
+	size_t		available;
+	size_t		blockLength;
+} blockPoolStats_t;
+
+template <class Element>
+class BlockPool
+{
+public:
+
+	/** blockLength in elements,  maxFree blocks kept for reuse. */
+	BlockPool(size_t blockLength = 0, size_t maxFree = 32)
+	: m_block_length(blockLength)
+	, m_max_free(maxFree)
+	{
+		m_stats = {0, 0, 0, 0, 0, blockLength};
+		m_free.reserve(maxFree);
+	}
+
+	/**
+	 * Make block an empty vector with room for blockLength elements.
+	 * Storage it already has is kept if it is big enough.  With allocate
+	 * false,  return false rather than go to the heap.
+	 */
+	bool get(vector<Element>& block, bool allocate = true)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (block.capacity() >= m_block_length) {
+			block.clear();
+			m_stats.reuses++;
+			return true;
+		}
+
+		while (!m_free.empty()) {
+			vector<Element> b = std::move(m_free.back());
+			m_free.pop_back();
+
+			// left over from a smaller block length
+			if (b.capacity() < m_block_length) {
+				m_stats.discards++;
+				continue;
+			}
+
+			block.swap(b);
+			block.clear();
+			m_stats.reuses++;
+			return true;
+		}
+
+		if (!allocate)
+			return false;
+
+		block.clear();
+		block.reserve(m_block_length);
+		m_stats.allocations++;
+		return true;
+	}
+
+	/** Give the storage of block back to the pool,  block is left empty. */
+	void put(vector<Element>& block)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		if (block.capacity() < m_block_length || m_free.size() >= m_max_free) {
+			m_stats.discards++;
+			vector<Element>().swap(block);
+			return;
+		}
+
+		m_free.push_back(std::move(block));
+		block = vector<Element>();
+		m_stats.returns++;
+	}
+
+	/** Allocate up front so the first blocks don't. */
+	void fill(size_t count)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		while (m_free.size() < min(count, m_max_free)) {
+			vector<Element> b;
+			b.reserve(m_block_length);
+			m_free.push_back(std::move(b));
+			m_stats.allocations++;
+		}
+	}
+
+	/** Blocks already in the pool that are too small go on the next get(). */
+	void setBlockLength(size_t blockLength)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_block_length = blockLength;
+		m_stats.blockLength = blockLength;
+	}
+
+	void setMaxFree(size_t maxFree)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_max_free = maxFree;
+		if (m_free.size() > maxFree)
+			m_free.resize(maxFree);
+	}
+
+	/** Drop everything in the pool. */
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_free.clear();
+	}
+
+	size_t blockLength() const
+	{
+		return m_block_length;
+	}
+
+	blockPoolStats_t stats()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.available = m_free.size();
+		return m_stats;
+	}
+
+private:
+	size_t						m_block_length;
+	size_t						m_max_free;
+	vector<vector<Element>>	m_free;			// stack,  last returned is warmest
+	blockPoolStats_t			m_stats;
+	std::mutex					m_mutex;
+};
@@ -16,6 +16,7 @@
 #include <array>
 #include <climits>
 #include "timespec_util.h"
+#include "ThreadPolicy.hpp"
 #include "XXHash32.h"
 
 using namespace std;
@@ -74,6 +75,7 @@ CANBusMgr::CANBusMgr(){
  
 	pthread_create(&_TID, NULL,
 										  (THREADFUNCPTR) &CANBusMgr::CANReaderThread, (void*)this);
+	ThreadPolicy::shared()->registerThread("CANBusMgr", _TID);
 
 }
 
@@ -0,0 +1,137 @@
+//
+//  DSPTiming.cpp
+//  carradio
+//
+
+#include "DSPTiming.hpp"
+
+#include <stdio.h>
+
+#include "PropValKeys.hpp"
+
+static vector<DSPTiming::stageStats_t>	s_last_stats;
+static uint64_t								s_last_values_ns = 0;
+
+DSPStage::DSPStage(const char* name)
+: m_name(name)
+, m_busy_ns(0)
+, m_signal_ns(0)
+, m_last_busy_ns(0)
+, m_last_signal_ns(0)
+{
+	for (unsigned int i = 0; i < bucketCount; i++) {
+		m_buckets[i] = 0;
+		m_last_buckets[i] = 0;
+	}
+
+	DSPTiming::add(this);
+}
+
+// Stages are statics in the files that time them,  the list has to
+// exist before the first of them is constructed.
+std::mutex& DSPTiming::mutex()
+{
+	static std::mutex m;
+	return m;
+}
+
+vector<DSPStage*>& DSPTiming::stages()
+{
+	static vector<DSPStage*> list;
+	return list;
+}
+
+void DSPTiming::add(DSPStage* stage)
+{
+	std::lock_guard<std::mutex> lock(mutex());
+	stages().push_back(stage);
+}
+
+vector<DSPTiming::stageStats_t> DSPTiming::stats()
+{
+	std::lock_guard<std::mutex> lock(mutex());
+	vector<stageStats_t> result;
+
+	for (DSPStage* stage : stages()) {
+
+		uint64_t counts[DSPStage::bucketCount];
+		uint64_t blocks = 0;
+
+		for (unsigned int i = 0; i < DSPStage::bucketCount; i++) {
+			uint64_t now = stage->m_buckets[i].load(memory_order_relaxed);
+			counts[i] = now - stage->m_last_buckets[i];
+			stage->m_last_buckets[i] = now;
+			blocks += counts[i];
+		}
+
+		uint64_t busy = stage->m_busy_ns.load(memory_order_relaxed);
+		uint64_t signal = stage->m_signal_ns.load(memory_order_relaxed);
+		uint64_t busy_ns = busy - stage->m_last_busy_ns;
+		uint64_t signal_ns = signal - stage->m_last_signal_ns;
+		stage->m_last_busy_ns = busy;
+		stage->m_last_signal_ns = signal;
+
+		if (blocks == 0)
+			continue;
+
+		stageStats_t s = {stage->name(), blocks, 0, 0, 0};
+
+		// first bucket that reaches the rank
+		uint64_t p50_rank = (blocks + 1) / 2;
+		uint64_t p99_rank = blocks - blocks / 100;
+		uint64_t seen = 0;
+		bool have_p50 = false;
+
+		for (unsigned int i = 0; i < DSPStage::bucketCount; i++) {
+			seen += counts[i];
+			if (!have_p50 && seen >= p50_rank) {
+				s.p50Us = DSPStage::bucket_ns(i) * 1.0e-3;
+				have_p50 = true;
+			}
+			if (seen >= p99_rank) {
+				s.p99Us = DSPStage::bucket_ns(i) * 1.0e-3;
+				break;
+			}
+		}
+
+		if (signal_ns > 0)
+			s.rtPercent = 100.0 * busy_ns / signal_ns;
+
+		result.push_back(s);
+	}
+
+	s_last_stats = result;
+	return result;
+}
+
+vector<DSPTiming::stageStats_t> DSPTiming::lastStats()
+{
+	std::lock_guard<std::mutex> lock(mutex());
+	return s_last_stats;
+}
+
+bool DSPTiming::statsValues(map<string,string> &values)
+{
+	uint64_t now = DSPStage::now_ns();
+
+	if (s_last_values_ns != 0 && now - s_last_values_ns < statsInterval * 1000000000ULL)
+		return false;
+
+	s_last_values_ns = now;
+
+	char buf[32];
+	for (auto &s : stats()) {
+		string key = VAL_DSP_PREFIX + s.name;
+
+		snprintf(buf, sizeof(buf), "%.0f", s.p50Us);
+		values[key + "_p50_us"] = buf;
+
+		snprintf(buf, sizeof(buf), "%.0f", s.p99Us);
+		values[key + "_p99_us"] = buf;
+
+		snprintf(buf, sizeof(buf), "%.1f", s.rtPercent);
+		values[key + "_rt"] = buf;
+	}
+
+	return true;
+}
@@ -0,0 +1,151 @@
+//
+//  DSPTiming.hpp
+//  carradio
+//
+//  Always on timing of the stages of the radio chain.  Each stage is a
+//  static DSPStage with a histogram of how long it took per block,  four
+//  buckets per octave from 256 ns up.  A DSPTimer around the work reads
+//  the monotonic clock twice (vDSO,  no syscall) and adds one to a bucket
+//  with a relaxed atomic,  so the writers never lock or wait on a reader.
+//
+//  DSPTiming::stats() turns the counts since the last call into p50,
+//  p99 and the percent of real time the stage takes,  time spent against
+//  the length of signal it got through.
+//
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include <time.h>
+
+using namespace std;
+
+class DSPStage
+{
+public:
+
+	static constexpr unsigned int bucketsPerOctave = 4;
+	static constexpr unsigned int minOctave        = 8;		// 256 ns
+	static constexpr unsigned int octaves          = 24;		// to about 4 s
+	static constexpr unsigned int bucketCount      = octaves * bucketsPerOctave;
+
+	/** name is also the PiCarDB key,  keep it short.  Registers the stage. */
+	DSPStage(const char* name);
+
+	/** One block took ns and covered signalSecs of signal. */
+	void record(uint64_t ns, double signalSecs)
+	{
+		m_buckets[bucket(ns)].fetch_add(1, memory_order_relaxed);
+		m_busy_ns.fetch_add(ns, memory_order_relaxed);
+		m_signal_ns.fetch_add(uint64_t(signalSecs * 1.0e9), memory_order_relaxed);
+	}
+
+	const char* name() const { return m_name; }
+
+	static inline uint64_t now_ns()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return uint64_t(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+	}
+
+private:
+
+	friend class DSPTiming;
+
+	static inline unsigned int bucket(uint64_t ns)
+	{
+		if (ns < (1ULL << minOctave))
+			return 0;
+
+		unsigned int msb = 63 - __builtin_clzll(ns);
+		unsigned int sub = (ns >> (msb - 2)) & (bucketsPerOctave - 1);
+		unsigned int idx = (msb - minOctave) * bucketsPerOctave + sub;
+		return idx < bucketCount ? idx : bucketCount - 1;
+	}
+
+	/** Middle of a bucket in ns. */
+	static double bucket_ns(unsigned int idx)
+	{
+		unsigned int octave = idx / bucketsPerOctave + minOctave;
+		unsigned int sub    = idx % bucketsPerOctave;
+		double step = double(1ULL << (octave - 2));
+		return (bucketsPerOctave + sub + 0.5) * step;
+	}
+
+	const char*			m_name;
+	atomic<uint64_t>	m_buckets[bucketCount];
+	atomic<uint64_t>	m_busy_ns;
+	atomic<uint64_t>	m_signal_ns;
+
+	// counts at the last DSPTiming::stats(),  only touched there
+	uint64_t				m_last_buckets[bucketCount];
+	uint64_t				m_last_busy_ns;
+	uint64_t				m_last_signal_ns;
+};
+
+
+/** Times one block of a stage,  until stop() or the end of the scope. */
+class DSPTimer
+{
+public:
+	DSPTimer(DSPStage& stage, double signalSecs)
+	: m_stage(stage)
+	, m_signal_secs(signalSecs)
+	, m_start(DSPStage::now_ns())
+	{ }
+
+	~DSPTimer() { stop(); }
+
+	void stop()
+	{
+		if (m_start) {
+			m_stage.record(DSPStage::now_ns() - m_start, m_signal_secs);
+			m_start = 0;
+		}
+	}
+
+private:
+	DSPStage&	m_stage;
+	double		m_signal_secs;
+	uint64_t		m_start;
+};
+
+
+class DSPTiming
+{
+public:
+
+	typedef struct {
+		string		name;
+		uint64_t		blocks;
+		double		p50Us;
+		double		p99Us;
+		double		rtPercent;			// busy time against signal time
+	} stageStats_t;
+
+	/** Every stage that ran since the last call. */
+	static vector<stageStats_t> stats();
+
+	/** What the last stats() or statsValues() found. */
+	static vector<stageStats_t> lastStats();
+
+	/** PiCarDB values,  false until statsInterval has passed. */
+	static bool statsValues(map<string,string> &values);
+
+private:
+
+	friend class DSPStage;
+
+	static constexpr int statsInterval = 2;		// seconds
+
+	static void add(DSPStage* stage);
+
+	static std::mutex& mutex();
+	static vector<DSPStage*>& stages();
+};
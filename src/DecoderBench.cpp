@@ -0,0 +1,226 @@
+//
+//  DecoderBench.cpp
+//  carradio
+//
+//  Decoder throughput for each radio mode,  on synthetic IQ at the rate
+//  the mode's plan runs the dongle at.  Each mode is timed decoding on
+//  one thread,  and split decoders again through a DecoderPipeline.
+//  FM stereo is run again at each of its quality tiers.
+//
+//  Figures are in times realtime.  "stages" is the pipeline limit when
+//  every stage has a core,  the slowest stage sets it.  "pipeline" is
+//  what this machine actually did,  on fewer than two free cores it
+//  can't reach the stage limit.
+//
+//  	decoderbench [seconds of signal per mode]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include <string>
+
+#include "FmDecode.hpp"
+#include "VhfDecode.hpp"
+#include "MultiChannelDecode.hpp"
+#include "DecoderPipeline.hpp"
+#include "DSPTiming.hpp"
+
+using namespace std;
+
+static constexpr double pcmRate = 48000;
+static constexpr unsigned int blockLength = 65536;		// RtlSdr::default_blockLength
+static constexpr int maxInFlight = 4;						// blocks queued in the pipeline
+
+static double secsNow(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+// FM carrier at offset,  modulated by a composite baseband signal
+static vector<IQSampleVector> makeSignal(double rate, double offset, double dev,
+													  bool stereo, double seconds){
+	size_t total = (size_t)(rate * seconds);
+	vector<IQSampleVector> blocks;
+
+	double phase = 0;
+	for(size_t n = 0; n < total; n += blockLength){
+		IQSampleVector block(min((size_t)blockLength, total - n));
+
+		for(size_t i = 0; i < block.size(); i++){
+			double t = (n + i) / rate;
+			double left  = sin(2 * M_PI * 1000 * t);
+			double right = sin(2 * M_PI * 400 * t);
+			double mpx = 0.45 * (left + right);
+
+			if(stereo)
+				mpx = 0.4 * (left + right) / 2
+						+ 0.4 * (left - right) / 2 * cos(2 * M_PI * 38000 * t)
+						+ 0.1 * cos(2 * M_PI * 19000 * t);
+
+			phase += 2 * M_PI * (offset + dev * mpx) / rate;
+			phase = remainder(phase, 2 * M_PI);
+
+			// a little noise so squelch and the PLL see something real
+			double noise = 0.01 * ((rand() / (double)RAND_MAX) - 0.5);
+			block[i] = IQSample(cos(phase) + noise, sin(phase) - noise);
+		}
+		blocks.push_back(block);
+	}
+
+	return blocks;
+}
+
+static double runSingle(SDRDecoder* decoder, const vector<IQSampleVector>& blocks){
+	SampleVector audio;
+
+	double start = secsNow();
+	for(auto &block : blocks)
+		decoder->process(block, audio);
+	return secsNow() - start;
+}
+
+static double runPipeline(SDRDecoder* decoder, const vector<IQSampleVector>& blocks,
+								  DecoderPipeline::stats_t &stats){
+	DecoderPipeline pipeline;
+	BlockPool<Sample> audioPool(0, 16);
+	atomic<uint64_t> done(0);
+
+	int cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	bool pin = cpus >= 4;
+
+	// RadioMgr::postAudio() only hands the block on,  gain and metering
+	// are packed with the output (AudioPost)
+	auto post = [&](SampleVector& audio, const DecoderPipeline::blockInfo_t& info){
+		done++;
+	};
+
+	if(!pipeline.begin(post, audioPool, pin ? 2 : -1))
+		return 0;
+
+	if(pin)
+		DecoderPipeline::pinThread(pthread_self(), 1);
+
+	double start = secsNow();
+	uint64_t sent = 0;
+
+	for(auto &block : blocks){
+		// keep the queues short so nothing is dropped for overflow
+		while(sent - done - pipeline.stats().dropped >= maxInFlight)
+			sched_yield();
+
+		pipeline.process(decoder, block);
+		sent++;
+	}
+
+	while(done + pipeline.stats().dropped < sent)
+		sched_yield();
+
+	double elapsed = secsNow() - start;
+	stats = pipeline.stats();
+	pipeline.stop();
+	return elapsed;
+}
+
+static void benchMode(string name, SDRDecoder* decoder, const vector<IQSampleVector>& blocks,
+							 double seconds){
+
+	// settle the filters,  then time
+	SampleVector audio;
+	decoder->process(blocks[0], audio);
+
+	double single = seconds / runSingle(decoder, blocks);
+	printf("%-10s single %7.1fx", name.c_str(), single);
+
+	if(!decoder->can_split()){
+		printf("   (not split)\n");
+		return;
+	}
+
+	decoder->reset();
+
+	DecoderPipeline::stats_t stats;
+	double elapsed = runPipeline(decoder, blocks, stats);
+	double slowest = max(stats.ifSecs, stats.demodSecs);
+
+	printf("   IF %6.1fx  demod %6.1fx   stages %7.1fx  pipeline %7.1fx   headroom %+.0f%%\n",
+			 seconds / stats.ifSecs,
+			 seconds / stats.demodSecs,
+			 seconds / slowest,
+			 seconds / elapsed,
+			 100 * (single > 0 ? (seconds / slowest) / single - 1 : 0));
+
+	if(stats.dropped > 0)
+		printf("%-10s %llu blocks dropped\n", "", (unsigned long long) stats.dropped);
+}
+
+int main(int argc, const char * argv[]) {
+
+	double seconds = argc > 1 ? atof(argv[1]) : 5;
+	if(seconds <= 0)
+		seconds = 5;
+
+	printf("decoder throughput,  %.1f s of signal per mode,  %ld cpus\n\n",
+			 seconds, sysconf(_SC_NPROCESSORS_ONLN));
+
+	// broadcast FM,  1 MS/s,  baseband decimated by 4 (RadioMgr rate plan)
+	{
+		double rate = 1.0e6;
+		auto blocks = makeSignal(rate, -0.25 * rate, 75000, true, seconds);
+
+		FmDecoder stereo(rate, -0.25 * rate, pcmRate, true,
+							  FmDecoder::default_deemphasis, FmDecoder::default_bandwidth_if,
+							  FmDecoder::default_freq_dev, FmDecoder::default_bandwidth_pcm, 4, 5);
+		benchMode("FM stereo", &stereo, blocks, seconds);
+
+		FmDecoder mono(rate, -0.25 * rate, pcmRate, false,
+							FmDecoder::default_deemphasis, FmDecoder::default_bandwidth_if,
+							FmDecoder::default_freq_dev, FmDecoder::default_bandwidth_pcm, 4, 5);
+		benchMode("FM mono", &mono, blocks, seconds);
+
+		// what each quality tier saves,  see QualityGovernor
+		for(unsigned int tier = 1; tier < stereo.quality_tiers(); tier++){
+			stereo.set_quality_tier(tier);
+			benchMode(stereo.quality_tier_name(tier), &stereo, blocks, seconds);
+		}
+	}
+
+	// VHF/UHF narrowband,  240 kS/s
+	{
+		double rate = 240000;
+		auto blocks = makeSignal(rate, -0.25 * rate, 3000, false, seconds);
+
+		VhfDecoder vhf(rate, -0.25 * rate, pcmRate,
+							VhfDecoder::default_deemphasis, 12500, VhfDecoder::default_freq_dev,
+							min(FmDecoder::default_bandwidth_pcm, 0.45 * pcmRate), 4, 0, 10);
+		benchMode("VHF", &vhf, blocks, seconds);
+	}
+
+	// scanner,  2.4 MS/s and a cluster of channels across it
+	{
+		double rate = 2.4e6;
+		auto blocks = makeSignal(rate, -0.25 * rate, 3000, false, seconds);
+
+		vector<MultiChannelDecoder::channel_t> channels;
+		for(int i = 0; i < 8; i++)
+			channels.push_back({ -0.25 * rate + i * 25000, 6250, 0 });
+
+		MultiChannelDecoder scanner(rate, channels, pcmRate,
+											 VhfDecoder::default_deemphasis, VhfDecoder::default_freq_dev,
+											 min(FmDecoder::default_bandwidth_pcm, 0.45 * pcmRate));
+		benchMode("scanner", &scanner, blocks, seconds);
+	}
+
+	// the stage timers,  over every run above
+	printf("\n%-10s %8s %8s %8s %8s\n", "stage", "blocks", "p50 us", "p99 us", "% RT");
+	for(auto &s : DSPTiming::stats())
+		printf("%-10s %8llu %8.0f %8.0f %8.1f\n", s.name.c_str(),
+				 (unsigned long long) s.blocks, s.p50Us, s.p99Us, s.rtPercent);
+
+	return 0;
+}
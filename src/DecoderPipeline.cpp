@@ -0,0 +1,187 @@
+//
+//  DecoderPipeline.cpp
+//  carradio
+//
+
+#include "DecoderPipeline.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+typedef void * (*THREADFUNCPTR)(void *);
+
+static inline uint64_t nsecsNow(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+DecoderPipeline::DecoderPipeline(){
+	_isRunning = false;
+	_shouldQuit = false;
+	_audioPool = NULL;
+	_decoder = NULL;
+	_epoch = 0;
+	_blocks = 0;
+	_dropped = 0;
+	_ifNsecs = 0;
+	_demodNsecs = 0;
+}
+
+DecoderPipeline::~DecoderPipeline(){
+	stop();
+}
+
+bool DecoderPipeline::begin(postCallback_t post, BlockPool<Sample> &audioPool,
+									 int demodCPU){
+	if(_isRunning)
+		return true;
+
+	_post = post;
+	_audioPool = &audioPool;
+	_shouldQuit = false;
+
+	if(pthread_create(&_demodTID, NULL,
+							(THREADFUNCPTR) &DecoderPipeline::DemodStageThread, (void*)this) != 0){
+		fprintf(stderr, "DecoderPipeline: demod thread failed\n");
+		return false;
+	}
+
+	if(demodCPU >= 0)
+		pinThread(_demodTID, demodCPU);
+
+	_isRunning = true;
+	return true;
+}
+
+void DecoderPipeline::stop(){
+	if(!_isRunning)
+		return;
+
+	_shouldQuit = true;
+	_ifQueue.push_end();
+
+	pthread_join(_demodTID, NULL);
+
+	_isRunning = false;
+}
+
+bool DecoderPipeline::pinThread(pthread_t tid, int cpu){
+#if defined(__linux__)
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+
+	int err = pthread_setaffinity_np(tid, sizeof(cpu_set_t), &cpuset);
+	if(err != 0){
+		fprintf(stderr, "pin thread to cpu %d failed: %s\n", cpu, strerror(err));
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void DecoderPipeline::lock(){
+	_demodMutex.lock();
+
+	_epoch++;
+
+	_ifQueue.flush([this](IQSampleVector& block){
+		_ifPool.put(block);
+		_dropped++;
+	});
+}
+
+void DecoderPipeline::unlock(){
+	_demodMutex.unlock();
+}
+
+DecoderPipeline::stats_t DecoderPipeline::stats(){
+	stats_t s;
+	s.blocks 	= _blocks;
+	s.dropped 	= _dropped;
+	s.overflows = _ifQueue.dropped_blocks();
+	s.queued 	= _ifQueue.queued_blocks();
+	s.capacity 	= _ifQueue.stats().capacity;
+	s.ifSecs 	= _ifNsecs * 1.0e-9;
+	s.demodSecs = _demodNsecs * 1.0e-9;
+	return s;
+}
+
+// MARK: -  IF stage
+
+void DecoderPipeline::process(SDRDecoder* decoder, const IQSampleVector& samples, bool discard){
+
+	IQSampleVector ifsamples;
+	_ifPool.get(ifsamples);
+
+	uint64_t start = nsecsNow();
+	_decoder = decoder;
+	decoder->process_if(samples, ifsamples);
+	_ifNsecs += nsecsNow() - start;
+
+	blockInfo_t info = {};
+	info.epoch = _epoch;
+	info.discard = discard;
+	info.ifLevel = decoder->get_if_level();
+
+	// the demod stage fell behind,  what comes back is the oldest block
+	_ifQueue.push(move(ifsamples), info);
+	if(ifsamples.capacity() > 0)
+		_ifPool.put(ifsamples);
+}
+
+// MARK: -  demod stage
+
+void DecoderPipeline::DemodStage(){
+
+	SampleVector audio;
+
+	while(!_shouldQuit){
+
+		blockInfo_t info;
+		IQSampleVector ifsamples = _ifQueue.pull(info);
+		if(ifsamples.empty())
+			continue;
+
+		std::lock_guard<std::mutex> lock(_demodMutex);
+
+		// pulled just before a retune locked us out
+		SDRDecoder* decoder = _decoder;
+		if(info.epoch != _epoch || !decoder){
+			_ifPool.put(ifsamples);
+			_dropped++;
+			continue;
+		}
+
+		_audioPool->get(audio);
+
+		uint64_t start = nsecsNow();
+		decoder->process_demod(ifsamples, audio);
+
+		info.basebandLevel = decoder->get_baseband_level();
+		info.stereo = decoder->stereo_detected();
+
+		_ifPool.put(ifsamples);
+
+		// the filters were still settling,  decoded for their sake only
+		if(!info.discard){
+			_post(audio, info);
+			_blocks++;
+		}
+		_demodNsecs += nsecsNow() - start;
+
+		// whatever the callback left behind
+		if(audio.capacity() > 0)
+			_audioPool->put(audio);
+	}
+}
+
+void* DecoderPipeline::DemodStageThread(void *context){
+	DecoderPipeline* d = (DecoderPipeline*)context;
+	d->DemodStage();
+	return((void *)1);
+}
@@ -0,0 +1,115 @@
+//
+//  DecoderPipeline.hpp
+//  carradio
+//
+//  Runs a decoder that can_split() as two stages on two cores:
+//
+//   	IF chain			the caller (SDRProcessor),  mixer, decimation, IF filter
+//   	demod				discriminator,  pilot PLL,  stereo / mono audio,  then
+//   						the post callback that queues it for output
+//
+//  The stages hand blocks along in a SampleRing and only share the
+//  decoder,  whose halves keep separate state.  Each stage then has a
+//  whole block time of its own instead of the two sharing one,  which
+//  is the headroom the FM stereo chain was missing on a Pi.  Gain,
+//  metering and packing are done on the output thread (AudioPost),  the
+//  post callback is too little work for a thread of its own.
+//
+//  A retune holds the pipeline locked (it is BasicLockable,  so a
+//  std::lock_guard will do).  That waits out the block in the demod stage
+//  and drops whatever was still queued.
+//
+
+#pragma once
+
+#include <pthread.h>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+
+#include "SDRDecoder.hpp"
+#include "SampleRing.hpp"
+#include "BlockPool.hpp"
+
+using namespace std;
+
+class DecoderPipeline {
+
+public:
+	
+	// travels with each block,  the decoder's levels are only read on the
+	// thread of the stage that just wrote them
+	typedef struct {
+		uint32_t		epoch;				// lock() count when the IF stage took it
+		bool			discard;				// decoded to settle the filters,  not posted
+		double		ifLevel;
+		double		basebandLevel;
+		bool			stereo;
+	} blockInfo_t;
+	
+	typedef std::function<void(SampleVector& audio, const blockInfo_t& info)> postCallback_t;
+
+	typedef struct {
+		uint64_t		blocks;				// posted
+		uint64_t		dropped;				// in flight at a retune
+		uint64_t		overflows;			// a stage fell a whole queue behind
+		size_t		queued;				// IF blocks waiting for the demod
+		size_t		capacity;
+		double		ifSecs;				// time spent working,  per stage
+		double		demodSecs;			// with the post callback
+	} stats_t;
+
+	DecoderPipeline();
+	~DecoderPipeline();
+
+	// start the demod thread,  post is called on it.  Audio blocks come
+	// from and go back to audioPool.  A cpu of -1 leaves it unpinned.
+	bool begin(postCallback_t post, BlockPool<Sample> &audioPool,
+				  int demodCPU = -1);
+	void stop();
+	bool isRunning() { return _isRunning; };
+	
+	pthread_t demodThread() { return _demodTID; };
+
+	// IF stage,  runs on the calling thread.  One caller at a time,  and
+	// not while the pipeline is locked.
+	void process(SDRDecoder* decoder, const IQSampleVector& samples, bool discard = false);
+
+	// while locked the stages are idle,  and blocks in flight are dropped
+	void lock();
+	void unlock();
+
+	stats_t stats();
+
+	// pin a thread to one core,  false where that is not supported
+	static bool pinThread(pthread_t tid, int cpu);
+
+private:
+
+	static constexpr size_t	queueBlocks = 8;
+
+	bool						_isRunning;
+	bool						_shouldQuit;
+	postCallback_t			_post;
+	BlockPool<Sample>*	_audioPool;
+
+	atomic<SDRDecoder*>	_decoder;
+
+	SampleRing<IQSample, blockInfo_t>	_ifQueue {queueBlocks};
+	BlockPool<IQSample>	_ifPool {0, queueBlocks * 2};
+
+	// the demod stage holds it for the length of a block
+	std::mutex				_demodMutex;
+	atomic<uint32_t>		_epoch;				// bumped by lock(),  stale blocks have an older one
+
+	atomic<uint64_t>		_blocks;
+	atomic<uint64_t>		_dropped;
+	atomic<uint64_t>		_ifNsecs;
+	atomic<uint64_t>		_demodNsecs;
+
+	pthread_t				_demodTID;
+
+	void DemodStage();		// C++ version of thread
+	static void* DemodStageThread(void *context);
+};
@@ -30,6 +30,7 @@
 
 #include "PiCarMgr.hpp"
 #include "PropValKeys.hpp"
+#include "ThreadPolicy.hpp"
 
 #define TRY(_statement_) if(!(_statement_)) { \
 printf("FAIL AT line: %d\n", __LINE__ ); \
@@ -142,17 +143,22 @@ DisplayMgr::DisplayMgr(DisplayType displayType, EncoderConfig leftConfig, Encode
 										 _rightEncoderConfig.generic.swPin);
 	}
 
+	ThreadPolicy* threads = ThreadPolicy::shared();
+	
 	pthread_create(&_updateTID, NULL,
 						(THREADFUNCPTR) &DisplayMgr::DisplayUpdateThread, (void*)this);
+	threads->registerThread("DisplayUpdate", _updateTID);
 	
 	// Only create LED thread if we have LED functionality
 	if (_hasLEDs) {
 		pthread_create(&_ledUpdateTID, NULL,
 							(THREADFUNCPTR) &DisplayMgr::LEDUpdateThread, (void*)this);
+		threads->registerThread("LEDUpdate", _ledUpdateTID);
 	}
 	
 	pthread_create(&_metaReaderTID, NULL,
 						(THREADFUNCPTR) &DisplayMgr::MetaDataReaderThread, (void*)this);
+	threads->registerThread("MetaReader", _metaReaderTID);
 }
 
 
@@ -589,6 +595,10 @@ void DisplayMgr::showDTCInfo(string code){
 	setEvent(EVT_PUSH, MODE_DTC_INFO, code);
 }
 
+void DisplayMgr::showSpectrum(){
+	setEvent(EVT_PUSH, MODE_SPECTRUM);
+}
+
 void DisplayMgr::showGPS(knobCallBack_t cb){
 	_knobCB = cb;
 	setEvent(EVT_PUSH, MODE_GPS);
@@ -659,6 +669,7 @@ bool  DisplayMgr::usesSelectorKnob(){
 		case MODE_SLIDER:
 		case MODE_SELECT_SLIDER:
 		case MODE_INFO:
+		case MODE_SPECTRUM:
  			return true;
 			
 		default:
@@ -796,6 +807,10 @@ bool DisplayMgr::processSelectorKnobAction( knob_action_t action){
 			break;
 
 			
+		case MODE_SPECTRUM:
+			wasHandled = processSelectorKnobActionForSpectrum(action);
+			break;
+
 		case MODE_CHANNEL_INFO:
 			wasHandled = processSelectorKnobActionForChannelInfo(action);
 			break;
@@ -1006,6 +1021,7 @@ bool DisplayMgr::isStickyMode(mode_state_t md){
 		case MODE_CANBUS:
 		case MODE_CHANNEL_INFO:
 		case MODE_DTC:
+		case MODE_SPECTRUM:
 			isSticky = true;
 			break;
 			
@@ -1147,6 +1163,13 @@ void DisplayMgr::DisplayUpdateLoop(){
 						shouldUpdate = true;
 					}
 				}
+				else if(_current_mode == MODE_SPECTRUM) {
+					// check for {EVT_NONE,MODE_SPECTRUM}  which is a new row
+					if(item.mode == MODE_SPECTRUM) {
+						shouldRedraw = false;
+						shouldUpdate = true;
+					}
+				}
 				
 				else if(_current_mode == MODE_GPS_WAYPOINTS) {
 					// check for {EVT_NONE,MODE_GPS_WAYPOINTS}  which is a scroll change
@@ -1558,6 +1581,10 @@ void DisplayMgr::drawMode(modeTransition_t transition,
 				drawInfoScreen(transition);
 				break;
 				
+			case MODE_SPECTRUM:
+				drawSpectrumScreen(transition);
+				break;
+				
 			case MODE_UNKNOWN:
 				// we will always leave the UNKNOWN state at start
 				if(transition == TRANS_LEAVING)
@@ -3874,6 +3901,131 @@ void DisplayMgr::drawEditStringScreen(modeTransition_t transition){
 }
 
 
+// MARK: -  Band scope
+
+void DisplayMgr::drawSpectrumScreen(modeTransition_t transition){
+
+	RadioMgr*		radio 	= PiCarMgr::shared()->radio();
+	SpectrumEngine* spectrum = radio->spectrum();
+
+	constexpr uint8_t graphTop 		= 16;
+	constexpr float   dBPerPixel 	= 1.25;
+
+	uint8_t bottom = _vfd->height() -1;
+	int		graphHeight = bottom - graphTop + 1;
+
+	if(transition == TRANS_LEAVING) {
+		spectrum->setActive(false);
+		return;
+	}
+
+	if(transition == TRANS_ENTERING) {
+		_vfd->clearScreen();
+
+		_vfd->setFont(VFD::FONT_MINI);
+		_vfd->setCursor(2,7);
+		_vfd->printPacket("BAND SCOPE");
+
+		// tick at the tuned frequency
+		uint8_t mid = SpectrumEngine::columns / 2;
+		uint8_t buff1[] = {VFD::VFD_SET_AREA, mid, graphTop - 5, mid, graphTop - 3};
+		_vfd->writePacket(buff1, sizeof(buff1), 0);
+
+		memset(_spectrumHeights, 0, sizeof(_spectrumHeights));
+		_spectrumSeq = 0;
+		_spectrumFreq = 0;
+
+		// each new row comes back to us as {EVT_NONE,MODE_SPECTRUM}
+		spectrum->setActive(true, SpectrumEngine::default_frameMs, [this](){
+			setEvent(EVT_NONE, MODE_SPECTRUM);
+		});
+	}
+
+	SpectrumEngine::row_t row;
+	if(!spectrum->getLatestRow(row) || row.seq == _spectrumSeq)
+		return;
+
+	_spectrumSeq = row.seq;
+
+	if(row.centerFreq != _spectrumFreq){
+		_spectrumFreq = row.centerFreq;
+
+		uint8_t buff2[] = {VFD::VFD_CLEAR_AREA, 50, 0, static_cast<uint8_t>(_vfd->width() -1), 9};
+		_vfd->writePacket(buff2, sizeof(buff2), 0);
+
+		string str = RadioMgr::hertz_to_string(row.centerFreq, 3) + RadioMgr::freqSuffixString(row.centerFreq)
+			+ " " + RadioMgr::hertz_to_string(row.span, 1) + RadioMgr::freqSuffixString(row.span);
+
+		_vfd->setFont(VFD::FONT_MINI);
+		_vfd->setCursor(50,7);
+		_vfd->printPacket("%s", str.c_str());
+	}
+
+	// noise floor sits just above the bottom of the graph
+	float sorted[SpectrumEngine::columns];
+	std::copy(row.dB, row.dB + SpectrumEngine::columns, sorted);
+	std::nth_element(sorted, sorted + SpectrumEngine::columns/2, sorted + SpectrumEngine::columns);
+	float floor = sorted[SpectrumEngine::columns/2] - 3;
+
+	// The serial link to the VFD is slow,  only send the columns that
+	// moved,  and ignore a one pixel wobble in the noise.
+	for(uint8_t c = 0; c < SpectrumEngine::columns; c++){
+
+		int h = (row.dB[c] - floor) / dBPerPixel;
+		h = max(0, min(h, graphHeight));
+
+		int old = _spectrumHeights[c];
+		if(h == old || (abs(h - old) == 1 && h != 0))
+			continue;
+
+		if(h > old){
+			uint8_t buff3[] = {VFD::VFD_SET_AREA,
+				c, static_cast<uint8_t>(bottom - h + 1),
+				c, static_cast<uint8_t>(bottom - old)};
+			_vfd->writePacket(buff3, sizeof(buff3), 0);
+		}
+		else {
+			uint8_t y1 = bottom - old + 1;
+			uint8_t y2 = bottom - h;
+
+			// the Noritake VFD chokes on VFD_CLEAR_AREA followed by a 0x60,
+			// clear from the column before and put its bar back.
+			if(c == 0x60){
+				uint8_t buff4[] = {VFD::VFD_CLEAR_AREA, static_cast<uint8_t>(c - 1), y1, c, y2};
+				_vfd->writePacket(buff4, sizeof(buff4), 0);
+
+				uint8_t prevTop = bottom - _spectrumHeights[c - 1] + 1;
+				if(_spectrumHeights[c - 1] > 0 && prevTop <= y2){
+					uint8_t buff5[] = {VFD::VFD_SET_AREA,
+						static_cast<uint8_t>(c - 1), max(prevTop, y1),
+						static_cast<uint8_t>(c - 1), y2};
+					_vfd->writePacket(buff5, sizeof(buff5), 0);
+				}
+			}
+			else {
+				uint8_t buff4[] = {VFD::VFD_CLEAR_AREA, c, y1, c, y2};
+				_vfd->writePacket(buff4, sizeof(buff4), 0);
+			}
+		}
+
+		_spectrumHeights[c] = h;
+	}
+}
+
+bool DisplayMgr::processSelectorKnobActionForSpectrum( knob_action_t action){
+	bool wasHandled = false;
+
+	if(action == KNOB_DOUBLE_CLICK){
+		// popMode() here never sees TRANS_LEAVING,  stop the rows now
+		PiCarMgr::shared()->radio()->spectrum()->setActive(false);
+		popMode();
+		wasHandled = true;
+	}
+
+	return wasHandled;
+}
+
+
 // MARK: -  GPS waypoints
 
 
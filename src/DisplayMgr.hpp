@@ -119,7 +119,8 @@ public:
 		MODE_SCANNER_CHANNELS,
 		MODE_CHANNEL_INFO,
 		MODE_SLIDER,
-		MODE_SELECT_SLIDER
+		MODE_SELECT_SLIDER,
+		MODE_SPECTRUM
 	}mode_state_t;
 
 	mode_state_t active_mode();
@@ -193,6 +194,7 @@ public:
 	void showInfo(time_t timeout = 0);
 	void showDTC();
 	void showDTCInfo(string code);
+	void showSpectrum();
  
 	void showDimmerChange();	
 	void showBalanceChange();
@@ -332,6 +334,14 @@ private:
 	//chanel management stuff
 	void drawScannerChannels(modeTransition_t transition);
 	void drawChannelInfo(modeTransition_t transition);
+
+	// band scope
+	void drawSpectrumScreen(modeTransition_t transition);
+	bool processSelectorKnobActionForSpectrum( knob_action_t action);
+	
+	uint8_t		_spectrumHeights[SpectrumEngine::columns];	// what the VFD shows now
+	uint32_t		_spectrumSeq;
+	uint32_t		_spectrumFreq;
  
 	typedef struct {
 		string title;
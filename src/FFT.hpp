@@ -0,0 +1,160 @@
+//
+//  FFT.hpp
+//  carradio
+//
+//  Small in-place complex FFT for the DSP code.  Radix-2, iterative, with
+//  the twiddles and bit reversal worked out once per size.  Header only so
+//  the filters and the spectrum code don't pull in an outside library.
+//
+
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+// Same switch as Filter.cpp,  -DFILTER_NO_SIMD=1 forces scalar code.
+#if !FILTER_NO_SIMD
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FFT_USE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FFT_USE_SSE2 1
+#endif
+#endif
+
+class FFT
+{
+public:
+
+	 typedef std::complex<float> value_type;
+
+	 /** Construct transform of size points,  must be a power of 2. */
+	 FFT(unsigned int size)
+		  : m_size(size)
+	 {
+		  assert(size >= 2 && (size & (size - 1)) == 0);
+
+		  unsigned int bits = 0;
+		  while ((1u << bits) < size)
+				bits++;
+
+		  m_bitrev.resize(size);
+		  for (unsigned int i = 0; i < size; i++) {
+				unsigned int r = 0;
+				for (unsigned int b = 0; b < bits; b++)
+					 r |= ((i >> b) & 1) << (bits - 1 - b);
+				m_bitrev[i] = r;
+		  }
+
+		  // Twiddles of each stage laid out back to back as interleaved
+		  // floats, so a butterfly is  b = h * wr + swap(h) * wi  with unit
+		  // stride loads:
+		  //   wr = (re, re),  wi = (-im, im),  inverse uses (im, -im).
+		  for (unsigned int half = 2; half < size; half *= 2) {
+				for (unsigned int k = 0; k < half; k++) {
+					 float re = cos(M_PI * k / half);
+					 float im = -sin(M_PI * k / half);
+					 m_wr.push_back(re);
+					 m_wr.push_back(re);
+					 m_wi_fwd.push_back(-im);
+					 m_wi_fwd.push_back(im);
+					 m_wi_inv.push_back(im);
+					 m_wi_inv.push_back(-im);
+				}
+		  }
+	 }
+
+	 unsigned int size() const { return m_size; }
+
+	 /** Forward transform in place,  X[k] = sum x[n] * exp(-2*pi*j*k*n/N). */
+	 void forward(value_type* data) const
+	 {
+		  transform(data, m_wi_fwd.data());
+	 }
+
+	 /** Inverse transform in place,  not scaled by 1/N. */
+	 void inverse(value_type* data) const
+	 {
+		  transform(data, m_wi_inv.data());
+	 }
+
+private:
+	 unsigned int              m_size;
+	 std::vector<unsigned int> m_bitrev;
+	 std::vector<float>        m_wr;
+	 std::vector<float>        m_wi_fwd;
+	 std::vector<float>        m_wi_inv;
+
+	 void transform(value_type* data, const float* wi) const
+	 {
+		  unsigned int n = m_size;
+
+		  for (unsigned int i = 0; i < n; i++) {
+				unsigned int r = m_bitrev[i];
+				if (r > i)
+					 std::swap(data[i], data[r]);
+		  }
+
+		  // First stage has unit twiddles only.
+		  for (unsigned int i = 0; i < n; i += 2) {
+				value_type a = data[i];
+				value_type b = data[i+1];
+				data[i]   = a + b;
+				data[i+1] = a - b;
+		  }
+
+		  float* d = reinterpret_cast<float*>(data);
+		  const float* wr = m_wr.data();
+
+		  for (unsigned int half = 2; half < n; half *= 2) {
+				for (unsigned int base = 0; base < n; base += 2 * half)
+					 butterflies(d + 2 * base, d + 2 * (base + half), wr, wi, half);
+				wr += 2 * half;
+				wi += 2 * half;
+		  }
+	 }
+
+	 /** half butterflies,  lo[k], hi[k] = lo[k] +- hi[k] * w[k]. */
+	 static void butterflies(float* lo, float* hi, const float* wr,
+									 const float* wi, unsigned int half)
+	 {
+		  unsigned int k = 0;
+
+#if FFT_USE_NEON
+		  for (; k + 2 <= half; k += 2) {
+				float32x4_t h = vld1q_f32(hi + 2*k);
+				float32x4_t a = vld1q_f32(lo + 2*k);
+				float32x4_t b = vmulq_f32(h, vld1q_f32(wr + 2*k));
+				b = vmlaq_f32(b, vrev64q_f32(h), vld1q_f32(wi + 2*k));
+				vst1q_f32(lo + 2*k, vaddq_f32(a, b));
+				vst1q_f32(hi + 2*k, vsubq_f32(a, b));
+		  }
+#elif FFT_USE_SSE2
+		  for (; k + 2 <= half; k += 2) {
+				__m128 h = _mm_loadu_ps(hi + 2*k);
+				__m128 a = _mm_loadu_ps(lo + 2*k);
+				__m128 hs = _mm_shuffle_ps(h, h, _MM_SHUFFLE(2, 3, 0, 1));
+				__m128 b = _mm_add_ps(_mm_mul_ps(h, _mm_loadu_ps(wr + 2*k)),
+											 _mm_mul_ps(hs, _mm_loadu_ps(wi + 2*k)));
+				_mm_storeu_ps(lo + 2*k, _mm_add_ps(a, b));
+				_mm_storeu_ps(hi + 2*k, _mm_sub_ps(a, b));
+		  }
+#endif
+
+		  for (; k < half; k++) {
+				float br = hi[2*k]   * wr[2*k]   + hi[2*k+1] * wi[2*k];
+				float bi = hi[2*k+1] * wr[2*k+1] + hi[2*k]   * wi[2*k+1];
+				float ar = lo[2*k];
+				float ai = lo[2*k+1];
+				lo[2*k]   = ar + br;
+				lo[2*k+1] = ai + bi;
+				hi[2*k]   = ar - br;
+				hi[2*k+1] = ai - bi;
+		  }
+	 }
+};
+
+/* end */
@@ -4,8 +4,10 @@
 #include <cstdint>
 #include <algorithm>
 #include <complex>
+#include <numeric>
 
 #include "Filter.hpp"
+#include "FilterKernels.hpp"
 
 using namespace std;
 
@@ -50,6 +52,60 @@ static void make_lanczos_coeff(unsigned int filter_order, double cutoff,
 }
 
 
+/**
+ * Design the coefficient banks of a rational resampler.
+ * Reduces the rate ratio to L/M and returns L banks of taps coefficients,
+ * bank p holding prototype taps p, p+L, p+2L ... last to first.
+ */
+static void make_polyphase_banks(double sample_rate_in, double sample_rate_out,
+											unsigned int taps, double cutoff,
+											unsigned int max_interpolation,
+											unsigned int& interp_out,
+											unsigned int& decim_out,
+											vector<double>& banks)
+{
+	 assert(sample_rate_in > 0 && sample_rate_out > 0);
+	 assert(taps > 1);
+
+	 // Reduce the rate ratio to L/M.
+	 uint64_t rate_in  = llrint(sample_rate_in);
+	 uint64_t rate_out = llrint(sample_rate_out);
+	 uint64_t g = gcd(rate_in, rate_out);
+	 uint64_t interp = rate_out / g;
+	 uint64_t decim  = rate_in / g;
+
+	 if (interp > max_interpolation) {
+		  // Awkward ratio, use the closest one with a sane bank count.
+		  double ratio = sample_rate_in / sample_rate_out;
+		  double best_err = HUGE_VAL;
+		  for (unsigned int l = 1; l <= max_interpolation; l++) {
+				uint64_t m = max<uint64_t>(1, llrint(l * ratio));
+				double err = fabs(double(m) / l - ratio);
+				if (err < best_err) {
+					 best_err = err;
+					 interp = l;
+					 decim = m;
+				}
+		  }
+	 }
+
+	 interp_out = interp;
+	 decim_out  = decim;
+
+	 // Prototype filter runs at L times the input rate, scaled by L for
+	 // unit gain after zero stuffing.
+	 vector<double> proto;
+	 make_lanczos_coeff(interp * taps - 1, cutoff / interp, proto);
+
+	 banks.resize(interp * taps);
+	 for (unsigned int p = 0; p < interp; p++) {
+		  for (unsigned int t = 0; t < taps; t++) {
+				banks[p * taps + (taps - 1 - t)] = proto[p + t * interp] * interp;
+		  }
+	 }
+}
+
+
 /* ****************  class FineTuner  **************** */
 
 // Construct finetuner.
@@ -88,13 +144,317 @@ void FineTuner::process(const IQSampleVector& samples_in,
 }
 
 
+/* ****************  class ChannelPowerMeter  **************** */
+
+// Construct power meter.
+ChannelPowerMeter::ChannelPowerMeter(unsigned int table_size, int freq_shift,
+												 unsigned int length,
+												 unsigned int max_dumps)
+	 : m_length(max(1u, length))
+	 , m_max_dumps(max(1u, max_dumps))
+	 , m_osc(m_length)
+{
+	 // Same oscillator as FineTuner.  Each dump starts at phase 0, the
+	 // power of a dump does not depend on where the oscillator was.
+	 double phase_step = 2.0 * M_PI / double(table_size);
+	 for (unsigned int i = 0; i < m_length; i++) {
+		  int k = (int64_t(i) * freq_shift) % int(table_size);
+		  m_osc[i] = polar(1.0, k * phase_step);
+	 }
+}
+
+
+// Measure channel level.
+double ChannelPowerMeter::process(const IQSampleVector& samples_in) const
+{
+	 unsigned int n = samples_in.size();
+	 unsigned int dumps = min(m_max_dumps, n / m_length);
+
+	 if (dumps == 0)
+		  return 0;
+
+	 unsigned int stride = n / dumps;
+	 const float* osc = reinterpret_cast<const float*>(m_osc.data());
+
+	 double power = 0;
+	 for (unsigned int d = 0; d < dumps; d++) {
+		  const float* x = reinterpret_cast<const float*>(samples_in.data() + d * stride);
+		  float acc_i = 0, acc_q = 0;
+		  for (unsigned int k = 0; k < m_length; k++) {
+				acc_i += x[2*k] * osc[2*k]   - x[2*k+1] * osc[2*k+1];
+				acc_q += x[2*k] * osc[2*k+1] + x[2*k+1] * osc[2*k];
+		  }
+		  power += acc_i * acc_i + acc_q * acc_q;
+	 }
+
+	 return sqrt(power / dumps) / m_length;
+}
+
+
+/* ****************  class FftFilterIQ  **************** */
+
+// Construct overlap-save filter.
+FftFilterIQ::FftFilterIQ(const vector<float>& coeff, unsigned int fft_size)
+	 : m_taps(coeff.size())
+	 , m_fft(fft_size ? fft_size : fft_size_for(coeff.size()))
+	 , m_segment(m_fft.size() - (m_taps - 1))
+	 , m_response(m_fft.size())
+	 , m_hist(m_taps - 1)
+	 , m_buf(m_fft.size())
+{
+	 assert(m_taps > 0 && m_fft.size() > m_taps);
+
+	 // Fold the 1/N of the inverse transform into the response.
+	 float scale = 1.0f / m_fft.size();
+	 for (unsigned int i = 0; i < m_taps; i++)
+		  m_response[i] = coeff[i] * scale;
+	 m_fft.forward(m_response.data());
+}
+
+
+// Transform size for a tap count.
+unsigned int FftFilterIQ::fft_size_for(unsigned int taps)
+{
+	 // Around 8x the taps keeps the overlap small without the transform
+	 // falling out of L1.
+	 unsigned int size = 64;
+	 while (size < 8 * taps)
+		  size *= 2;
+	 return size;
+}
+
+
+// Process samples.
+void FftFilterIQ::process(const IQSampleVector& samples_in,
+								  IQSampleVector& samples_out)
+{
+	 unsigned int hlen = m_taps - 1;
+	 unsigned int nfft = m_fft.size();
+	 unsigned int n = samples_in.size();
+
+	 samples_out.resize(n);
+
+	 // Input sample k lives at m_hist[hlen + k].
+	 m_hist.resize(hlen + n);
+	 copy(samples_in.begin(), samples_in.end(), m_hist.begin() + hlen);
+
+	 float* buf = reinterpret_cast<float*>(m_buf.data());
+	 const float* resp = reinterpret_cast<const float*>(m_response.data());
+
+	 for (unsigned int pos = 0; pos < n; pos += m_segment) {
+		  unsigned int count = min(m_segment, n - pos);
+
+		  // Last segment of a block may be short,  zero fill so the
+		  // circular wrap only touches the discarded first hlen outputs.
+		  copy(m_hist.begin() + pos, m_hist.begin() + pos + hlen + count,
+				 m_buf.begin());
+		  fill(m_buf.begin() + hlen + count, m_buf.end(), IQSample(0));
+
+		  m_fft.forward(m_buf.data());
+
+		  for (unsigned int k = 0; k < nfft; k++) {
+				float xr = buf[2*k],  xi = buf[2*k+1];
+				float hr = resp[2*k], hi = resp[2*k+1];
+				buf[2*k]   = xr * hr - xi * hi;
+				buf[2*k+1] = xr * hi + xi * hr;
+		  }
+
+		  m_fft.inverse(m_buf.data());
+
+		  copy(m_buf.begin() + hlen, m_buf.begin() + hlen + count,
+				 samples_out.begin() + pos);
+	 }
+
+	 // Keep the tail as history for the next block.
+	 copy(m_hist.end() - hlen, m_hist.end(), m_hist.begin());
+}
+
+
+/* ****************  class PolyphaseChannelizer  **************** */
+
+// Construct channelizer.
+PolyphaseChannelizer::PolyphaseChannelizer(unsigned int channels,
+														 unsigned int decimation,
+														 unsigned int taps_per_channel,
+														 double cutoff)
+	 : m_channels(channels)
+	 , m_decim(decimation)
+	 , m_taps(taps_per_channel)
+	 , m_phase(0)
+	 , m_pending(0)
+	 , m_fft(channels)
+	 , m_rotate(channels)
+	 , m_hist(channels * taps_per_channel - 1)
+	 , m_buf(channels)
+{
+	 assert(decimation > 0 && channels % decimation == 0);
+	 assert(taps_per_channel > 0);
+
+	 unsigned int len = m_channels * m_taps;
+
+	 vector<float> proto;
+	 make_lanczos_coeff(len - 1, cutoff, proto);
+
+	 // Reversed so the window over the history lines up with it, doubled
+	 // so I and Q multiply in one pass over floats.
+	 m_coeff.resize(2 * len);
+	 for (unsigned int i = 0; i < len; i++) {
+		  m_coeff[2*i]   = proto[len - 1 - i];
+		  m_coeff[2*i+1] = proto[len - 1 - i];
+	 }
+
+	 for (unsigned int i = 0; i < m_channels; i++)
+		  m_rotate[i] = polar(1.0, -2.0 * M_PI * i / m_channels);
+}
+
+
+// Process samples.
+void PolyphaseChannelizer::process(const IQSampleVector& samples_in,
+											  const vector<unsigned int>& bins,
+											  vector<IQSampleVector>& samples_out)
+{
+	 unsigned int m = m_channels;
+	 unsigned int len = m * m_taps;
+	 unsigned int hlen = len - 1;
+	 unsigned int n = samples_in.size();
+	 unsigned int nbins = bins.size();
+
+	 // Input sample k lives at m_hist[hlen + k].
+	 m_hist.resize(hlen + n);
+	 copy(samples_in.begin(), samples_in.end(), m_hist.begin() + hlen);
+
+	 unsigned int first = m_decim - m_pending;
+	 unsigned int nout = (n >= first) ? 1 + (n - first) / m_decim : 0;
+
+	 samples_out.resize(nbins);
+	 for (unsigned int b = 0; b < nbins; b++) {
+		  assert(bins[b] < m);
+		  samples_out[b].resize(nout);
+	 }
+
+	 float* v = reinterpret_cast<float*>(m_buf.data());
+	 const float* c = m_coeff.data();
+
+	 for (unsigned int i = 0; i < nout; i++) {
+		  // Newest input of this output is sample t of the block.
+		  unsigned int t = first - 1 + i * m_decim;
+		  const float* w = reinterpret_cast<const float*>(m_hist.data() + t);
+
+		  // Window the last len samples and fold them onto m points:
+		  //   v[j] = sum(p) h[p*m + m-1-j] * x[t - p*m - (m-1) + j]
+		  fill(m_buf.begin(), m_buf.end(), IQSample(0));
+		  for (unsigned int p = 0; p < m_taps; p++) {
+				const float* cp = c + 2 * p * m;
+				const float* wp = w + 2 * p * m;
+				for (unsigned int k = 0; k < 2 * m; k++)
+					 v[k] += cp[k] * wp[k];
+		  }
+
+		  m_fft.forward(m_buf.data());
+
+		  // Bin k was mixed down from its centre frequency relative to
+		  // absolute time,  so rotate by the phase that reached by now:
+		  //   y[k] = exp(-2*pi*j*k*(t_abs + 1)/m) * V[k]
+		  unsigned int phase = (m_phase + t + 1) % m;
+		  for (unsigned int b = 0; b < nbins; b++) {
+				unsigned int k = bins[b];
+				samples_out[b][i] = m_buf[k] * m_rotate[(k * phase) % m];
+		  }
+	 }
+
+	 m_phase = (m_phase + n) % m;
+	 m_pending = (m_pending + n) % m_decim;
+
+	 // Keep the tail as history for the next block.
+	 copy(m_hist.end() - hlen, m_hist.end(), m_hist.begin());
+}
+
+
+/* ****************  class PowerSpectrum  **************** */
+
+// Construct power spectrum.
+PowerSpectrum::PowerSpectrum(unsigned int size)
+	 : m_fft(size)
+	 , m_window(size)
+	 , m_buf(size)
+{
+	 double wsum2 = 0;
+	 vector<double> w(size);
+	 for (unsigned int i = 0; i < size; i++) {
+		  w[i] = 0.5 - 0.5 * cos(2 * M_PI * i / size);
+		  wsum2 += w[i] * w[i];
+	 }
+
+	 // |X[k]|^2 of white noise averages sigma^2 * sum(w^2),  fold the
+	 // division by size * sum(w^2) into the window.
+	 double scale = 1.0 / sqrt(size * wsum2);
+	 for (unsigned int i = 0; i < size; i++)
+		  m_window[i] = w[i] * scale;
+}
+
+
+// Average power spectrum over the newest frames of a block.
+unsigned int PowerSpectrum::process(const IQSampleVector& samples_in,
+												vector<float>& power,
+												unsigned int max_frames)
+{
+	 unsigned int size = m_fft.size();
+	 unsigned int frames = min<size_t>(max_frames, samples_in.size() / size);
+
+	 power.assign(size, 0.0f);
+	 if (frames == 0)
+		  return 0;
+
+	 const IQSample* x = samples_in.data() + samples_in.size() - frames * size;
+
+	 for (unsigned int f = 0; f < frames; f++, x += size) {
+		  for (unsigned int i = 0; i < size; i++)
+				m_buf[i] = x[i] * m_window[i];
+
+		  m_fft.forward(m_buf.data());
+
+		  for (unsigned int k = 0; k < size; k++)
+				power[k] += norm(m_buf[k]);
+	 }
+
+	 float scale = 1.0f / frames;
+	 for (unsigned int k = 0; k < size; k++)
+		  power[k] *= scale;
+
+	 return frames;
+}
+
+
+// Power in a band.
+double PowerSpectrum::band_power(const vector<float>& power,
+											double freq, double half_bw)
+{
+	 int size = power.size();
+	 int lo = lrint((freq - half_bw) * size);
+	 int hi = lrint((freq + half_bw) * size);
+
+	 // never count a bin twice
+	 hi = min(hi, lo + size - 1);
+
+	 double sum = 0;
+	 for (int k = lo; k <= hi; k++)
+		  sum += power[((k % size) + size) % size];
+	 return sum;
+}
+
+
 /* ****************  class LowPassFilterFirIQ  **************** */
 
 // Construct low-pass filter.
 LowPassFilterFirIQ::LowPassFilterFirIQ(unsigned int filter_order, double cutoff)
-	 : m_state(filter_order)
+	 : m_order(filter_order)
+	 , m_hist_i(filter_order)
+	 , m_hist_q(filter_order)
 {
 	 make_lanczos_coeff(filter_order, cutoff, m_coeff);
+
+	 if (filter_order + 1 >= fft_min_taps)
+		  m_fft.reset(new FftFilterIQ(m_coeff));
 }
 
 
@@ -102,7 +462,12 @@ LowPassFilterFirIQ::LowPassFilterFirIQ(unsigned int filter_order, double cutoff)
 void LowPassFilterFirIQ::process(const IQSampleVector& samples_in,
 											IQSampleVector& samples_out)
 {
-	 unsigned int order = m_state.size();
+	 if (m_fft) {
+		  m_fft->process(samples_in, samples_out);
+		  return;
+	 }
+
+	 unsigned int order = m_order;
 	 unsigned int n = samples_in.size();
 
 	 samples_out.resize(n);
@@ -110,37 +475,228 @@ void LowPassFilterFirIQ::process(const IQSampleVector& samples_in,
 	 if (n == 0)
 		  return;
 
+	 // Append the new block behind the last (order) input samples so the
+	 // filter never has to switch between state and input.
+	 m_hist_i.resize(order + n);
+	 m_hist_q.resize(order + n);
+	 for (unsigned int i = 0; i < n; i++) {
+		  m_hist_i[order + i] = samples_in[i].real();
+		  m_hist_q[order + i] = samples_in[i].imag();
+	 }
+
 	 // NOTE: We use m_coeff the wrong way around because it is slightly
 	 // faster to scan forward through the array. The result is still correct
 	 // because the coefficients are symmetric.
+	 fir_iq_kernel(m_hist_i.data(), m_hist_q.data(),
+						m_coeff.data(), order + 1, n, samples_out.data());
+
+	 // Keep the tail as history for the next block.
+	 copy(m_hist_i.end() - order, m_hist_i.end(), m_hist_i.begin());
+	 copy(m_hist_q.end() - order, m_hist_q.end(), m_hist_q.begin());
+}
+
+
+/* ****************  class CicDecimatorIQ  **************** */
+
+// Construct CIC decimator.
+CicDecimatorIQ::CicDecimatorIQ(unsigned int decimation, unsigned int stages)
+	 : m_decim(decimation)
+	 , m_stages(stages)
+	 , m_count(0)
+	 , m_integ_i(stages), m_integ_q(stages)
+	 , m_comb_i(stages), m_comb_q(stages)
+{
+	 assert(decimation >= 1);
+	 assert(stages >= 1);
+
+	 // Gain is R**N,  the output has to fit the 32-bit registers with a
+	 // sign bit and one bit for |I|,|Q| <= sqrt(2),  and a spare.  What is
+	 // left below that is the input precision.
+	 unsigned int growth = ceil(stages * log2(double(decimation)));
+	 assert(growth + min_frac_bits <= 29);
+	 unsigned int frac_bits = 29 - growth;
+
+	 m_scale_in  = ldexp(1.0, frac_bits);
+	 m_scale_out = 1.0 / (pow(double(decimation), stages) * m_scale_in);
+}
+
+
+unsigned int CicDecimatorIQ::max_decimation(unsigned int stages)
+{
+	 unsigned int growth = (29 - min_frac_bits) / stages;
+	 return 1u << growth;
+}
+
+
+// Process samples.
+void CicDecimatorIQ::process(const IQSampleVector& samples_in,
+									  IQSampleVector& samples_out)
+{
+	 unsigned int n = samples_in.size();
+
+	 if (m_decim == 1) {
+		  samples_out = samples_in;
+		  return;
+	 }
+
+	 samples_out.resize((n + m_count) / m_decim);
+
+	 // Unsigned arithmetic wraps, the combs undo any integrator overflow.
+	 uint32_t* ii = m_integ_i.data();
+	 uint32_t* iq = m_integ_q.data();
+	 unsigned int stages = m_stages;
+	 unsigned int count = m_count;
+	 unsigned int k = 0;
+
+	 for (unsigned int i = 0; i < n; i++) {
+		  uint32_t xi = (int32_t)lrintf(samples_in[i].real() * m_scale_in);
+		  uint32_t xq = (int32_t)lrintf(samples_in[i].imag() * m_scale_in);
+
+		  ii[0] += xi;
+		  iq[0] += xq;
+		  for (unsigned int s = 1; s < stages; s++) {
+				ii[s] += ii[s-1];
+				iq[s] += iq[s-1];
+		  }
+
+		  if (++count < m_decim)
+				continue;
+		  count = 0;
+
+		  uint32_t yi = ii[stages-1];
+		  uint32_t yq = iq[stages-1];
+		  for (unsigned int s = 0; s < stages; s++) {
+				uint32_t ti = yi - m_comb_i[s];
+				uint32_t tq = yq - m_comb_q[s];
+				m_comb_i[s] = yi;
+				m_comb_q[s] = yq;
+				yi = ti;
+				yq = tq;
+		  }
+
+		  samples_out[k++] = IQSample((int32_t)yi * m_scale_out,
+												(int32_t)yq * m_scale_out);
+	 }
+
+	 assert(k == samples_out.size());
+	 m_count = count;
+}
+
 
-	 // The first few samples need data from m_state.
+/* ****************  class HalfBandDecimatorIQ  **************** */
+
+// Construct half-band decimator.
+HalfBandDecimatorIQ::HalfBandDecimatorIQ(unsigned int filter_order)
+	 : m_order(filter_order)
+	 , m_pos(0)
+	 , m_hist(filter_order)
+{
+	 assert(filter_order % 4 == 2);
+
+	 // Lanczos at cutoff 0.25 puts exact zeros on every even offset from
+	 // the center, keep only the center and the odd offsets.
+	 vector<IQSample::value_type> coeff;
+	 make_lanczos_coeff(filter_order, 0.25, coeff);
+
+	 unsigned int c = filter_order / 2;
+	 m_center = coeff[c];
+	 for (unsigned int k = 1; k <= c; k += 2)
+		  m_pairs.push_back(coeff[c - k]);
+}
+
+
+// Process samples.
+void HalfBandDecimatorIQ::process(const IQSampleVector& samples_in,
+											 IQSampleVector& samples_out)
+{
+	 unsigned int order = m_order;
+	 unsigned int c = order / 2;
+	 unsigned int npairs = m_pairs.size();
+	 unsigned int n = samples_in.size();
+
+	 // Input sample k lives at m_hist[order + k].
+	 m_hist.resize(order + n);
+	 copy(samples_in.begin(), samples_in.end(), m_hist.begin() + order);
+
+	 unsigned int p = m_pos;
+	 samples_out.resize(p < n ? (n - p + 1) / 2 : 0);
+
+	 // Output at input p covers m_hist[p .. p + order], centered at p + c.
 	 unsigned int i = 0;
-	 for (; i < n && i < order; i++) {
-		  IQSample y = 0;
-		  for (unsigned int j = 0; j < order - i; j++)
-				y += m_state[i+j] * m_coeff[j];
-		  for (unsigned int j = order - i; j <= order; j++)
-				y += samples_in[i-order+j] * m_coeff[j];
-		  samples_out[i] = y;
+	 for (; p < n; p += 2, i++) {
+		  const IQSample* x = m_hist.data() + p + c;
+		  IQSample::value_type yi = m_center * x[0].real();
+		  IQSample::value_type yq = m_center * x[0].imag();
+		  for (unsigned int k = 0; k < npairs; k++) {
+				int d = 2 * k + 1;
+				yi += m_pairs[k] * (x[-d].real() + x[d].real());
+				yq += m_pairs[k] * (x[-d].imag() + x[d].imag());
+		  }
+		  samples_out[i] = IQSample(yi, yq);
 	 }
 
-	 // Remaining samples only need data from samples_in.
-	 for (; i < n; i++) {
-		  IQSample y = 0;
-		  IQSampleVector::const_iterator inp = samples_in.begin() + i - order;
-		  for (unsigned int j = 0; j <= order; j++)
-				y += inp[j] * m_coeff[j];
-		  samples_out[i] = y;
+	 m_pos = p - n;
+
+	 // Keep the tail as history for the next block.
+	 copy(m_hist.end() - order, m_hist.end(), m_hist.begin());
+}
+
+
+/* ****************  class DecimatingFrontEnd  **************** */
+
+// Construct front end.
+DecimatingFrontEnd::DecimatingFrontEnd(unsigned int table_size, int freq_shift,
+													unsigned int decimation)
+	 : m_decim(decimation)
+	 , m_tuner(table_size, freq_shift)
+	 , m_cic(decimation > 4 ? min(decimation / 4, CicDecimatorIQ::max_decimation()) : 1)
+{
+	 assert(decimation >= 1 && (decimation & (decimation - 1)) == 0);
+
+	 // The half-bands take care of the last x4 (or all of a smaller factor),
+	 // and whatever the CIC can't do without running out of bits.
+	 unsigned int hb = decimation > 4 ? decimation / min(decimation / 4, CicDecimatorIQ::max_decimation())
+												 : decimation;
+	 for (; hb > 1; hb /= 2)
+		  m_halfbands.emplace_back();
+}
+
+
+// Pick decimation for a minimum output rate.
+unsigned int DecimatingFrontEnd::decimation_for(double sample_rate,
+																double min_sample_rate,
+																unsigned int divisor_of)
+{
+	 unsigned int decim = 1;
+	 while (sample_rate / (2 * decim) >= min_sample_rate && decim < 256
+			  && (divisor_of == 0 || divisor_of % (2 * decim) == 0))
+		  decim *= 2;
+	 return decim;
+}
+
+
+// Process samples.
+void DecimatingFrontEnd::process(const IQSampleVector& samples_in,
+											IQSampleVector& samples_out)
+{
+	 if (m_decim == 1) {
+		  m_tuner.process(samples_in, samples_out);
+		  return;
 	 }
 
-	 // Update m_state.
-	 if (n < order) {
-		  copy(m_state.begin() + n, m_state.end(), m_state.begin());
-		  copy(samples_in.begin(), samples_in.end(), m_state.end() - n);
-	 } else {
-		  copy(samples_in.end() - order, samples_in.end(), m_state.begin());
+	 m_tuner.process(samples_in, m_buf_a);
+
+	 if (m_decim > 4) {
+		  m_cic.process(m_buf_a, m_buf_b);
+		  swap(m_buf_a, m_buf_b);
+	 }
+
+	 for (auto &hb : m_halfbands) {
+		  hb.process(m_buf_a, m_buf_b);
+		  swap(m_buf_a, m_buf_b);
 	 }
+
+	 samples_out.swap(m_buf_a);
 }
 
 
@@ -148,22 +704,20 @@ void LowPassFilterFirIQ::process(const IQSampleVector& samples_in,
 
 // Construct low-pass filter with optional downsampling.
 DownsampleFilter::DownsampleFilter(unsigned int filter_order, double cutoff,
-											  double downsample, bool integer_factor)
+											  unsigned int downsample)
 	 : m_downsample(downsample)
-	 , m_downsample_int(integer_factor ? lrint(downsample) : 0)
-	 , m_pos_int(0)
-	 , m_pos_frac(0)
-	 , m_state(filter_order)
+	 , m_order(filter_order)
+	 , m_pos(0)
+	 , m_hist(filter_order)
 {
 	 assert(downsample >= 1);
 	 assert(filter_order > 1);
 
-	 // Force the first coefficient to zero and append an extra zero at the
-	 // end of the array. This ensures we can always obtain (filter_order+1)
-	 // coefficients by linear interpolation between adjacent array elements.
-	 make_lanczos_coeff(filter_order - 1, cutoff, m_coeff);
-	 m_coeff.insert(m_coeff.begin(), 0);
-	 m_coeff.push_back(0);
+	 SampleVector coeff;
+	 make_lanczos_coeff(filter_order - 1, cutoff, coeff);
+
+	 // Reversed taps let us run a forward dot product over the history.
+	 m_coeff_rev.assign(coeff.rbegin(), coeff.rend());
 }
 
 
@@ -171,95 +725,93 @@ DownsampleFilter::DownsampleFilter(unsigned int filter_order, double cutoff,
 void DownsampleFilter::process(const SampleVector& samples_in,
 										 SampleVector& samples_out)
 {
-	 unsigned int order = m_state.size();
+	 unsigned int order = m_order;
 	 unsigned int n = samples_in.size();
 
-	 if (m_downsample_int != 0) {
-
-		  // Integer downsample factor, no linear interpolation.
-		  // This is relatively simple.
-
-		  unsigned int p = m_pos_int;
-		  unsigned int pstep = m_downsample_int;
-
-		  samples_out.resize((n - p + pstep - 1) / pstep);
+	 // History is the last (order) input samples followed by this block,
+	 // so input sample k lives at m_hist[order + k].
+	 m_hist.resize(order + n);
+	 copy(samples_in.begin(), samples_in.end(), m_hist.begin() + order);
 
-		  // The first few samples need data from m_state.
-		  unsigned int i = 0;
-		  for (; p < n && p < order; p += pstep, i++) {
-				Sample y = 0;
-				for (unsigned int j = 1; j <= p; j++)
-					 y += samples_in[p-j] * m_coeff[j];
-				for (unsigned int j = p + 1; j <= order; j++)
-					 y += m_state[order+p-j] * m_coeff[j];
-				samples_out[i] = y;
-		  }
+	 unsigned int p = m_pos;
+	 unsigned int pstep = m_downsample;
 
-		  // Remaining samples only need data from samples_in.
-		  for (; p < n; p += pstep, i++) {
-				Sample y = 0;
-				for (unsigned int j = 1; j <= order; j++)
-					 y += samples_in[p-j] * m_coeff[j];
-				samples_out[i] = y;
-		  }
+	 samples_out.resize(p < n ? (n - p + pstep - 1) / pstep : 0);
 
-		  assert(i == samples_out.size());
+	 //   y = sum(j = 1 .. order) in[p-j] * coeff[j-1]
+	 //     = sum(k = 0 .. order-1) m_hist[p+k] * coeff_rev[k]
+	 unsigned int i = 0;
+	 for (; p < n; p += pstep, i++) {
+		  samples_out[i] = dot_product(m_hist.data() + p,
+												 m_coeff_rev.data(), order);
+	 }
 
-		  // Update index of start position in text sample block.
-		  m_pos_int = p - n;
+	 assert(i == samples_out.size());
 
-	 } else {
+	 // Update index of start position in text sample block.
+	 m_pos = p - n;
 
-		  // Fractional downsample factor via linear interpolation of
-		  // the FIR coefficient table. This is a bitch.
+	 // Keep the tail as history for the next block.
+	 copy(m_hist.end() - order, m_hist.end(), m_hist.begin());
+}
 
-		  // Estimate number of output samples we can produce in this run.
-		  Sample p = m_pos_frac;
-		  Sample pstep = m_downsample;
-		  unsigned int n_out = int(2 + n / pstep);
 
-		  samples_out.resize(n_out);
+/* ****************  class PolyphaseResampler  **************** */
 
-		  // Produce output samples.
-		  unsigned int i = 0;
-		  Sample pf = p;
-		  unsigned int pi = int(pf);
-		  while (pi < n) {
-				Sample k1 = pf - pi;
-				Sample k0 = 1 - k1;
+// Construct polyphase resampler.
+PolyphaseResampler::PolyphaseResampler(double sample_rate_in,
+													double sample_rate_out,
+													unsigned int filter_order,
+													double cutoff)
+	 : m_taps(filter_order)
+	 , m_index(0)
+	 , m_phase(0)
+{
+	 // Banks are walked forward over the history in process().
+	 vector<double> banks;
+	 make_polyphase_banks(sample_rate_in, sample_rate_out, m_taps, cutoff,
+								 max_interpolation, m_interp, m_decim, banks);
+	 m_banks.assign(banks.begin(), banks.end());
 
-				Sample y = 0;
-				for (unsigned int j = 0; j <= order; j++) {
-					 Sample k = m_coeff[j] * k0 + m_coeff[j+1] * k1;
-					 Sample s = (j <= pi) ? samples_in[pi-j] : m_state[order+pi-j];
-					 y += k * s;
-				}
-				samples_out[i] = y;
+	 m_hist.resize(m_taps - 1);
+}
 
-				i++;
-				pf = p + i * pstep;
-				pi = int(pf);
-		  }
 
-		  // We may overestimate the number of samples by 1 or 2.
-		  assert(i <= n_out && i + 2 >= n_out);
-		  samples_out.resize(i);
+// Process samples.
+void PolyphaseResampler::process(const SampleVector& samples_in,
+											SampleVector& samples_out)
+{
+	 unsigned int hlen = m_taps - 1;
+	 unsigned int n = samples_in.size();
 
-		  // Update fractional index of start position in text sample block.
-		  // Limit to 0 to avoid catastrophic results of rounding errors.
-		  m_pos_frac = pf - n;
-		  if (m_pos_frac < 0)
-				m_pos_frac = 0;
+	 // Input sample k lives at m_hist[hlen + k],  so output at input index
+	 // i reads m_hist[i .. i + hlen].
+	 m_hist.resize(hlen + n);
+	 copy(samples_in.begin(), samples_in.end(), m_hist.begin() + hlen);
+
+	 // Outputs fall at (index * L + phase) + k * M on the upsampled grid.
+	 uint64_t start = uint64_t(m_index) * m_interp + m_phase;
+	 uint64_t end   = uint64_t(n) * m_interp;
+	 unsigned int n_out = start < end ? (end - start + m_decim - 1) / m_decim : 0;
+
+	 samples_out.resize(n_out);
+
+	 unsigned int index = m_index;
+	 unsigned int phase = m_phase;
+	 for (unsigned int i = 0; i < n_out; i++) {
+		  samples_out[i] = dot_product(m_hist.data() + index,
+												 m_banks.data() + phase * m_taps,
+												 m_taps);
+		  phase += m_decim;
+		  index += phase / m_interp;
+		  phase %= m_interp;
 	 }
 
-	 // Update m_state.
-	 if (n < order) {
-		  copy(m_state.begin() + n, m_state.end(), m_state.begin());
-		  copy(samples_in.begin(), samples_in.end(), m_state.end() - n);
-	 } else {
-		  copy(samples_in.end() - order, samples_in.end(), m_state.begin());
-	 }
+	 m_index = index - n;
+	 m_phase = phase;
 
+	 // Keep the tail as history for the next block.
+	 copy(m_hist.end() - hlen, m_hist.end(), m_hist.begin());
 }
 
 
@@ -269,13 +821,6 @@ void DownsampleFilter::process(const SampleVector& samples_in,
 LowPassFilterRC::LowPassFilterRC(double timeconst)
 	 : m_timeconst(timeconst)
 	 , m_y1(0)
-{
-}
-
-
-// Process samples.
-void LowPassFilterRC::process(const SampleVector& samples_in,
-										SampleVector& samples_out)
 {
 	 /*
 	  * Continuous domain:
@@ -284,15 +829,24 @@ void LowPassFilterRC::process(const SampleVector& samples_in,
 	  * Discrete domain:
 	  *   H(z) = (1 - exp(-1/timeconst)) / (1 - exp(-1/timeconst) / z)
 	  */
-	 Sample a1 = - exp(-1/m_timeconst);;
-	 Sample b0 = 1 + a1;
+	 m_a1 = - exp(-1/m_timeconst);
+	 m_b0 = 1 + m_a1;
+}
+
+
+// Process samples.
+void LowPassFilterRC::process(const SampleVector& samples_in,
+										SampleVector& samples_out)
+{
+	 double a1 = m_a1;
+	 double b0 = m_b0;
 
 	 unsigned int n = samples_in.size();
 	 samples_out.resize(n);
 
-	 Sample y = m_y1;
+	 double y = m_y1;
 	 for (unsigned int i = 0; i < n; i++) {
-		  Sample x = samples_in[i];
+		  double x = samples_in[i];
 		  y = b0 * x - a1 * y;
 		  samples_out[i] = y;
 	 }
@@ -304,14 +858,14 @@ void LowPassFilterRC::process(const SampleVector& samples_in,
 // Process samples in-place.
 void LowPassFilterRC::process_inplace(SampleVector& samples)
 {
-	 Sample a1 = - exp(-1/m_timeconst);;
-	 Sample b0 = 1 + a1;
+	 double a1 = m_a1;
+	 double b0 = m_b0;
 
 	 unsigned int n = samples.size();
 
-	 Sample y = m_y1;
+	 double y = m_y1;
 	 for (unsigned int i = 0; i < n; i++) {
-		  Sample x = samples[i];
+		  double x = samples[i];
 		  y = b0 * x - a1 * y;
 		  samples[i] = y;
 	 }
@@ -372,8 +926,8 @@ void LowPassFilterIir::process(const SampleVector& samples_in,
 	 samples_out.resize(n);
 
 	 for (unsigned int i = 0; i < n; i++) {
-		  Sample x = samples_in[i];
-		  Sample y = b0 * x - a1 * y1 - a2 * y2 - a3 * y3 - a4 * y4;
+		  double x = samples_in[i];
+		  double y = b0 * x - a1 * y1 - a2 * y2 - a3 * y3 - a4 * y4;
 		  y4 = y3; y3 = y2; y2 = y1; y1 = y;
 		  samples_out[i] = y;
 	 }
@@ -431,8 +985,8 @@ void HighPassFilterIir::process(const SampleVector& samples_in,
 	 samples_out.resize(n);
 
 	 for (unsigned int i = 0; i < n; i++) {
-		  Sample x = samples_in[i];
-		  Sample y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+		  double x = samples_in[i];
+		  double y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
 		  x2 = x1; x1 = x;
 		  y2 = y1; y1 = y;
 		  samples_out[i] = y;
@@ -446,12 +1000,179 @@ void HighPassFilterIir::process_inplace(SampleVector& samples)
 	 unsigned int n = samples.size();
 
 	 for (unsigned int i = 0; i < n; i++) {
-		  Sample x = samples[i];
-		  Sample y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+		  double x = samples[i];
+		  double y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
 		  x2 = x1; x1 = x;
 		  y2 = y1; y1 = y;
 		  samples[i] = y;
 	 }
 }
 
+
+/* ****************  class StereoDemuxFilter  **************** */
+
+// Construct stereo demultiplexer.
+StereoDemuxFilter::StereoDemuxFilter(double sample_rate_in,
+												 double sample_rate_out,
+												 unsigned int filter_order,
+												 double cutoff,
+												 double dcblock_cutoff,
+												 double deemphasis)
+	 : m_taps(filter_order)
+	 , m_index(0)
+	 , m_phase(0)
+	 , m_dcblock_mono(dcblock_cutoff)
+	 , m_dcblock_stereo(dcblock_cutoff)
+	 , m_deemph_mono(deemphasis)
+	 , m_deemph_stereo(deemphasis)
+{
+	 vector<double> banks;
+	 make_polyphase_banks(sample_rate_in, sample_rate_out, m_taps, cutoff,
+								 PolyphaseResampler::max_interpolation,
+								 m_interp, m_decim, banks);
+
+	 // Duplicate each tap for the mono and L-R lanes.
+	 m_banks.resize(2 * banks.size());
+	 for (unsigned int i = 0; i < banks.size(); i++) {
+		  m_banks[2*i]   = banks[i];
+		  m_banks[2*i+1] = banks[i];
+	 }
+
+	 m_hist.resize(2 * (m_taps - 1));
+}
+
+
+// Process samples.
+void StereoDemuxFilter::process(const SampleVector& samples_baseband,
+										  const SampleVector& samples_pilot,
+										  bool stereo, SampleVector& audio)
+{
+	 unsigned int hlen = 2 * (m_taps - 1);
+	 unsigned int n = samples_baseband.size();
+	 assert(n == samples_pilot.size());
+
+	 // Demodulate L-R straight into the history,  multiplying with the
+	 // double-frequency pilot and by two to get the full amplitude.
+	 m_hist.resize(hlen + 2 * n);
+	 Sample* hist = m_hist.data() + hlen;
+	 for (unsigned int i = 0; i < n; i++) {
+		  Sample b = samples_baseband[i];
+		  hist[2*i]   = b;
+		  hist[2*i+1] = 2 * b * samples_pilot[i];
+	 }
+
+	 // Same output grid as PolyphaseResampler.
+	 uint64_t start = uint64_t(m_index) * m_interp + m_phase;
+	 uint64_t end   = uint64_t(n) * m_interp;
+	 unsigned int n_out = start < end ? (end - start + m_decim - 1) / m_decim : 0;
+
+	 audio.resize(2 * n_out);
+
+	 unsigned int index = m_index;
+	 unsigned int phase = m_phase;
+	 for (unsigned int i = 0; i < n_out; i++) {
+		  Sample m, s;
+		  dot_product2(m_hist.data() + 2 * index,
+							m_banks.data() + 2 * phase * m_taps,
+							m_taps, m, s);
+
+		  // DC blocking and de-emphasis.
+		  double mono = m_deemph_mono.process_sample(m_dcblock_mono.process_sample(m));
+		  double diff = m_deemph_stereo.process_sample(m_dcblock_stereo.process_sample(s));
+
+		  if (!stereo)
+				diff = 0;
+
+		  // Extract left/right channels from mono/stereo signals.
+		  audio[2*i]   = mono + diff;
+		  audio[2*i+1] = mono - diff;
+
+		  phase += m_decim;
+		  index += phase / m_interp;
+		  phase %= m_interp;
+	 }
+
+	 m_index = index - n;
+	 m_phase = phase;
+
+	 // Keep the tail as history for the next block.
+	 copy(m_hist.end() - hlen, m_hist.end(), m_hist.begin());
+}
+
+
+/* ****************  class DriftResampler  **************** */
+
+// Construct variable ratio resampler.
+DriftResampler::DriftResampler(unsigned int taps, unsigned int phases)
+	 : m_taps(taps)
+	 , m_phases(phases)
+	 , m_ratio(1.0)
+	 , m_pos(0)
+{
+	 assert(taps > 1 && phases > 0);
+
+	 // One extra bank so the blend at the last phase has a right neighbour,
+	 // it is bank 0 one input sample further on.
+	 vector<double> proto;
+	 make_lanczos_coeff(taps * phases, 0.45 / phases, proto);
+
+	 m_banks.resize(2 * (phases + 1) * taps);
+	 for (unsigned int p = 0; p <= phases; p++) {
+		  for (unsigned int t = 0; t < taps; t++) {
+				Sample c = proto[p + t * phases] * phases;
+				unsigned int k = 2 * (p * taps + (taps - 1 - t));
+				m_banks[k]   = c;
+				m_banks[k+1] = c;
+		  }
+	 }
+
+	 reset();
+}
+
+
+// Forget history.
+void DriftResampler::reset()
+{
+	 m_pos = 0;
+	 m_hist.assign(2 * (m_taps - 1), 0);
+}
+
+
+// Process samples.
+void DriftResampler::process(const SampleVector& samples_in,
+									  SampleVector& samples_out)
+{
+	 unsigned int hlen = 2 * (m_taps - 1);
+	 unsigned int n = samples_in.size() / 2;
+
+	 m_hist.resize(hlen + 2 * n);
+	 copy(samples_in.begin(), samples_in.begin() + 2 * n, m_hist.begin() + hlen);
+
+	 double step = 1.0 / m_ratio;
+	 samples_out.resize(2 * (unsigned int)(ceil((n - m_pos) * m_ratio) + 1));
+
+	 unsigned int i = 0;
+	 double pos = m_pos;
+	 for (; pos < n; pos += step, i++) {
+		  unsigned int index = (unsigned int)pos;
+		  double f = (pos - index) * m_phases;
+		  unsigned int phase = (unsigned int)f;
+		  Sample w = f - phase;
+
+		  Sample l0, r0, l1, r1;
+		  const Sample* x = m_hist.data() + 2 * index;
+		  dot_product2(x, m_banks.data() + 2 * phase * m_taps, m_taps, l0, r0);
+		  dot_product2(x, m_banks.data() + 2 * (phase + 1) * m_taps, m_taps, l1, r1);
+
+		  samples_out[2*i]   = l0 + w * (l1 - l0);
+		  samples_out[2*i+1] = r0 + w * (r1 - r0);
+	 }
+
+	 samples_out.resize(2 * i);
+	 m_pos = pos - n;
+
+	 // Keep the tail as history for the next block.
+	 copy(m_hist.end() - hlen, m_hist.end(), m_hist.begin());
+}
+
 /* end */
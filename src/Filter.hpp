@@ -1,7 +1,10 @@
 #ifndef SOFTFM_FILTER_H
 #define SOFTFM_FILTER_H
 
+#include <cstdint>
+#include <memory>
 #include <vector>
+#include "FFT.hpp"
 #include "IQSample.h"
 
 
@@ -30,7 +33,185 @@ private:
 };
 
 
-/** Low-pass filter for IQ samples, based on Lanczos FIR filter. */
+/**
+ *  FIR filter for IQ samples using overlap-save fast convolution.
+ *
+ *  Cost per sample grows with log(taps) instead of taps, which pays off
+ *  for long channel filters.  Same output as the direct form up to float
+ *  rounding, with no added latency: a short tail of a block is run as a
+ *  partially filled segment rather than held back.
+ */
+class FftFilterIQ
+{
+public:
+
+	 /**
+	  * Construct filter.
+	  *
+	  * coeff    :: FIR taps in convolution order.
+	  * fft_size :: Transform size, power of 2 larger than the tap count,
+	  *             or 0 to pick one.
+	  */
+	 FftFilterIQ(const std::vector<float>& coeff, unsigned int fft_size = 0);
+
+	 /** Process samples. */
+	 void process(const IQSampleVector& samples_in, IQSampleVector& samples_out);
+
+	 /** Transform size chosen for a given tap count. */
+	 static unsigned int fft_size_for(unsigned int taps);
+
+private:
+	 unsigned int    m_taps;
+	 FFT             m_fft;
+	 unsigned int    m_segment;      // new samples per transform
+	 IQSampleVector  m_response;     // filter spectrum,  scaled by 1/N
+	 IQSampleVector  m_hist;         // last (taps - 1) samples + block
+	 IQSampleVector  m_buf;
+};
+
+
+/**
+ *  Polyphase analysis filter bank.
+ *
+ *  Splits a wideband IQ stream into equally spaced channels, bin k being
+ *  centred on k * sample_rate / channels (bins above channels/2 are the
+ *  negative frequencies).  Each output is decimated by decimation; with
+ *  decimation below channels the bins overlap, so a station anywhere
+ *  between two bin centres still falls inside one bin's flat passband.
+ *
+ *  One prototype low-pass serves all bins: per output it costs one pass of
+ *  taps_per_channel * channels multiplies plus one FFT, however many
+ *  bins are read out.
+ */
+class PolyphaseChannelizer
+{
+public:
+
+	 /**
+	  * Construct channelizer.
+	  *
+	  * channels         :: Number of bins,  power of 2.
+	  * decimation       :: Input samples per output sample,  must divide
+	  *                     channels.
+	  * taps_per_channel :: Prototype filter length in units of channels.
+	  * cutoff           :: Prototype cutoff relative to the input rate.
+	  */
+	 PolyphaseChannelizer(unsigned int channels, unsigned int decimation,
+								 unsigned int taps_per_channel, double cutoff);
+
+	 /**
+	  * Process samples.
+	  *
+	  * bins        :: Bins to read out.
+	  * samples_out :: One vector per entry of bins,  each at
+	  *                sample_rate / decimation.
+	  */
+	 void process(const IQSampleVector& samples_in,
+					  const std::vector<unsigned int>& bins,
+					  std::vector<IQSampleVector>& samples_out);
+
+	 unsigned int channels() const { return m_channels; }
+	 unsigned int decimation() const { return m_decim; }
+
+private:
+	 unsigned int        m_channels;     // M
+	 unsigned int        m_decim;        // D
+	 unsigned int        m_taps;         // taps per branch
+	 unsigned int        m_phase;        // input samples seen, modulo M
+	 unsigned int        m_pending;      // input samples since last output
+	 FFT                 m_fft;
+	 std::vector<float>  m_coeff;        // reversed prototype, every tap twice
+	 IQSampleVector      m_rotate;       // exp(-2*pi*j*i/M)
+	 IQSampleVector      m_hist;         // last M*taps - 1 samples + block
+	 IQSampleVector      m_buf;
+};
+
+
+/**
+ *  Averaged power spectrum of IQ samples.
+ *
+ *  Hann windowed frames, bins in FFT order: bin k is at
+ *  k * sample_rate / size,  the upper half being negative frequencies.
+ *  Scaled so the bins covering a band add up to the mean power of the
+ *  signal in that band,  the square of what an IF filter's RMS level
+ *  would read.
+ */
+class PowerSpectrum
+{
+public:
+
+	 /** Construct spectrum of size bins,  power of 2. */
+	 PowerSpectrum(unsigned int size);
+
+	 /**
+	  * Average up to max_frames back to back frames taken from the end of
+	  * samples_in,  the newest samples.  Returns the number of frames
+	  * used,  0 if the block is shorter than one frame.
+	  */
+	 unsigned int process(const IQSampleVector& samples_in,
+								 std::vector<float>& power,
+								 unsigned int max_frames = 8);
+
+	 /**
+	  * Return the power in a band.
+	  *
+	  * freq    :: Band centre relative to the sample rate (-0.5 ... 0.5).
+	  * half_bw :: Half bandwidth relative to the sample rate.
+	  */
+	 static double band_power(const std::vector<float>& power,
+									  double freq, double half_bw);
+
+	 unsigned int size() const { return m_fft.size(); }
+
+private:
+	 FFT                 m_fft;
+	 std::vector<float>  m_window;       // Hann,  scaled
+	 IQSampleVector      m_buf;
+};
+
+
+/**
+ *  Cheap channel power estimate for squelch decisions.
+ *
+ *  Mixes a short stretch of input to DC and integrates it, a boxcar filter
+ *  whose noise bandwidth is sample_rate / length.  A handful of such dumps
+ *  spread over the block give an RMS level on the same scale as the IF
+ *  filter output,  at a tiny fraction of the cost of the IF chain.
+ */
+class ChannelPowerMeter
+{
+public:
+
+	 /**
+	  * Construct power meter.
+	  *
+	  * table_size :: As for FineTuner.
+	  * freq_shift :: As for FineTuner,  moves the channel to DC.
+	  * length     :: Samples per dump,  sample_rate / (2 * IF half bandwidth)
+	  *               gives the noise bandwidth of that IF filter.
+	  * max_dumps  :: Dumps per block,  spread evenly over the block.
+	  */
+	 ChannelPowerMeter(unsigned int table_size, int freq_shift,
+							 unsigned int length, unsigned int max_dumps = 64);
+
+	 /** Return RMS channel level of the block (full scale IQ is 1.0). */
+	 double process(const IQSampleVector& samples_in) const;
+
+private:
+	 unsigned int    m_length;
+	 unsigned int    m_max_dumps;
+	 IQSampleVector  m_osc;          // m_length samples of the mixer
+};
+
+
+/**
+ *  Low-pass filter for IQ samples, based on Lanczos FIR filter.
+ *
+ *  History is kept contiguous and split into I and Q arrays so the inner
+ *  loop computes several output samples per SIMD register (NEON or SSE2,
+ *  scalar otherwise).  Each lane sums in tap order, so results match the
+ *  plain loop bit for bit when built without -ffast-math.
+ */
 class LowPassFilterFirIQ
 {
 public:
@@ -47,9 +228,138 @@ public:
 	 /** Process samples. */
 	 void process(const IQSampleVector& samples_in, IQSampleVector& samples_out);
 
+	 /**
+	  * Filters with at least this many taps run as FftFilterIQ.
+	  * On SSE2 the direct form costs ~0.23 ns per tap per sample and
+	  * overlap-save a flat 16..19 ns per sample from 32 up to 256 taps,
+	  * they meet between 64 (15.5 vs 18 ns) and 96 taps (23 vs 17 ns).
+	  */
+	 static constexpr unsigned int fft_min_taps = 80;
+
 private:
+	 unsigned int    m_order;
 	 std::vector<IQSample::value_type> m_coeff;
-	 IQSampleVector  m_state;
+	 std::vector<IQSample::value_type> m_hist_i;
+	 std::vector<IQSample::value_type> m_hist_q;
+	 std::unique_ptr<FftFilterIQ> m_fft;
+};
+
+
+/**
+ *  CIC decimator for IQ samples.
+ *
+ *  Runs in wrapping 32-bit fixed point so the integrators never lose
+ *  precision, output is scaled back to unit DC gain.
+ */
+class CicDecimatorIQ
+{
+public:
+
+	 /**
+	  * Construct CIC decimator.
+	  *
+	  * decimation :: Decimation factor R (>= 1, 1 passes samples through),
+	  *               at most max_decimation(stages).
+	  * stages     :: Number of integrator/comb pairs N.
+	  */
+	 CicDecimatorIQ(unsigned int decimation, unsigned int stages = 4);
+
+	 /**
+	  * Largest power of two R whose gain R**N leaves min_frac_bits of
+	  * input precision in the 32-bit registers.
+	  */
+	 static unsigned int max_decimation(unsigned int stages = 4);
+
+	 /** Fraction bits kept below the input full scale of 1.0. */
+	 static constexpr unsigned int min_frac_bits = 8;
+
+	 /** Process samples. */
+	 void process(const IQSampleVector& samples_in, IQSampleVector& samples_out);
+
+private:
+	 unsigned int    m_decim;
+	 unsigned int    m_stages;
+	 unsigned int    m_count;
+	 float           m_scale_in;
+	 float           m_scale_out;
+	 std::vector<uint32_t> m_integ_i, m_integ_q;
+	 std::vector<uint32_t> m_comb_i, m_comb_q;
+};
+
+
+/**
+ *  Decimate-by-2 half-band FIR for IQ samples.
+ *
+ *  Every other tap of a half-band filter is zero, so each output costs
+ *  one multiply per symmetric tap pair plus the center tap.
+ */
+class HalfBandDecimatorIQ
+{
+public:
+
+	 /**
+	  * Construct half-band decimator.
+	  *
+	  * filter_order :: FIR filter order,  must be 2 mod 4 (6, 10, 14, ...).
+	  */
+	 HalfBandDecimatorIQ(unsigned int filter_order = 22);
+
+	 /** Process samples. */
+	 void process(const IQSampleVector& samples_in, IQSampleVector& samples_out);
+
+private:
+	 unsigned int    m_order;
+	 unsigned int    m_pos;
+	 IQSample::value_type m_center;
+	 std::vector<IQSample::value_type> m_pairs;   // taps at center-1, -3, ...
+	 IQSampleVector  m_hist;
+};
+
+
+/**
+ *  Decimating IQ front end:  NCO mix, CIC, then a half-band cascade.
+ *
+ *  Brings the IQ stream down to the lowest rate a mode needs so the
+ *  channel filter and discriminator run at that rate instead of the
+ *  dongle rate.  Large factors use the CIC for all but the last x4,
+ *  which the half-bands do to clean up CIC droop and aliasing.  Past
+ *  CicDecimatorIQ::max_decimation() more half-bands take the rest.
+ */
+class DecimatingFrontEnd
+{
+public:
+
+	 /**
+	  * Construct front end.
+	  *
+	  * table_size :: NCO table size (see FineTuner).
+	  * freq_shift :: NCO frequency shift in table steps (see FineTuner).
+	  * decimation :: Total decimation,  a power of two (1 to only mix).
+	  */
+	 DecimatingFrontEnd(unsigned int table_size, int freq_shift,
+							  unsigned int decimation);
+
+	 /**
+	  * Largest power of two decimation that keeps the output rate at or
+	  * above min_sample_rate,  and divides divisor_of when that isn't 0
+	  * (a decoder's total downsampling,  the rest is done after it).
+	  */
+	 static unsigned int decimation_for(double sample_rate,
+													double min_sample_rate,
+													unsigned int divisor_of = 0);
+
+	 /** Process samples. */
+	 void process(const IQSampleVector& samples_in, IQSampleVector& samples_out);
+
+	 unsigned int decimation() const { return m_decim; }
+
+private:
+	 unsigned int    m_decim;
+	 FineTuner       m_tuner;
+	 CicDecimatorIQ  m_cic;
+	 std::vector<HalfBandDecimatorIQ> m_halfbands;
+	 IQSampleVector  m_buf_a;
+	 IQSampleVector  m_buf_b;
 };
 
 
@@ -57,7 +367,9 @@ private:
  *  Downsampler with low-pass FIR filter for real-valued signals.
  *
  *  Step 1: Low-pass filter based on Lanczos FIR filter
- *  Step 2: (optional) Decimation by an arbitrary factor (integer or float)
+ *  Step 2: (optional) Decimation by an integer factor
+ *
+ *  Use PolyphaseResampler for non-integer rate changes.
  */
 class DownsampleFilter
 {
@@ -70,24 +382,66 @@ public:
 	  * cutoff       :: Cutoff frequency relative to the full input sample rate
 	  *                 (valid range 0.0 .. 0.5)
 	  * downsample   :: Decimation factor (>= 1) or 1 to disable
-	  * integer_factor :: Enables a faster and more precise algorithm that
-	  *                   only works for integer downsample factors.
 	  *
 	  * The output sample rate is (input_sample_rate / downsample)
 	  */
 	 DownsampleFilter(unsigned int filter_order, double cutoff,
-							double downsample=1, bool integer_factor=true);
+							unsigned int downsample=1);
 
 	 /** Process samples. */
 	 void process(const SampleVector& samples_in, SampleVector& samples_out);
 
 private:
-	 double          m_downsample;
-	 unsigned int    m_downsample_int;
-	 unsigned int    m_pos_int;
-	 Sample          m_pos_frac;
-	 SampleVector    m_coeff;
-	 SampleVector    m_state;
+	 unsigned int    m_downsample;
+	 unsigned int    m_order;
+	 unsigned int    m_pos;
+	 SampleVector    m_coeff_rev;    // taps, last to first
+	 SampleVector    m_hist;         // last order samples + current block
+};
+
+
+/**
+ *  Polyphase rational resampler for real-valued signals.
+ *
+ *  Conceptually upsamples by L, applies a Lanczos low-pass filter and
+ *  decimates by M.  The filter is split into L coefficient banks up front,
+ *  so each output sample is one branch-free dot product over the input
+ *  history.
+ */
+class PolyphaseResampler
+{
+public:
+
+	 /** Largest interpolation factor before the ratio gets approximated. */
+	 static constexpr unsigned int max_interpolation = 1024;
+
+	 /**
+	  * Construct resampler.
+	  *
+	  * sample_rate_in  :: Input sample rate in Hz
+	  * sample_rate_out :: Output sample rate in Hz.  The ratio is reduced to
+	  *                    L/M,  e.g. 250 kHz -> 48 kHz is 24/125.
+	  * filter_order    :: FIR filter order at the input sample rate
+	  * cutoff          :: Cutoff frequency relative to the input sample rate
+	  *                    (valid range 0.0 .. 0.5)
+	  */
+	 PolyphaseResampler(double sample_rate_in, double sample_rate_out,
+							  unsigned int filter_order, double cutoff);
+
+	 /** Process samples. */
+	 void process(const SampleVector& samples_in, SampleVector& samples_out);
+
+	 unsigned int interpolation() const { return m_interp; }
+	 unsigned int decimation() const { return m_decim; }
+
+private:
+	 unsigned int    m_interp;       // L
+	 unsigned int    m_decim;        // M
+	 unsigned int    m_taps;         // taps per phase
+	 unsigned int    m_index;        // input index of next output
+	 unsigned int    m_phase;        // bank of next output, 0 .. L-1
+	 SampleVector    m_banks;        // L banks of m_taps, reversed
+	 SampleVector    m_hist;         // last (m_taps - 1) samples + block
 };
 
 
@@ -109,9 +463,17 @@ public:
 	 /** Process samples in-place. */
 	 void process_inplace(SampleVector& samples);
 
+	 /** Process a single sample. */
+	 double process_sample(double x)
+	 {
+		  m_y1 = m_b0 * x - m_a1 * m_y1;
+		  return m_y1;
+	 }
+
 private:
 	 double  m_timeconst;
-	 Sample  m_y1;
+	 double  m_b0, m_a1;
+	 double  m_y1;
 };
 
 
@@ -132,8 +494,8 @@ public:
 	 void process(const SampleVector& samples_in, SampleVector& samples_out);
 
 private:
-	 Sample  b0, a1, a2, a3, a4;
-	 Sample  y1, y2, y3, y4;
+	 double  b0, a1, a2, a3, a4;
+	 double  y1, y2, y3, y4;
 };
 
 
@@ -156,9 +518,116 @@ public:
 	 /** Process samples in-place. */
 	 void process_inplace(SampleVector& samples);
 
+	 /** Process a single sample. */
+	 double process_sample(double x)
+	 {
+		  double y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+		  x2 = x1; x1 = x;
+		  y2 = y1; y1 = y;
+		  return y;
+	 }
+
+private:
+	 double b0, b1, b2, a1, a2;
+	 double x1, x2, y1, y2;
+};
+
+
+/**
+ *  FM stereo demultiplexer.
+ *
+ *  Does in two passes over the block what used to take one pass per step:
+ *  L-R demodulation, resampling of the mono and L-R channels, DC blocking,
+ *  de-emphasis and the L/R matrix.  Both channels share one polyphase walk
+ *  over an interleaved history, so each tap is a single SIMD multiply for
+ *  mono and L-R together.
+ */
+class StereoDemuxFilter
+{
+public:
+
+	 /**
+	  * Construct stereo demultiplexer.
+	  *
+	  * sample_rate_in  :: Baseband sample rate in Hz
+	  * sample_rate_out :: Audio sample rate in Hz
+	  * filter_order    :: FIR filter order at the baseband rate
+	  * cutoff          :: Audio cutoff relative to the baseband rate
+	  * dcblock_cutoff  :: DC blocking cutoff relative to the audio rate
+	  * deemphasis      :: De-emphasis RC time constant in audio samples,
+	  *                    1.0 to disable
+	  */
+	 StereoDemuxFilter(double sample_rate_in, double sample_rate_out,
+							 unsigned int filter_order, double cutoff,
+							 double dcblock_cutoff, double deemphasis);
+
+	 /**
+	  * Process samples.
+	  *
+	  * samples_baseband :: FM baseband multiplex
+	  * samples_pilot    :: Double-frequency pilot from PilotPhaseLock
+	  * stereo           :: Output left/right, else mono in both channels.
+	  *                     The L-R channel is filtered either way so the
+	  *                     switch over is seamless.
+	  * audio            :: Interleaved left/right output
+	  */
+	 void process(const SampleVector& samples_baseband,
+					  const SampleVector& samples_pilot,
+					  bool stereo, SampleVector& audio);
+
+private:
+	 unsigned int    m_interp;       // L
+	 unsigned int    m_decim;        // M
+	 unsigned int    m_taps;         // taps per phase
+	 unsigned int    m_index;        // input index of next output
+	 unsigned int    m_phase;        // bank of next output, 0 .. L-1
+	 SampleVector    m_banks;        // L banks of m_taps, every tap twice
+	 SampleVector    m_hist;         // mono, L-R pairs
+
+	 HighPassFilterIir  m_dcblock_mono;
+	 HighPassFilterIir  m_dcblock_stereo;
+	 LowPassFilterRC    m_deemph_mono;
+	 LowPassFilterRC    m_deemph_stereo;
+};
+
+
+/**
+ *  Variable ratio resampler for interleaved stereo audio.
+ *
+ *  Trims the rate by a few hundred ppm so the audio output can follow the
+ *  sound card clock instead of the SDR clock.  The ratio is free-running,
+ *  so there are no fixed banks to walk:  the output position is split into
+ *  a bank and a fraction,  and the fraction blends the two nearest banks.
+ */
+class DriftResampler
+{
+public:
+
+	 /**
+	  * Construct resampler.
+	  *
+	  * taps   :: FIR taps per bank
+	  * phases :: Number of banks between two input samples
+	  */
+	 DriftResampler(unsigned int taps = 16, unsigned int phases = 64);
+
+	 /** Output samples per input sample,  1.0 passes the rate through. */
+	 void set_ratio(double ratio) { m_ratio = ratio; }
+	 double ratio() const { return m_ratio; }
+
+	 /** Process interleaved L/R samples. */
+	 void process(const SampleVector& samples_in, SampleVector& samples_out);
+
+	 /** Forget history,  e.g. after the stream was restarted. */
+	 void reset();
+
 private:
-	 Sample b0, b1, b2, a1, a2;
-	 Sample x1, x2, y1, y2;
+	 unsigned int    m_taps;         // taps per bank
+	 unsigned int    m_phases;
+	 double          m_ratio;
+	 double          m_pos;          // input position of next output
+	 SampleVector    m_banks;        // phases + 1 banks, every tap twice
+	 SampleVector    m_hist;         // last (m_taps - 1) frames + block
 };
 
 #endif
@@ -0,0 +1,202 @@
+//
+//  FilterCheck.cpp
+//  carradio
+//
+//  Holds the SIMD FIR kernels (FilterKernels.hpp) to their scalar
+//  references on random signals,  for every tap count up to maxTaps and
+//  output counts that leave each possible tail.  The rate plans use 6 to
+//  251 taps:  IF filters of order 5 and 10,  baseband resamplers of 8 and
+//  16,  the PCM resamplers and stereo demux at baseband rate / 1000 and
+//  / 2000,  and their polyphase banks split those up further.
+//
+//  fir_iq_kernel has to match bit for bit.  The dot products add up their
+//  lanes in another order,  which is allowed to be off by at most
+//  2 n eps sum|x c|,  the textbook bound on two n term sums against each
+//  other.  With -ffast-math (the repo's flags) the compiler vectorizes the
+//  scalar loops as well,  or contracts them to FMA,  and the IQ kernel is
+//  held to that bound too.
+//
+//  Exits non-zero on the first kernel out of bounds.
+//
+//  	filtercheck
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "FilterKernels.hpp"
+
+using namespace std;
+
+static constexpr unsigned int maxTaps = 300;
+static constexpr unsigned int maxTail = 16;			// past the widest SIMD step
+static constexpr unsigned int longRun = 4096;
+
+#if defined(__FAST_MATH__) || defined(__FP_FAST_FMAF)
+static constexpr bool iqExact = false;
+#else
+static constexpr bool iqExact = true;
+#endif
+
+static mt19937 rng(1);
+
+template <class T>
+static vector<T> randomVector(size_t n){
+	uniform_real_distribution<double> dist(-1.0, 1.0);
+	vector<T> v(n);
+	for(auto &x : v)
+		x = T(dist(rng));
+	return v;
+}
+
+// how far apart two results are allowed to be,  and how far apart they were
+// in units of eps sum|x c|
+template <class T>
+class Bound {
+public:
+	Bound(const char* name) : _name(name), _worst(0), _failed(false) {}
+
+	bool check(T a, T b, double abssum, unsigned int n){
+		double eps = numeric_limits<T>::epsilon();
+		double unit = eps * abssum + numeric_limits<T>::denorm_min();
+		double err = fabs(double(a) - double(b)) / unit;
+
+		if(err > _worst)
+			_worst = err;
+
+		if(err > 2.0 * n){
+			if(!_failed)
+				fprintf(stderr, "%s: %u taps off by %.1f eps sum|x c|,  bound %u\n",
+						  _name, n, err, 2 * n);
+			_failed = true;
+		}
+		return !_failed;
+	}
+
+	bool report(){
+		printf("%-20s %s  worst %.2f eps sum|x c|\n",
+				 _name, _failed ? "FAIL" : "ok  ", _worst);
+		return !_failed;
+	}
+
+private:
+	const char*	_name;
+	double		_worst;
+	bool			_failed;
+};
+
+static bool checkFirIQ(){
+
+	Bound<float> bound("fir_iq_kernel");
+	uint64_t mismatches = 0;
+
+	for(unsigned int ntaps = 1; ntaps <= maxTaps; ntaps++){
+		auto coeff = randomVector<float>(ntaps);
+
+		for(unsigned int n : {1u, 2u, 3u, 7u, 8u, 9u, 15u, maxTail, longRun + 5}){
+			auto xi = randomVector<float>(n + ntaps);
+			auto xq = randomVector<float>(n + ntaps);
+
+			IQSampleVector simd(n), scalar(n);
+			fir_iq_kernel(xi.data(), xq.data(), coeff.data(), ntaps, n, simd.data());
+			fir_iq_kernel_scalar(xi.data(), xq.data(), coeff.data(), ntaps, n, scalar.data());
+
+			for(unsigned int i = 0; i < n; i++){
+				if(simd[i] != scalar[i])
+					mismatches++;
+
+				double si = 0, sq = 0;
+				for(unsigned int j = 0; j < ntaps; j++){
+					si += fabs(xi[i+j] * coeff[j]);
+					sq += fabs(xq[i+j] * coeff[j]);
+				}
+				bound.check(simd[i].real(), scalar[i].real(), si, ntaps);
+				bound.check(simd[i].imag(), scalar[i].imag(), sq, ntaps);
+			}
+		}
+	}
+
+	bool ok = bound.report();
+	if(iqExact && mismatches){
+		fprintf(stderr, "fir_iq_kernel: %llu samples not bit-identical\n",
+				  (unsigned long long)mismatches);
+		ok = false;
+	}
+	return ok;
+}
+
+template <class T>
+static bool checkDotProduct(const char* name){
+
+	Bound<T> bound(name);
+
+	for(unsigned int n = 1; n <= maxTaps; n++){
+		for(int trial = 0; trial < 8; trial++){
+			auto x = randomVector<T>(n);
+			auto c = randomVector<T>(n);
+
+			double abssum = 0;
+			for(unsigned int k = 0; k < n; k++)
+				abssum += fabs(x[k] * c[k]);
+
+			bound.check(dot_product(x.data(), c.data(), n),
+							dot_product_scalar(x.data(), c.data(), n), abssum, n);
+		}
+	}
+
+	return bound.report();
+}
+
+template <class T>
+static bool checkDotProduct2(const char* name){
+
+	Bound<T> bound(name);
+
+	for(unsigned int n = 1; n <= maxTaps; n++){
+		for(int trial = 0; trial < 8; trial++){
+			auto x = randomVector<T>(2 * n);
+			auto c = randomVector<T>(2 * n);
+
+			double abssum0 = 0, abssum1 = 0;
+			for(unsigned int k = 0; k < n; k++){
+				abssum0 += fabs(x[2*k]   * c[2*k]);
+				abssum1 += fabs(x[2*k+1] * c[2*k+1]);
+			}
+
+			T y0, y1, r0, r1;
+			dot_product2(x.data(), c.data(), n, y0, y1);
+			dot_product2_scalar(x.data(), c.data(), n, r0, r1);
+
+			bound.check(y0, r0, abssum0, n);
+			bound.check(y1, r1, abssum1, n);
+		}
+	}
+
+	return bound.report();
+}
+
+int main(int argc, const char * argv[]) {
+
+#if FILTER_USE_NEON
+	printf("FIR kernels:  NEON\n");
+#elif FILTER_USE_SSE2
+	printf("FIR kernels:  SSE2\n");
+#else
+	printf("FIR kernels:  scalar\n");
+#endif
+	printf("1 to %u taps,  fir_iq_kernel %s\n\n", maxTaps,
+			 iqExact ? "bit-identical" : "within bound (fast-math)");
+
+	bool ok = true;
+	ok &= checkFirIQ();
+	ok &= checkDotProduct<float>("dot_product float");
+	ok &= checkDotProduct<double>("dot_product double");
+	ok &= checkDotProduct2<float>("dot_product2 float");
+	ok &= checkDotProduct2<double>("dot_product2 double");
+
+	return ok ? 0 : 1;
+}
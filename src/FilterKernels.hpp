@@ -0,0 +1,259 @@
+#ifndef SOFTFM_FILTERKERNELS_H
+#define SOFTFM_FILTERKERNELS_H
+
+/*
+ *  Inner loops of the FIR filters in Filter.cpp,  NEON on the Pi,  SSE2 on
+ *  x86,  plain C++ otherwise.  fir_iq_kernel sums in the same order as its
+ *  scalar reference and is bit-identical to it unless -ffast-math lets the
+ *  compiler reorder the reference,  the dot products split the sum over
+ *  lanes.  Either way they differ by rounding only,  see FilterCheck.
+ */
+
+#include "IQSample.h"
+
+// Build with -DFILTER_NO_SIMD=1 to force the scalar FIR kernels.
+#if !FILTER_NO_SIMD
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FILTER_USE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FILTER_USE_SSE2 1
+#endif
+#endif
+
+
+/**
+ * Scalar references,  the plain loops the SIMD kernels stand in for.
+ * FilterCheck holds the kernels to these.
+ */
+static inline void fir_iq_kernel_scalar(const float* xi, const float* xq,
+													 const float* coeff, unsigned int ntaps,
+													 unsigned int n, IQSample* out)
+{
+	 for (unsigned int i = 0; i < n; i++) {
+		  float yi = 0, yq = 0;
+		  for (unsigned int j = 0; j < ntaps; j++) {
+				yi += xi[i+j] * coeff[j];
+				yq += xq[i+j] * coeff[j];
+		  }
+		  out[i] = IQSample(yi, yq);
+	 }
+}
+
+
+template <class T>
+static inline T dot_product_scalar(const T* x, const T* c, unsigned int n)
+{
+	 T y = 0;
+	 for (unsigned int k = 0; k < n; k++)
+		  y += x[k] * c[k];
+	 return y;
+}
+
+
+template <class T>
+static inline void dot_product2_scalar(const T* x, const T* c, unsigned int n,
+													T& y0, T& y1)
+{
+	 y0 = y1 = 0;
+	 for (unsigned int k = 0; k < n; k++) {
+		  y0 += x[2*k]   * c[2*k];
+		  y1 += x[2*k+1] * c[2*k+1];
+	 }
+}
+
+
+/**
+ * Complex FIR over split I/Q history.
+ *   out[i] = sum(j = 0 .. ntaps-1) (xi[i+j], xq[i+j]) * coeff[j]
+ *
+ * Vectorized across output samples rather than taps, so every lane sums in
+ * the same order as the scalar loop and the result is bit-identical
+ * (as long as -ffast-math doesn't reorder the scalar loop).
+ */
+static inline void fir_iq_kernel(const float* xi, const float* xq,
+											const float* coeff, unsigned int ntaps,
+											unsigned int n, IQSample* out)
+{
+	 unsigned int i = 0;
+
+#if FILTER_USE_NEON
+	 for (; i + 8 <= n; i += 8) {
+		  float32x4_t yi0 = vdupq_n_f32(0), yq0 = vdupq_n_f32(0);
+		  float32x4_t yi1 = vdupq_n_f32(0), yq1 = vdupq_n_f32(0);
+		  for (unsigned int j = 0; j < ntaps; j++) {
+				float32x4_t c = vdupq_n_f32(coeff[j]);
+				yi0 = vaddq_f32(yi0, vmulq_f32(vld1q_f32(xi + i + j), c));
+				yq0 = vaddq_f32(yq0, vmulq_f32(vld1q_f32(xq + i + j), c));
+				yi1 = vaddq_f32(yi1, vmulq_f32(vld1q_f32(xi + i + j + 4), c));
+				yq1 = vaddq_f32(yq1, vmulq_f32(vld1q_f32(xq + i + j + 4), c));
+		  }
+		  // vst2 interleaves back to I/Q pairs.
+		  float32x4x2_t y0 = {{ yi0, yq0 }};
+		  float32x4x2_t y1 = {{ yi1, yq1 }};
+		  vst2q_f32((float*)(out + i), y0);
+		  vst2q_f32((float*)(out + i + 4), y1);
+	 }
+#elif FILTER_USE_SSE2
+	 for (; i + 8 <= n; i += 8) {
+		  __m128 yi0 = _mm_setzero_ps(), yq0 = _mm_setzero_ps();
+		  __m128 yi1 = _mm_setzero_ps(), yq1 = _mm_setzero_ps();
+		  for (unsigned int j = 0; j < ntaps; j++) {
+				__m128 c = _mm_set1_ps(coeff[j]);
+				yi0 = _mm_add_ps(yi0, _mm_mul_ps(_mm_loadu_ps(xi + i + j), c));
+				yq0 = _mm_add_ps(yq0, _mm_mul_ps(_mm_loadu_ps(xq + i + j), c));
+				yi1 = _mm_add_ps(yi1, _mm_mul_ps(_mm_loadu_ps(xi + i + j + 4), c));
+				yq1 = _mm_add_ps(yq1, _mm_mul_ps(_mm_loadu_ps(xq + i + j + 4), c));
+		  }
+		  float* o = (float*)(out + i);
+		  _mm_storeu_ps(o,      _mm_unpacklo_ps(yi0, yq0));
+		  _mm_storeu_ps(o + 4,  _mm_unpackhi_ps(yi0, yq0));
+		  _mm_storeu_ps(o + 8,  _mm_unpacklo_ps(yi1, yq1));
+		  _mm_storeu_ps(o + 12, _mm_unpackhi_ps(yi1, yq1));
+	 }
+#endif
+
+	 fir_iq_kernel_scalar(xi + i, xq + i, coeff, ntaps, n - i, out + i);
+}
+
+
+/** Real dot product, sum(x[k] * c[k]) for k = 0 .. n-1. */
+static inline float dot_product(const float* x, const float* c, unsigned int n)
+{
+	 unsigned int k = 0;
+	 float y = 0;
+
+#if FILTER_USE_NEON
+	 float32x4_t y0 = vdupq_n_f32(0), y1 = vdupq_n_f32(0);
+	 for (; k + 8 <= n; k += 8) {
+		  y0 = vaddq_f32(y0, vmulq_f32(vld1q_f32(x + k),     vld1q_f32(c + k)));
+		  y1 = vaddq_f32(y1, vmulq_f32(vld1q_f32(x + k + 4), vld1q_f32(c + k + 4)));
+	 }
+	 y0 = vaddq_f32(y0, y1);
+	 float32x2_t y2 = vadd_f32(vget_low_f32(y0), vget_high_f32(y0));
+	 y = vget_lane_f32(vpadd_f32(y2, y2), 0);
+#elif FILTER_USE_SSE2
+	 __m128 y0 = _mm_setzero_ps(), y1 = _mm_setzero_ps();
+	 for (; k + 8 <= n; k += 8) {
+		  y0 = _mm_add_ps(y0, _mm_mul_ps(_mm_loadu_ps(x + k),     _mm_loadu_ps(c + k)));
+		  y1 = _mm_add_ps(y1, _mm_mul_ps(_mm_loadu_ps(x + k + 4), _mm_loadu_ps(c + k + 4)));
+	 }
+	 y0 = _mm_add_ps(y0, y1);
+	 y0 = _mm_add_ps(y0, _mm_movehl_ps(y0, y0));
+	 y0 = _mm_add_ss(y0, _mm_shuffle_ps(y0, y0, 1));
+	 y = _mm_cvtss_f32(y0);
+#endif
+
+	 for (; k < n; k++)
+		  y += x[k] * c[k];
+
+	 return y;
+}
+
+
+static inline double dot_product(const double* x, const double* c, unsigned int n)
+{
+	 unsigned int k = 0;
+	 double y = 0;
+
+#if FILTER_USE_NEON && defined(__aarch64__)
+	 float64x2_t y0 = vdupq_n_f64(0), y1 = vdupq_n_f64(0);
+	 for (; k + 4 <= n; k += 4) {
+		  y0 = vaddq_f64(y0, vmulq_f64(vld1q_f64(x + k),     vld1q_f64(c + k)));
+		  y1 = vaddq_f64(y1, vmulq_f64(vld1q_f64(x + k + 2), vld1q_f64(c + k + 2)));
+	 }
+	 y = vaddvq_f64(vaddq_f64(y0, y1));
+#elif FILTER_USE_SSE2
+	 __m128d y0 = _mm_setzero_pd(), y1 = _mm_setzero_pd();
+	 for (; k + 4 <= n; k += 4) {
+		  y0 = _mm_add_pd(y0, _mm_mul_pd(_mm_loadu_pd(x + k),     _mm_loadu_pd(c + k)));
+		  y1 = _mm_add_pd(y1, _mm_mul_pd(_mm_loadu_pd(x + k + 2), _mm_loadu_pd(c + k + 2)));
+	 }
+	 y0 = _mm_add_pd(y0, y1);
+	 y = _mm_cvtsd_f64(_mm_add_sd(y0, _mm_unpackhi_pd(y0, y0)));
+#endif
+
+	 for (; k < n; k++)
+		  y += x[k] * c[k];
+
+	 return y;
+}
+
+
+/**
+ * Two channel dot product over interleaved samples.
+ *   y0 = sum(x[2k] * c[2k]),  y1 = sum(x[2k+1] * c[2k+1])  for k = 0 .. n-1
+ *
+ * c holds every tap twice, so a pair of lanes covers both channels.
+ */
+static inline void dot_product2(const float* x, const float* c, unsigned int n,
+										  float& y0, float& y1)
+{
+	 unsigned int k = 0;
+	 y0 = y1 = 0;
+
+#if FILTER_USE_NEON
+	 float32x4_t a0 = vdupq_n_f32(0), a1 = vdupq_n_f32(0);
+	 for (; k + 4 <= n; k += 4) {
+		  a0 = vaddq_f32(a0, vmulq_f32(vld1q_f32(x + 2*k),     vld1q_f32(c + 2*k)));
+		  a1 = vaddq_f32(a1, vmulq_f32(vld1q_f32(x + 2*k + 4), vld1q_f32(c + 2*k + 4)));
+	 }
+	 a0 = vaddq_f32(a0, a1);
+	 float32x2_t a2 = vadd_f32(vget_low_f32(a0), vget_high_f32(a0));
+	 y0 = vget_lane_f32(a2, 0);
+	 y1 = vget_lane_f32(a2, 1);
+#elif FILTER_USE_SSE2
+	 __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps();
+	 for (; k + 4 <= n; k += 4) {
+		  a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(x + 2*k),     _mm_loadu_ps(c + 2*k)));
+		  a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(x + 2*k + 4), _mm_loadu_ps(c + 2*k + 4)));
+	 }
+	 a0 = _mm_add_ps(a0, a1);
+	 a0 = _mm_add_ps(a0, _mm_movehl_ps(a0, a0));
+	 y0 = _mm_cvtss_f32(a0);
+	 y1 = _mm_cvtss_f32(_mm_shuffle_ps(a0, a0, 1));
+#endif
+
+	 for (; k < n; k++) {
+		  y0 += x[2*k]   * c[2*k];
+		  y1 += x[2*k+1] * c[2*k+1];
+	 }
+}
+
+
+static inline void dot_product2(const double* x, const double* c, unsigned int n,
+										  double& y0, double& y1)
+{
+	 unsigned int k = 0;
+	 y0 = y1 = 0;
+
+#if FILTER_USE_NEON && defined(__aarch64__)
+	 float64x2_t a0 = vdupq_n_f64(0), a1 = vdupq_n_f64(0);
+	 for (; k + 2 <= n; k += 2) {
+		  a0 = vaddq_f64(a0, vmulq_f64(vld1q_f64(x + 2*k),     vld1q_f64(c + 2*k)));
+		  a1 = vaddq_f64(a1, vmulq_f64(vld1q_f64(x + 2*k + 2), vld1q_f64(c + 2*k + 2)));
+	 }
+	 a0 = vaddq_f64(a0, a1);
+	 y0 = vgetq_lane_f64(a0, 0);
+	 y1 = vgetq_lane_f64(a0, 1);
+#elif FILTER_USE_SSE2
+	 __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();
+	 for (; k + 2 <= n; k += 2) {
+		  a0 = _mm_add_pd(a0, _mm_mul_pd(_mm_loadu_pd(x + 2*k),     _mm_loadu_pd(c + 2*k)));
+		  a1 = _mm_add_pd(a1, _mm_mul_pd(_mm_loadu_pd(x + 2*k + 2), _mm_loadu_pd(c + 2*k + 2)));
+	 }
+	 a0 = _mm_add_pd(a0, a1);
+	 y0 = _mm_cvtsd_f64(a0);
+	 y1 = _mm_cvtsd_f64(_mm_unpackhi_pd(a0, a0));
+#endif
+
+	 for (; k < n; k++) {
+		  y0 += x[2*k]   * c[2*k];
+		  y1 += x[2*k+1] * c[2*k+1];
+	 }
+}
+
+#endif
+
+/* end */
@@ -3,36 +3,46 @@
 #include <cmath>
 
 #include "FmDecode.hpp"
+#include "DSPTiming.hpp"
 
 using namespace std;
 
 
+// Stage timing,  published by PiCarMgr.
+static DSPStage s_fm_front("fm_front");
+static DSPStage s_fm_if("fm_if");
+static DSPStage s_fm_disc("fm_disc");
+static DSPStage s_fm_resamp("fm_resamp");
+static DSPStage s_fm_stereo("fm_stereo");
+static DSPStage s_fm_mono("fm_mono");
+
+
 #pragma clang diagnostic ignored "-Wconversion"
 
-///** Fast approximation of atan function. */
-//static inline Sample fast_atan(Sample x)
-//{
-//	 // http://stackoverflow.com/questions/7378187/approximating-inverse-trigonometric-funcions
-//
-//	 Sample y = 1;
-//	 Sample p = 0;
-//
-//	 if (x < 0) {
-//		  x = -x;
-//		  y = -1;
-//	 }
-//
-//	 if (x > 1) {
-//		  p = y;
-//		  y = -y;
-//		  x = 1 / x;
-//	 }
-//
-//	 const Sample b = 0.596227;
-//	 y *= (b*x + x*x) / (1 + 2*b*x + x*x);
-//
-//	 return (y + p) * Sample(M_PI_2);
-//}
+/**
+ * Fast approximation of atan2.
+ *
+ * Folds the angle into [0, pi/4] and uses the Abramowitz & Stegun 4.4.49
+ * polynomial (|error| < 1e-5 rad).  Written with selects instead of
+ * branches so the loops that call it vectorize.
+ */
+static inline float fast_atan2(float y, float x)
+{
+	 float ax = fabsf(x);
+	 float ay = fabsf(y);
+	 float mn = min(ax, ay);
+	 float mx = max(ax, ay);
+	 float a  = mn / (mx + 1.0e-30f);
+	 float s  = a * a;
+
+	 float r = a * (0.9998660f + s * (-0.3302995f + s * (0.1801410f
+					  + s * (-0.0851330f + s * 0.0208351f))));
+
+	 r = (ay > ax) ? float(M_PI_2) - r : r;
+	 r = (x < 0) ? float(M_PI) - r : r;
+	 r = (y < 0) ? -r : r;
+	 return r;
+}
 
 
 /** Compute RMS level over a small prefix of the specified sample vector. */
@@ -55,8 +65,10 @@ static IQSample::value_type rms_level_approx(const IQSampleVector& samples)
 /* ****************  class PhaseDiscriminator  **************** */
 
 // Construct phase discriminator.
-PhaseDiscriminator::PhaseDiscriminator(double max_freq_dev)
+PhaseDiscriminator::PhaseDiscriminator(double max_freq_dev, disc_mode_t mode)
 	 : m_freq_scale_factor(1.0 / (max_freq_dev * 2.0 * M_PI))
+	 , m_mode(mode)
+	 , m_last_sample(0)
 { }
 
 
@@ -65,25 +77,81 @@ void PhaseDiscriminator::process(const IQSampleVector& samples_in,
 											SampleVector& samples_out)
 {
 	 unsigned int n = samples_in.size();
-	 IQSample s0 = m_last_sample;
 
 	 samples_out.resize(n);
 
-	 for (unsigned int i = 0; i < n; i++) {
-		  IQSample s1(samples_in[i]);
-		  IQSample d(conj(s0) * s1);
-// TODO : implement fast approximation of atan2
-		  Sample w = atan2(d.imag(), d.real());
-		  samples_out[i] = w * m_freq_scale_factor;
-		  s0 = s1;
+	 if (n == 0)
+		  return;
+
+	 const IQSample* in = samples_in.data();
+	 Sample* out = samples_out.data();
+	 const Sample scale = m_freq_scale_factor;
+
+	 // Phase step between in[i-1] and in[i],  in[-1] is the last sample of
+	 // the previous block.  Each mode is its own loop with no carried
+	 // state so the compiler can vectorize it.
+	 IQSample s0 = m_last_sample;
+
+	 switch (m_mode) {
+
+		  case DISC_ATAN2: {
+				IQSample d(conj(s0) * in[0]);
+				out[0] = atan2(d.imag(), d.real()) * scale;
+				for (unsigned int i = 1; i < n; i++) {
+					 IQSample d(conj(in[i-1]) * in[i]);
+					 out[i] = atan2(d.imag(), d.real()) * scale;
+				}
+				break;
+		  }
+
+		  case DISC_FAST_ATAN2: {
+				IQSample d(conj(s0) * in[0]);
+				out[0] = fast_atan2(d.imag(), d.real()) * scale;
+				for (unsigned int i = 1; i < n; i++) {
+					 float re = in[i-1].real() * in[i].real() + in[i-1].imag() * in[i].imag();
+					 float im = in[i-1].real() * in[i].imag() - in[i-1].imag() * in[i].real();
+					 out[i] = fast_atan2(im, re) * scale;
+				}
+				break;
+		  }
+
+		  case DISC_POLAR: {
+				// I dQ - Q dI  reduces to  Im(conj(s0) * s1).
+				float i1 = in[0].real(), q1 = in[0].imag();
+				float cross = s0.real() * q1 - s0.imag() * i1;
+				out[0] = cross / (i1 * i1 + q1 * q1 + 1.0e-30f) * scale;
+				for (unsigned int i = 1; i < n; i++) {
+					 float i0 = in[i-1].real(), q0 = in[i-1].imag();
+					 float i1 = in[i].real(),   q1 = in[i].imag();
+					 float cross = i0 * q1 - q0 * i1;
+					 out[i] = cross / (i1 * i1 + q1 * q1 + 1.0e-30f) * scale;
+				}
+				break;
+		  }
 	 }
 
-	 m_last_sample = s0;
+	 m_last_sample = in[n-1];
 }
 
 
 /* ****************  class PilotPhaseLock  **************** */
 
+// Pilot NCO sine table, one period of 2**12 steps.  Linear interpolation
+// keeps the error below 3e-7.  Extra quarter period so cos can be read
+// at index + size/4 without wrapping, plus one guard entry.
+static constexpr unsigned int pilot_table_size = 1 << 12;
+
+static const vector<double>& pilot_sine_table()
+{
+	 static const vector<double> table = [] {
+		  vector<double> t(pilot_table_size + pilot_table_size / 4 + 2);
+		  for (unsigned int i = 0; i < t.size(); i++)
+				t[i] = sin(2.0 * M_PI * i / pilot_table_size);
+		  return t;
+	 }();
+	 return table;
+}
+
 // Construct phase-locked loop.
 PilotPhaseLock::PilotPhaseLock(double freq, double bandwidth, double minsignal)
 {
@@ -144,6 +212,24 @@ PilotPhaseLock::PilotPhaseLock(double freq, double bandwidth, double minsignal)
 }
 
 
+// Drop lock and start again from the center frequency.
+void PilotPhaseLock::reset()
+{
+	 m_freq  = 0.5 * (m_minfreq + m_maxfreq);
+	 m_phase = 0;
+
+	 m_phasor_i1 = 0;
+	 m_phasor_i2 = 0;
+	 m_phasor_q1 = 0;
+	 m_phasor_q2 = 0;
+	 m_loopfilter_x1 = 0;
+
+	 m_lock_cnt      = 0;
+	 m_pilot_level   = 0;
+	 m_pilot_periods = 0;
+}
+
+
 // Process samples.
 void PilotPhaseLock::process(const SampleVector& samples_in,
 									  SampleVector& samples_out)
@@ -158,20 +244,28 @@ void PilotPhaseLock::process(const SampleVector& samples_in,
 	 if (n > 0)
 		  m_pilot_level = 1000.0;
 
+	 const double* sintab = pilot_sine_table().data();
+	 const double table_scale = pilot_table_size / (2.0 * M_PI);
+
 	 for (unsigned int i = 0; i < n; i++) {
 
 		  // Generate locked pilot tone.
-		  Sample psin = sin(m_phase);
-		  Sample pcos = cos(m_phase);
+		  // m_phase stays within [0, 2*pi] so the index never wraps.
+		  double tpos = m_phase * table_scale;
+		  unsigned int ti = (unsigned int)tpos;
+		  unsigned int tc = ti + pilot_table_size / 4;
+		  double tf = tpos - ti;
+		  double psin = sintab[ti] + tf * (sintab[ti+1] - sintab[ti]);
+		  double pcos = sintab[tc] + tf * (sintab[tc+1] - sintab[tc]);
 
 		  // Generate double-frequency output.
 		  // sin(2*x) = 2 * sin(x) * cos(x)
 		  samples_out[i] = 2 * psin * pcos;
 
 		  // Multiply locked tone with input.
-		  Sample x = samples_in[i];
-		  Sample phasor_i = psin * x;
-		  Sample phasor_q = pcos * x;
+		  double x = samples_in[i];
+		  double phasor_i = psin * x;
+		  double phasor_q = pcos * x;
 
 		  // Run IQ phase error through low-pass filter.
 		  phasor_i = m_phasor_b0 * phasor_i
@@ -186,7 +280,7 @@ void PilotPhaseLock::process(const SampleVector& samples_in,
 		  m_phasor_q1 = phasor_q;
 
 		  // Convert I/Q ratio to estimate of phase error.
-		  Sample phase_err;
+		  double phase_err;
 		  if (phasor_i > abs(phasor_q)) {
 				// We are within +/- 45 degrees from lock.
 				// Use simple linear approximation of arctan.
@@ -261,63 +355,100 @@ FmDecoder::FmDecoder(double sample_rate_if,
 							double bandwidth_if,
 							double freq_dev,
 							double bandwidth_pcm,
-							unsigned int downsample)
+							unsigned int downsample,
+							unsigned int if_filter_order)
 
 	 // Initialize member fields
 	 : m_sample_rate_if(sample_rate_if)
-	 , m_sample_rate_baseband(sample_rate_if / downsample)
+	 // IQ rate has to hold the IF filter and the Carson bandwidth of the
+	 // stereo multiplex (up to 57 kHz).
+	 , m_if_decim(DecimatingFrontEnd::decimation_for(sample_rate_if,
+						  max(4 * bandwidth_if, 2 * (freq_dev + 57000.0)),
+						  max(1u, downsample)))
+	 , m_downsample(max(1u, downsample) / m_if_decim)
+	 , m_sample_rate_channel(sample_rate_if / m_if_decim)
+	 , m_sample_rate_baseband(m_sample_rate_channel / m_downsample)
 	 , m_tuning_table_size(64)
 	 , m_tuning_shift(lrint(-64.0 * tuning_offset / sample_rate_if))
 	 , m_freq_dev(freq_dev)
-	 , m_downsample(downsample)
 	 , m_stereo_enabled(stereo)
+	 , m_quality(QUALITY_FULL)
+	 , m_disc_mode(PhaseDiscriminator::DISC_FAST_ATAN2)
 	 , m_stereo_detected(false)
 	 , m_if_level(0)
 	 , m_baseband_mean(0)
 	 , m_baseband_level(0)
 
-	 // Construct FineTuner
-	 , m_finetuner(m_tuning_table_size, m_tuning_shift)
+	 // Construct DecimatingFrontEnd
+	 , m_frontend(m_tuning_table_size, m_tuning_shift, m_if_decim)
 
 	 // Construct LowPassFilterFirIQ
-	 , m_iffilter(10, bandwidth_if / sample_rate_if)
+	 // Same time span as 10 taps at the dongle rate, a sharper filter eats
+	 // into the FM sidebands and costs stereo SNR.
+	 , m_iffilter(if_filter_order ? if_filter_order : max(2u, 10 / m_if_decim),
+					  bandwidth_if / m_sample_rate_channel)
 
 	 // Construct PhaseDiscriminator
-	 , m_phasedisc(freq_dev / sample_rate_if)
+	 , m_phasedisc(freq_dev / m_sample_rate_channel)
 
 	 // Construct DownsampleFilter for baseband
-	 , m_resample_baseband(8 * downsample, 0.4 / downsample, downsample, true)
+	 , m_resample_baseband(8 * m_downsample, 0.4 / m_downsample, m_downsample)
 
 	 // Construct PilotPhaseLock
 	 , m_pilotpll(pilot_freq / m_sample_rate_baseband,       // freq
 					  50 / m_sample_rate_baseband,               // bandwidth
 					  0.04)                                      // minsignal
 
-	 // Construct DownsampleFilter for mono channel
+	 // Construct PolyphaseResampler for mono channel
 	 , m_resample_mono(
+		  m_sample_rate_baseband,                             // sample_rate_in
+		  sample_rate_pcm,                                    // sample_rate_out
 		  int(m_sample_rate_baseband / 1000.0),               // filter_order
-		  bandwidth_pcm / m_sample_rate_baseband,             // cutoff
-		  m_sample_rate_baseband / sample_rate_pcm,           // downsample
-		  false)                                              // integer_factor
-
-	 // Construct DownsampleFilter for stereo channel
-	 , m_resample_stereo(
-		  int(m_sample_rate_baseband / 1000.0),               // filter_order
-		  bandwidth_pcm / m_sample_rate_baseband,             // cutoff
-		  m_sample_rate_baseband / sample_rate_pcm,           // downsample
-		  false)                                              // integer_factor
+		  bandwidth_pcm / m_sample_rate_baseband)             // cutoff
 
 	 // Construct HighPassFilterIir
 	 , m_dcblock_mono(30.0 / sample_rate_pcm)
-	 , m_dcblock_stereo(30.0 / sample_rate_pcm)
 
 	 // Construct LowPassFilterRC
 	 , m_deemph_mono(
 		  (deemphasis == 0) ? 1.0 : (deemphasis * sample_rate_pcm * 1.0e-6))
-	 , m_deemph_stereo(
+
+	 // Construct StereoDemuxFilter
+	 , m_stereo_demux(
+		  m_sample_rate_baseband,                             // sample_rate_in
+		  sample_rate_pcm,                                    // sample_rate_out
+		  int(m_sample_rate_baseband / 1000.0),               // filter_order
+		  bandwidth_pcm / m_sample_rate_baseband,             // cutoff
+		  30.0 / sample_rate_pcm,                             // dcblock_cutoff
+		  (deemphasis == 0) ? 1.0 : (deemphasis * sample_rate_pcm * 1.0e-6))
+
+	 // The same again at half the filter orders,  wider transition bands
+	 // let a little more adjacent channel and aliasing through.
+	 , m_iffilter_short(
+		  max(2u, (if_filter_order ? if_filter_order : max(2u, 10 / m_if_decim)) / 2),
+		  bandwidth_if / m_sample_rate_channel)
+
+	 , m_resample_baseband_short(4 * m_downsample, 0.4 / m_downsample, m_downsample)
+
+	 , m_resample_mono_short(
+		  m_sample_rate_baseband,
+		  sample_rate_pcm,
+		  int(m_sample_rate_baseband / 2000.0),
+		  bandwidth_pcm / m_sample_rate_baseband)
+
+	 , m_stereo_demux_short(
+		  m_sample_rate_baseband,
+		  sample_rate_pcm,
+		  int(m_sample_rate_baseband / 2000.0),
+		  bandwidth_pcm / m_sample_rate_baseband,
+		  30.0 / sample_rate_pcm,
 		  (deemphasis == 0) ? 1.0 : (deemphasis * sample_rate_pcm * 1.0e-6))
 
 {
+	 // the front end and the baseband resampler share the downsampling
+	 assert(m_if_decim * m_downsample == max(1u, downsample));
+
+	 m_disc_mode = m_phasedisc.mode();
 	
 //	printf("FmDecoder PCM at %f\n", sample_rate_pcm);
 
@@ -325,26 +456,98 @@ FmDecoder::FmDecoder(double sample_rate_if,
 }
 
 
+// Forget the last station.  The FIR histories are a few samples long
+// and are gone by the end of the first block.
+void FmDecoder::reset()
+{
+	 m_stereo_detected = false;
+	 m_if_level        = 0;
+	 m_baseband_mean   = 0;
+	 m_baseband_level  = 0;
+
+	 m_phasedisc.reset();
+	 m_pilotpll.reset();
+}
+
+
+// Takes effect with the next block.  The filters switched to still hold
+// history from the last time they ran,  the first few output samples
+// after a change are off.
+void FmDecoder::set_quality_tier(unsigned int tier)
+{
+	 m_quality = min(tier, (unsigned int) QUALITY_TIERS - 1);
+
+	 m_phasedisc.set_mode(m_quality >= QUALITY_POLAR_DISC
+								 ? PhaseDiscriminator::DISC_POLAR : m_disc_mode);
+
+	 if (m_quality >= QUALITY_MONO)
+		  m_stereo_detected = false;
+}
+
+
+const char* FmDecoder::quality_tier_name(unsigned int tier) const
+{
+	 switch (tier) {
+		  case QUALITY_FULL:       return "full";
+		  case QUALITY_SHORT_FIR:  return "short FIR";
+		  case QUALITY_MONO:       return "mono";
+		  case QUALITY_POLAR_DISC: return "polar disc";
+		  default:                 return "?";
+	 }
+}
+
+
 void FmDecoder::process(const IQSampleVector& samples_in,
 								SampleVector& audio)
 {
-	// Fine tuning.
-	m_finetuner.process(samples_in, m_buf_iftuned);
+	process_if(samples_in, m_buf_iffiltered);
+	process_demod(m_buf_iffiltered, audio);
+}
+
+
+void FmDecoder::process_if(const IQSampleVector& samples_in,
+									IQSampleVector& samples_if)
+{
+	double block_secs = samples_in.size() / m_sample_rate_if;
+	
+	// Fine tuning and decimation to the channel rate.
+	DSPTimer front(s_fm_front, block_secs);
+	m_frontend.process(samples_in, m_buf_iftuned);
+	front.stop();
 	
 	// Low pass filter to isolate station.
-	m_iffilter.process(m_buf_iftuned, m_buf_iffiltered);
+	DSPTimer iffilter(s_fm_if, block_secs);
+	if (m_quality >= QUALITY_SHORT_FIR)
+		m_iffilter_short.process(m_buf_iftuned, samples_if);
+	else
+		m_iffilter.process(m_buf_iftuned, samples_if);
 	
 	// Measure IF level.
-	double if_rms = rms_level_approx(m_buf_iffiltered);
+	double if_rms = rms_level_approx(samples_if);
 	m_if_level = 0.95 * m_if_level + 0.05 * if_rms;
+}
+
+
+void FmDecoder::process_demod(const IQSampleVector& samples_if,
+										SampleVector& audio)
+{
+	double block_secs = samples_if.size() / m_sample_rate_channel;
+	bool short_fir = m_quality >= QUALITY_SHORT_FIR;
 	
 	// Extract carrier frequency.
-	m_phasedisc.process(m_buf_iffiltered, m_buf_baseband);
+	DSPTimer disc(s_fm_disc, block_secs);
+	m_phasedisc.process(samples_if, m_buf_baseband);
+	disc.stop();
 	
 	// Downsample baseband signal to reduce processing.
+	// Swap rather than move so both buffers keep their storage.
+	DSPTimer resamp(s_fm_resamp, block_secs);
 	if (m_downsample > 1) {
-		SampleVector tmp(move(m_buf_baseband));
-		m_resample_baseband.process(tmp, m_buf_baseband);
+		m_buf_discrim.swap(m_buf_baseband);
+		if (short_fir)
+			m_resample_baseband_short.process(m_buf_discrim, m_buf_baseband);
+		else
+			m_resample_baseband.process(m_buf_discrim, m_buf_baseband);
 	}
 	
 	// Measure baseband level.
@@ -352,46 +555,34 @@ void FmDecoder::process(const IQSampleVector& samples_in,
 	samples_mean_rms(m_buf_baseband, baseband_mean, baseband_rms);
 	m_baseband_mean  = 0.95 * m_baseband_mean + 0.05 * baseband_mean;
 	m_baseband_level = 0.95 * m_baseband_level + 0.05 * baseband_rms;
+	resamp.stop();
 	
-	// Extract mono audio signal.
-	m_resample_mono.process(m_buf_baseband, m_buf_mono);
-	
-	// DC blocking and de-emphasis.
-	m_dcblock_mono.process_inplace(m_buf_mono);
-	m_deemph_mono.process_inplace(m_buf_mono);
-	
-	if (m_stereo_enabled) {
+	if (m_stereo_enabled && m_quality < QUALITY_MONO) {
+		DSPTimer stereo(s_fm_stereo, block_secs);
 		
 		// Lock on stereo pilot.
 		m_pilotpll.process(m_buf_baseband, m_buf_rawstereo);
 		m_stereo_detected = m_pilotpll.locked();
 		
-		// Demodulate stereo signal.
-		demod_stereo(m_buf_baseband, m_buf_rawstereo);
-		
-		// Extract audio and downsample.
-		// NOTE: This MUST be done even if no stereo signal is detected yet,
-		// because the downsamplers for mono and stereo signal must be
-		// kept in sync.
-		m_resample_stereo.process(m_buf_rawstereo, m_buf_stereo);
+		// Demodulate L-R, downsample both channels, DC blocking,
+		// de-emphasis and left/right matrix in one go.
+		// NOTE: The L-R channel is filtered even if no stereo signal is
+		// detected yet,  so its filter state is settled once the pilot locks.
+		StereoDemuxFilter& demux = short_fir ? m_stereo_demux_short : m_stereo_demux;
+		demux.process(m_buf_baseband, m_buf_rawstereo, m_stereo_detected, audio);
 		
-		// DC blocking and de-emphasis.
-		m_dcblock_stereo.process_inplace(m_buf_stereo);
-		m_deemph_stereo.process_inplace(m_buf_stereo);
+	} else {
+		DSPTimer mono(s_fm_mono, block_secs);
 		
-		if (m_stereo_detected) {
-			
-			// Extract left/right channels from mono/stereo signals.
-			stereo_to_left_right(m_buf_mono, m_buf_stereo, audio);
-			
-		} else {
-			
-			// Duplicate mono signal in left/right channels.
-			mono_to_left_right(m_buf_mono, audio);
-			
-		}
+		// Extract mono audio signal.
+		if (short_fir)
+			m_resample_mono_short.process(m_buf_baseband, m_buf_mono);
+		else
+			m_resample_mono.process(m_buf_baseband, m_buf_mono);
 		
-	} else {
+		// DC blocking and de-emphasis.
+		m_dcblock_mono.process_inplace(m_buf_mono);
+		m_deemph_mono.process_inplace(m_buf_mono);
 		
 		// Duplicate mono signal in left/right channels.
 		mono_to_left_right(m_buf_mono, audio);
@@ -402,23 +593,6 @@ void FmDecoder::process(const IQSampleVector& samples_in,
 }
 
 
-// Demodulate stereo L-R signal.
-void FmDecoder::demod_stereo(const SampleVector& samples_baseband,
-									  SampleVector& samples_rawstereo)
-{
-	 // Just multiply the baseband signal with the double-frequency pilot.
-	 // And multiply by two to get the full amplitude.
-	 // That's all.
-
-	 unsigned int n = samples_baseband.size();
-	 assert(n == samples_rawstereo.size());
-
-	 for (unsigned int i = 0; i < n; i++) {
-		  samples_rawstereo[i] *= 2 * samples_baseband[i];
-	 }
-}
-
-
 // Duplicate mono signal in left/right channels.
 void FmDecoder::mono_to_left_right(const SampleVector& samples_mono,
 											  SampleVector& audio)
@@ -433,22 +607,4 @@ void FmDecoder::mono_to_left_right(const SampleVector& samples_mono,
 	 }
 }
 
-
-// Extract left/right channels from mono/stereo signals.
-void FmDecoder::stereo_to_left_right(const SampleVector& samples_mono,
-												 const SampleVector& samples_stereo,
-												 SampleVector& audio)
-{
-	 unsigned int n = samples_mono.size();
-	 assert(n == samples_stereo.size());
-
-	 audio.resize(2*n);
-	 for (unsigned int i = 0; i < n; i++) {
-		  Sample m = samples_mono[i];
-		  Sample s = samples_stereo[i];
-		  audio[2*i]   = m + s;
-		  audio[2*i+1] = m - s;
-	 }
-}
-
 /* end */
@@ -29,13 +29,23 @@ class PhaseDiscriminator
 {
 public:
 
+	 typedef enum  {
+		  DISC_ATAN2 = 0,       // libm atan2
+		  DISC_FAST_ATAN2,      // polynomial atan2, error < 1e-5 rad
+		  DISC_POLAR,           // (I dQ - Q dI) / (I^2 + Q^2), ~ sin(dphi)
+	 }disc_mode_t;
+
 	 /**
 	  * Construct phase discriminator.
 	  *
 	  * max_freq_dev :: Full scale frequency deviation relative to the
 	  *                 full sample frequency.
+	  * mode         :: How the phase step is computed.  DISC_POLAR
+	  *                 compresses large phase steps,  only use it when the
+	  *                 deviation is small compared to the sample rate.
 	  */
-	 PhaseDiscriminator(double max_freq_dev);
+	 PhaseDiscriminator(double max_freq_dev,
+							  disc_mode_t mode = DISC_FAST_ATAN2);
 
 	 /**
 	  * Process samples.
@@ -44,8 +54,15 @@ public:
 	  */
 	 void process(const IQSampleVector& samples_in, SampleVector& samples_out);
 
+	 void set_mode(disc_mode_t mode) { m_mode = mode; }
+	 disc_mode_t mode() const { return m_mode; }
+
+	 /** Forget the previous sample,  for input that is not contiguous. */
+	 void reset() { m_last_sample = 0; }
+
 private:
 	 const Sample m_freq_scale_factor;
+	 disc_mode_t  m_mode;
 	 IQSample     m_last_sample;
 };
 
@@ -100,15 +117,18 @@ public:
 		  return m_pps_events;
 	 }
 
+	 /** Drop lock and start again from the center frequency. */
+	 void reset();
+
 private:
-	 Sample  m_minfreq, m_maxfreq;
-	 Sample  m_phasor_b0, m_phasor_a1, m_phasor_a2;
-	 Sample  m_phasor_i1, m_phasor_i2, m_phasor_q1, m_phasor_q2;
-	 Sample  m_loopfilter_b0, m_loopfilter_b1;
-	 Sample  m_loopfilter_x1;
-	 Sample  m_freq, m_phase;
-	 Sample  m_minsignal;
-	 Sample  m_pilot_level;
+	 double  m_minfreq, m_maxfreq;
+	 double  m_phasor_b0, m_phasor_a1, m_phasor_a2;
+	 double  m_phasor_i1, m_phasor_i2, m_phasor_q1, m_phasor_q2;
+	 double  m_loopfilter_b0, m_loopfilter_b1;
+	 double  m_loopfilter_x1;
+	 double  m_freq, m_phase;
+	 double  m_minsignal;
+	 double  m_pilot_level;
 	 int     m_lock_delay;
 	 int     m_lock_cnt;
 	 int     m_pilot_periods;
@@ -123,6 +143,19 @@ class FmDecoder : public SDRDecoder
 {
 public:
 	
+	 /**
+	  * Quality tiers,  each one keeps the savings of the tiers before it.
+	  * Filters are swapped for shorter twins built up front,  so a change
+	  * costs a few samples of filter history and no allocation.
+	  */
+	 typedef enum  {
+		  QUALITY_FULL = 0,
+		  QUALITY_SHORT_FIR,    // half length IF, baseband and audio filters
+		  QUALITY_MONO,         // no pilot PLL or L-R channel
+		  QUALITY_POLAR_DISC,   // DISC_POLAR,  a few % distortion at full deviation
+		  QUALITY_TIERS
+	 }quality_t;
+
 	 static constexpr double default_deemphasis    =     50;
 	 static constexpr double default_bandwidth_if  = 100000;
 	 static constexpr double default_freq_dev      =  75000;
@@ -146,8 +179,12 @@ public:
 	  *                     (75 kHz for broadcast FM)
 	  * bandwidth_pcm    :: Half bandwidth of audio signal in Hz
 	  *                     (15 kHz for broadcast FM)
-	  * downsample       :: Downsampling factor to apply after FM demodulation.
-	  *                     Set to 1 to disable.
+	  * downsample       :: Total downsampling factor ahead of the audio stage.
+	  *                     The IQ front end takes as much of it as the IF
+	  *                     bandwidth allows, the rest is applied after FM
+	  *                     demodulation.  Set to 1 to disable.
+	  * if_filter_order  :: IF filter order at the channel rate, 0 to use the
+	  *                     same time span as 10 taps at 1 MS/s.
 	  */
 	 FmDecoder(double sample_rate_if,
 				  double tuning_offset,
@@ -157,7 +194,8 @@ public:
 				  double bandwidth_if=default_bandwidth_if,
 				  double freq_dev=default_freq_dev,
 				  double bandwidth_pcm=default_bandwidth_pcm,
-				  unsigned int downsample=1);
+				  unsigned int downsample=1,
+				  unsigned int if_filter_order=0);
 
 	 /**
 	  * Process IQ samples and return audio samples.
@@ -170,6 +208,16 @@ public:
 	 void process(const IQSampleVector& samples_in,
 					  SampleVector& audio);
 
+	 /** Fine tuning,  decimation and IF filter,  the first half of process(). */
+	 void process_if(const IQSampleVector& samples_in,
+						  IQSampleVector& samples_if);
+
+	 /** Discriminator,  pilot PLL and stereo,  the second half. */
+	 void process_demod(const IQSampleVector& samples_if,
+							  SampleVector& audio);
+
+	 bool can_split() const { return true; }
+
 	 /** Return true if a stereo signal is detected. */
 	 bool stereo_detected() const
 	 {
@@ -209,6 +257,17 @@ public:
 	bool isSquelched() const  { return false; };
 
 	bool canSquelch() const  { return false; };
+
+	 /** Forget the last station,  for reuse after a retune. */
+	 void reset();
+
+	 unsigned int quality_tiers() const { return QUALITY_TIERS; }
+
+	 unsigned int quality_tier() const { return m_quality; }
+
+	 void set_quality_tier(unsigned int tier);
+
+	 const char* quality_tier_name(unsigned int tier) const;
  
 	 /** Return PPS events from the most recently processed block. */
 	 std::vector<PilotPhaseLock::PpsEvent> get_pps_events() const
@@ -217,27 +276,22 @@ public:
 	 }
 
 private:
-	 /** Demodulate stereo L-R signal. */
-	 void demod_stereo(const SampleVector& samples_baseband,
-							 SampleVector& samples_stereo);
-
 	 /** Duplicate mono signal in left/right channels. */
 	 void mono_to_left_right(const SampleVector& samples_mono,
 									 SampleVector& audio);
 
-	 /** Extract left/right channels from mono/stereo signals. */
-	 void stereo_to_left_right(const SampleVector& samples_mono,
-										const SampleVector& samples_stereo,
-										SampleVector& audio);
-
 	 // Data members.
 	 const double    m_sample_rate_if;
+	 const unsigned int m_if_decim;
+	 const unsigned int m_downsample;
+	 const double    m_sample_rate_channel;
 	 const double    m_sample_rate_baseband;
 	 const int       m_tuning_table_size;
 	 const int       m_tuning_shift;
 	 const double    m_freq_dev;
-	 const unsigned int m_downsample;
 	 const bool      m_stereo_enabled;
+	 unsigned int    m_quality;
+	 PhaseDiscriminator::disc_mode_t m_disc_mode;   // above QUALITY_POLAR_DISC
 	 bool            m_stereo_detected;
 	 double          m_if_level;
 	 double          m_baseband_mean;
@@ -246,19 +300,23 @@ private:
 	 IQSampleVector  m_buf_iftuned;
 	 IQSampleVector  m_buf_iffiltered;
 	 SampleVector    m_buf_baseband;
+	 SampleVector    m_buf_discrim;      // before baseband downsampling
 	 SampleVector    m_buf_mono;
 	 SampleVector    m_buf_rawstereo;
-	 SampleVector    m_buf_stereo;
 
-	 FineTuner           m_finetuner;
+	 DecimatingFrontEnd  m_frontend;
 	 LowPassFilterFirIQ  m_iffilter;
 	 PhaseDiscriminator  m_phasedisc;
 	 DownsampleFilter    m_resample_baseband;
 	 PilotPhaseLock      m_pilotpll;
-	 DownsampleFilter    m_resample_mono;
-	 DownsampleFilter    m_resample_stereo;
+	 PolyphaseResampler  m_resample_mono;
 	 HighPassFilterIir   m_dcblock_mono;
-	 HighPassFilterIir   m_dcblock_stereo;
 	 LowPassFilterRC     m_deemph_mono;
-	 LowPassFilterRC     m_deemph_stereo;
+	 StereoDemuxFilter   m_stereo_demux;
+
+	 // QUALITY_SHORT_FIR and below
+	 LowPassFilterFirIQ  m_iffilter_short;
+	 DownsampleFilter    m_resample_baseband_short;
+	 PolyphaseResampler  m_resample_mono_short;
+	 StereoDemuxFilter   m_stereo_demux_short;
 };
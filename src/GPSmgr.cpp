@@ -16,6 +16,7 @@
 #include "ErrorMgr.hpp"
 #include <cmath>
 #include "timespec_util.h"
+#include "ThreadPolicy.hpp"
 
 typedef void * (*THREADFUNCPTR)(void *);
 
@@ -82,6 +83,7 @@ GPSmgr::GPSmgr() {
 
 	pthread_create(&_TID, NULL,
 										  (THREADFUNCPTR) &GPSmgr::GPSReaderThread, (void*)this);
+	ThreadPolicy::shared()->registerThread("GPSmgr", _TID);
 
 	
 }
@@ -0,0 +1,307 @@
+//
+//  IQConverter.cpp
+//  carradio
+//
+
+#include <chrono>
+#include <mutex>
+#include <cstdio>
+
+#include "IQConverter.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IQCONVERT_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define IQCONVERT_NEON 1
+#endif
+
+// (x - 128) / 128,  1/128 is exact so every kernel gives identical results.
+static constexpr float k_scale = 1.0f / 128.0f;
+
+// MARK: -  scalar and table kernels
+
+static void convert_scalar(const uint8_t* buf, size_t count, IQSample* samples)
+{
+	for (size_t i = 0; i < count; i++) {
+		int32_t re = buf[2*i];
+		int32_t im = buf[2*i+1];
+		samples[i] = IQSample( (re - 128) * k_scale, (im - 128) * k_scale );
+	}
+}
+
+static float 		s_lut256[256];
+static IQSample* 	s_lut65536 = NULL;
+static std::once_flag s_lut256_once;
+static std::once_flag s_lut65536_once;
+
+static void make_lut256(){
+	for (int i = 0; i < 256; i++)
+		s_lut256[i] = (i - 128) * k_scale;
+}
+
+static void make_lut65536(){
+	make_lut256();
+	s_lut65536 = new IQSample[65536];
+	for (int i = 0; i < 65536; i++)
+		s_lut65536[i] = IQSample(s_lut256[i & 0xff], s_lut256[i >> 8]);
+}
+
+static void convert_lut256(const uint8_t* buf, size_t count, IQSample* samples)
+{
+	for (size_t i = 0; i < count; i++) {
+		samples[i] = IQSample(s_lut256[buf[2*i]], s_lut256[buf[2*i+1]]);
+	}
+}
+
+static void convert_lut65536(const uint8_t* buf, size_t count, IQSample* samples)
+{
+	for (size_t i = 0; i < count; i++) {
+		uint16_t idx = buf[2*i] | (buf[2*i+1] << 8);
+		samples[i] = s_lut65536[idx];
+	}
+}
+
+// MARK: -  SIMD kernels
+// IQ pairs are interleaved the same way complex<float> is laid out in memory,
+// so the vector kernels just widen bytes to floats and store them in order.
+
+#if IQCONVERT_X86
+
+static void convert_sse2(const uint8_t* buf, size_t count, IQSample* samples)
+{
+	float* out = reinterpret_cast<float*>(samples);
+	size_t nbytes = 2 * count;
+	size_t i = 0;
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 offset = _mm_set1_ps(128.0f);
+	const __m128 scale = _mm_set1_ps(k_scale);
+
+	for (; i + 16 <= nbytes; i += 16) {
+		__m128i b  = _mm_loadu_si128((const __m128i*)(buf + i));
+		__m128i lo = _mm_unpacklo_epi8(b, zero);
+		__m128i hi = _mm_unpackhi_epi8(b, zero);
+
+		__m128 f0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+		__m128 f1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+		__m128 f2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+		__m128 f3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+
+		_mm_storeu_ps(out + i,      _mm_mul_ps(_mm_sub_ps(f0, offset), scale));
+		_mm_storeu_ps(out + i + 4,  _mm_mul_ps(_mm_sub_ps(f1, offset), scale));
+		_mm_storeu_ps(out + i + 8,  _mm_mul_ps(_mm_sub_ps(f2, offset), scale));
+		_mm_storeu_ps(out + i + 12, _mm_mul_ps(_mm_sub_ps(f3, offset), scale));
+	}
+
+	convert_scalar(buf + i, (nbytes - i) / 2, samples + i / 2);
+}
+
+__attribute__((target("avx2")))
+static void convert_avx2(const uint8_t* buf, size_t count, IQSample* samples)
+{
+	float* out = reinterpret_cast<float*>(samples);
+	size_t nbytes = 2 * count;
+	size_t i = 0;
+
+	const __m256 offset = _mm256_set1_ps(128.0f);
+	const __m256 scale = _mm256_set1_ps(k_scale);
+
+	for (; i + 32 <= nbytes; i += 32) {
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(buf + i));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(buf + i + 16));
+
+		__m256 f0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b0));
+		__m256 f1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(b0, 8)));
+		__m256 f2 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b1));
+		__m256 f3 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(b1, 8)));
+
+		_mm256_storeu_ps(out + i,      _mm256_mul_ps(_mm256_sub_ps(f0, offset), scale));
+		_mm256_storeu_ps(out + i + 8,  _mm256_mul_ps(_mm256_sub_ps(f1, offset), scale));
+		_mm256_storeu_ps(out + i + 16, _mm256_mul_ps(_mm256_sub_ps(f2, offset), scale));
+		_mm256_storeu_ps(out + i + 24, _mm256_mul_ps(_mm256_sub_ps(f3, offset), scale));
+	}
+
+	convert_scalar(buf + i, (nbytes - i) / 2, samples + i / 2);
+}
+
+#endif
+
+#if IQCONVERT_NEON
+
+static void convert_neon(const uint8_t* buf, size_t count, IQSample* samples)
+{
+	float* out = reinterpret_cast<float*>(samples);
+	size_t nbytes = 2 * count;
+	size_t i = 0;
+
+	const float32x4_t offset = vdupq_n_f32(128.0f);
+	const float32x4_t scale = vdupq_n_f32(k_scale);
+
+	for (; i + 16 <= nbytes; i += 16) {
+		uint8x16_t b = vld1q_u8(buf + i);
+		uint16x8_t lo = vmovl_u8(vget_low_u8(b));
+		uint16x8_t hi = vmovl_u8(vget_high_u8(b));
+
+		float32x4_t f0 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo)));
+		float32x4_t f1 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo)));
+		float32x4_t f2 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi)));
+		float32x4_t f3 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi)));
+
+		vst1q_f32(out + i,      vmulq_f32(vsubq_f32(f0, offset), scale));
+		vst1q_f32(out + i + 4,  vmulq_f32(vsubq_f32(f1, offset), scale));
+		vst1q_f32(out + i + 8,  vmulq_f32(vsubq_f32(f2, offset), scale));
+		vst1q_f32(out + i + 12, vmulq_f32(vsubq_f32(f3, offset), scale));
+	}
+
+	convert_scalar(buf + i, (nbytes - i) / 2, samples + i / 2);
+}
+
+#endif
+
+// MARK: -  IQConverter
+
+IQConverter::convert_func_t IQConverter::_convert = &convert_scalar;
+IQConverter::kernel_t  IQConverter::_kernel = IQConverter::KERNEL_SCALAR;
+
+IQConverter::convert_func_t IQConverter::kernelFunc(kernel_t kernel){
+
+	switch (kernel) {
+		case KERNEL_SCALAR:
+			return &convert_scalar;
+
+		case KERNEL_LUT256:
+			std::call_once(s_lut256_once, make_lut256);
+			return &convert_lut256;
+
+		case KERNEL_LUT65536:
+			std::call_once(s_lut65536_once, make_lut65536);
+			return &convert_lut65536;
+
+#if IQCONVERT_X86
+		case KERNEL_SSE2:
+			return &convert_sse2;
+
+		case KERNEL_AVX2:
+			if(__builtin_cpu_supports("avx2"))
+				return &convert_avx2;
+			break;
+#endif
+
+#if IQCONVERT_NEON
+		case KERNEL_NEON:
+			return &convert_neon;
+#endif
+
+		default: ;
+	}
+
+	return NULL;
+}
+
+vector<IQConverter::kernel_t> IQConverter::availableKernels(){
+
+	vector<kernel_t> kernels = { KERNEL_SCALAR, KERNEL_LUT256, KERNEL_LUT65536 };
+
+#if IQCONVERT_X86
+	kernels.push_back(KERNEL_SSE2);
+	if(__builtin_cpu_supports("avx2"))
+		kernels.push_back(KERNEL_AVX2);
+#endif
+
+#if IQCONVERT_NEON
+	kernels.push_back(KERNEL_NEON);
+#endif
+
+	return kernels;
+}
+
+bool IQConverter::selectKernel(kernel_t kernel){
+
+	convert_func_t func = kernelFunc(kernel);
+	if(!func)
+		return false;
+
+	_convert = func;
+	_kernel = kernel;
+	return true;
+}
+
+string IQConverter::kernelName(kernel_t kernel){
+
+	string str = "?";
+
+	switch (kernel) {
+		case KERNEL_SCALAR:		str = "scalar"; 		break;
+		case KERNEL_LUT256:		str = "lut256"; 		break;
+		case KERNEL_LUT65536:	str = "lut65536"; 	break;
+		case KERNEL_SSE2:			str = "sse2"; 			break;
+		case KERNEL_AVX2:			str = "avx2"; 			break;
+		case KERNEL_NEON:			str = "neon"; 			break;
+		default: ;
+	}
+
+	return str;
+}
+
+vector<IQConverter::benchmark_t> IQConverter::benchmark(size_t count, int rounds){
+
+	using namespace std::chrono;
+
+	vector<benchmark_t> results;
+
+	vector<uint8_t> buf(2 * count);
+	IQSampleVector samples(count);
+
+	// something that looks like noise around the ADC midpoint
+	uint32_t seed = 0x12345678;
+	for(auto &b : buf){
+		seed = seed * 1664525 + 1013904223;
+		b = seed >> 24;
+	}
+
+	for(auto kernel : availableKernels()){
+		convert_func_t func = kernelFunc(kernel);
+		if(!func) continue;
+
+		// warm up caches and tables
+		func(buf.data(), count, samples.data());
+
+		auto start = steady_clock::now();
+		for(int r = 0; r < rounds; r++)
+			func(buf.data(), count, samples.data());
+		double secs = duration<double>(steady_clock::now() - start).count();
+
+		double rate = secs > 0 ? (double(count) * rounds) / secs : 0;
+		results.push_back({kernel, rate});
+	}
+
+	return results;
+}
+
+IQConverter::kernel_t IQConverter::selectFastest(bool verbose){
+
+	kernel_t best = KERNEL_SCALAR;
+	double bestRate = 0;
+
+	for(auto result : benchmark()){
+		if(verbose)
+			fprintf(stderr, "IQConverter %-9s %8.1f Msamples/s\n",
+					  kernelName(result.kernel).c_str(), result.samplesPerSec * 1.0e-6);
+
+		if(result.samplesPerSec > bestRate){
+			bestRate = result.samplesPerSec;
+			best = result.kernel;
+		}
+	}
+
+	selectKernel(best);
+
+	if(verbose)
+		fprintf(stderr, "IQConverter using %s\n", kernelName(best).c_str());
+
+	return best;
+}
@@ -0,0 +1,63 @@
+//
+//  IQConverter.hpp
+//  carradio
+//
+//  Converts the unsigned 8-bit IQ pairs delivered by the RTL-SDR into
+//  complex<float> samples.  This runs on every sample the radio ever sees,
+//  so there are several kernels and the fastest one is picked at startup.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "IQSample.h"
+
+using namespace std;
+
+class IQConverter {
+
+public:
+	typedef enum  {
+		KERNEL_SCALAR = 0,
+		KERNEL_LUT256,			// 256 entry float table per component
+		KERNEL_LUT65536,		// 65536 entry table indexed by the whole IQ pair
+		KERNEL_SSE2,
+		KERNEL_AVX2,
+		KERNEL_NEON,
+	}kernel_t;
+
+	typedef struct {
+		kernel_t		kernel;
+		double		samplesPerSec;
+	} benchmark_t;
+
+	/** Convert count IQ pairs (2 * count bytes) into samples. */
+	static void convert(const uint8_t* buf, size_t count, IQSample* samples) {
+		_convert(buf, count, samples);
+	}
+
+	/** Kernels that can run on this CPU. */
+	static vector<kernel_t> availableKernels();
+
+	static bool selectKernel(kernel_t kernel);
+	static kernel_t selectedKernel() { return _kernel; }
+	static string kernelName(kernel_t kernel);
+
+	/** Time every available kernel over rounds blocks of count samples. */
+	static vector<benchmark_t> benchmark(size_t count = 65536, int rounds = 40);
+
+	/** Benchmark the kernels once and select the fastest. */
+	static kernel_t selectFastest(bool verbose = false);
+
+private:
+	typedef void (*convert_func_t)(const uint8_t* buf, size_t count, IQSample* samples);
+
+	static convert_func_t _convert;
+	static kernel_t		 _kernel;
+
+	static convert_func_t kernelFunc(kernel_t kernel);
+};
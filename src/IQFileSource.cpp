@@ -0,0 +1,338 @@
+//
+//  IQFileSource.cpp
+//  carradio
+//
+
+#include <errno.h>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#include "IQFileSource.hpp"
+#include "IQConverter.hpp"
+#include "json.hpp"
+
+using namespace std::chrono;
+
+static bool hasSuffix(const string &str, const string &suffix){
+	return str.size() >= suffix.size()
+		&& str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+IQFileSource::IQFileSource(){
+	_isSetup = false;
+	_realtime = true;
+	_fp = NULL;
+	_datatype = DATA_CU8;
+	_sampleRate = 0;
+	_frequency = 0;
+	_tunerGain = 0;
+	_blockLength = default_blockLength;
+	_blockPool.setBlockLength(_blockLength);
+	_sampleIndex = 0;
+	_captureFrequency = 0;
+	_ringBlocks = 0;
+	_phasor = 1;
+	_phasorStep = 1;
+}
+
+IQFileSource::~IQFileSource(){
+	stop();
+}
+
+bool IQFileSource::begin(string path, bool realtime, int &error){
+
+	stop();
+
+	string dataPath = path;
+
+	_datatype = DATA_CU8;
+	_sampleRate = 0;
+	_captures.clear();
+
+	if(hasSuffix(path, ".sigmf-meta") || hasSuffix(path, ".sigmf-data")){
+		string base = path.substr(0, path.size() - strlen(".sigmf-meta"));
+		dataPath = base + ".sigmf-data";
+
+		if(!parseSigMF(base + ".sigmf-meta", error))
+			return false;
+	}
+
+	_fp = fopen(dataPath.c_str(), "rb");
+	if(!_fp){
+		error = errno;
+		fprintf(stderr, "IQFileSource: failed to open %s - %s\n", dataPath.c_str(), strerror(errno));
+		return false;
+	}
+
+	_path = dataPath;
+	_realtime = realtime;
+	_sampleIndex = 0;
+	_captureFrequency = _captures.empty() ? 0 : _captures.front().frequency;
+	_nextDeadline = steady_clock::now();
+	_isSetup = true;
+
+	return true;
+}
+
+void IQFileSource::stop(){
+
+	if(_fp)
+		fclose(_fp);
+
+	_fp = NULL;
+	_isSetup = false;
+}
+
+void IQFileSource::setRealtime(bool realtime){
+	_realtime = realtime;
+	_nextDeadline = steady_clock::now();
+}
+
+bool IQFileSource::parseSigMF(string metaPath, int &error){
+
+	nlohmann::json meta;
+
+	std::ifstream ifs(metaPath);
+	if(!ifs.is_open()){
+		error = ENOENT;
+		fprintf(stderr, "IQFileSource: missing %s\n", metaPath.c_str());
+		return false;
+	}
+
+	try {
+		meta = nlohmann::json::parse(ifs);
+	}
+	catch(nlohmann::json::exception &e){
+		error = EINVAL;
+		fprintf(stderr, "IQFileSource: bad SigMF metadata - %s\n", e.what());
+		return false;
+	}
+
+	if(!meta.contains("global") || !meta["global"].is_object()){
+		error = EINVAL;
+		return false;
+	}
+
+	auto global = meta["global"];
+
+	string datatype = global.value("core:datatype", "");
+	if(datatype == "cu8")
+		_datatype = DATA_CU8;
+	else if(datatype == "cf32_le")
+		_datatype = DATA_CF32;
+	else {
+		error = EINVAL;
+		fprintf(stderr, "IQFileSource: unsupported SigMF datatype \"%s\"\n", datatype.c_str());
+		return false;
+	}
+
+	if(global.contains("core:sample_rate") && global["core:sample_rate"].is_number())
+		_sampleRate = global["core:sample_rate"].get<double>();
+
+	if(meta.contains("captures") && meta["captures"].is_array()){
+		for(auto &capture : meta["captures"]){
+			if(capture.is_object()
+				&& capture.contains("core:frequency")
+				&& capture["core:frequency"].is_number()){
+				uint64_t start = capture.value("core:sample_start", 0);
+				uint32_t freq = capture["core:frequency"].get<double>();
+				_captures.push_back({start, freq});
+			}
+		}
+	}
+
+	return true;
+}
+
+bool IQFileSource::getDeviceInfo(device_info_t& info){
+
+	if(!_isSetup)
+		return false;
+
+	info.index = 0;
+	info.name = _path;
+	info.vendor = "file";
+	info.product = _realtime ? "IQ playback" : "IQ playback (unthrottled)";
+	info.serial = "";
+	return true;
+}
+
+bool IQFileSource::setFrequency(uint32_t frequency){
+
+	if(!_isSetup)
+		return false;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_frequency = frequency;
+	updateShift();
+	return true;
+}
+
+uint32_t IQFileSource::getFrequency(){
+	return _frequency;
+}
+
+bool IQFileSource::setSampleRate(uint32_t sample_rate){
+
+	if(!_isSetup)
+		return false;
+
+	// SigMF knows its own rate.
+	if(!_captures.empty() && _sampleRate != 0 && sample_rate != _sampleRate){
+		fprintf(stderr, "IQFileSource: capture is %u S/s, can not play at %u S/s\n",
+				  _sampleRate, sample_rate);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	_sampleRate = sample_rate;
+	updateShift();
+	return true;
+}
+
+uint32_t IQFileSource::getSampleRate(){
+	return _sampleRate;
+}
+
+// Mix the capture so that the requested frequency ends up at DC.
+void IQFileSource::updateShift(){
+
+	_phasor = 1;
+	_phasorStep = 1;
+
+	if(_captureFrequency == 0 || _frequency == 0 || _sampleRate == 0)
+		return;
+
+	double shift = double(_captureFrequency) - double(_frequency);
+	if(fabs(shift) > _sampleRate / 2)
+		fprintf(stderr, "IQFileSource: %u Hz is outside the captured span\n", _frequency);
+
+	_phasorStep = polar(1.0, 2.0 * M_PI * shift / _sampleRate);
+}
+
+bool IQFileSource::setBlockLength(int blockLength){
+
+	if(blockLength <= 0)
+		return false;
+
+	_blockLength = blockLength;
+	_blockPool.setBlockLength(_blockLength);
+	return true;
+}
+
+bool IQFileSource::startStreaming(int ringBlocks){
+
+	if(!_isSetup)
+		return false;
+
+	if(ringBlocks != _ringBlocks){
+		_blockPool.clear();
+		_blockPool.setMaxFree(ringBlocks);
+		_ringBlocks = ringBlocks;
+	}
+
+	return true;
+}
+
+void IQFileSource::releaseSamples(IQSampleVector& samples){
+
+	if(samples.capacity() >= (size_t)_blockLength)
+		_blockPool.put(samples);
+}
+
+bool IQFileSource::readBlock(IQSampleVector& samples){
+
+	size_t sampleSize = _datatype == DATA_CU8 ? 2 : sizeof(IQSample);
+
+	_buf.resize(_blockLength * sampleSize);
+
+	size_t n = fread(_buf.data(), sampleSize, _blockLength, _fp);
+	if(n < (size_t)_blockLength){
+		if(ferror(_fp)){
+			fprintf(stderr, "IQFileSource: read failed - %s\n", strerror(errno));
+			return false;
+		}
+
+		// loop back to the start of the capture
+		rewind(_fp);
+		_sampleIndex = 0;
+
+		if(n == 0)
+			n = fread(_buf.data(), sampleSize, _blockLength, _fp);
+	}
+
+	if(n == 0)
+		return false;
+
+	samples.resize(n);
+
+	if(_datatype == DATA_CU8)
+		IQConverter::convert(_buf.data(), n, samples.data());
+	else
+		memcpy(samples.data(), _buf.data(), n * sizeof(IQSample));
+
+	return true;
+}
+
+bool IQFileSource::getSamples(IQSampleVector& samples){
+
+	if(!_isSetup)
+		return false;
+
+	// track the capture segment that was recorded at this point
+	if(!_captures.empty()){
+		uint32_t freq = _captures.front().frequency;
+		for(auto &capture : _captures){
+			if(capture.sample_start <= _sampleIndex)
+				freq = capture.frequency;
+		}
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		if(freq != _captureFrequency){
+			_captureFrequency = freq;
+			updateShift();
+		}
+	}
+
+	_blockPool.get(samples);
+
+	if(!readBlock(samples))
+		return false;
+
+	_sampleIndex += samples.size();
+
+	// mix outside the lock,  a retune meanwhile starts over from its own phasor
+	complex<double> phasor, step;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		phasor = _phasor;
+		step = _phasorStep;
+	}
+
+	if(step != 1.0){
+		for(auto &s : samples){
+			s *= IQSample(phasor.real(), phasor.imag());
+			phasor *= step;
+		}
+
+		// keep the oscillator on the unit circle
+		std::lock_guard<std::mutex> lock(_mutex);
+		if(_phasorStep == step)
+			_phasor = phasor / abs(phasor);
+	}
+
+	if(_realtime && _sampleRate > 0){
+		auto blockTime = duration<double>(double(samples.size()) / _sampleRate);
+		_nextDeadline += duration_cast<steady_clock::duration>(blockTime);
+
+		auto now = steady_clock::now();
+		if(_nextDeadline > now)
+			std::this_thread::sleep_until(_nextDeadline);
+		else if(now - _nextDeadline > seconds(1))
+			_nextDeadline = now;		// fell way behind,  dont try to catch up
+	}
+
+	return true;
+}
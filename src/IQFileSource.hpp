@@ -0,0 +1,126 @@
+//
+//  IQFileSource.hpp
+//  carradio
+//
+//  Plays back recorded IQ captures (raw .cu8 or SigMF) through the same
+//  interface RadioMgr uses for the RTL-SDR dongle.  Lets the decoders run on
+//  a dev box without hardware, and makes field CPU problems reproducible.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <complex>
+#include <mutex>
+
+#include "IQSample.h"
+#include "SDRSource.hpp"
+
+using namespace std;
+
+class IQFileSource : public SDRSource
+{
+public:
+
+	static constexpr int 	default_blockLength = 65536;
+
+	IQFileSource();
+	~IQFileSource();
+
+	/**
+	 * Open a recorded capture.
+	 *
+	 * path      :: raw .cu8 file, or either file of a SigMF pair
+	 *              (.sigmf-meta / .sigmf-data, datatype cu8 or cf32_le).
+	 * realtime  :: pace blocks at the capture sample rate. Set to false to
+	 *              feed the decoder as fast as it can take them.
+	 *
+	 * Playback loops at the end of the file.
+	 */
+	bool begin(string path, bool realtime, int &error);
+	void stop();
+
+	bool isRealtime() { return _realtime; }
+	void setRealtime(bool realtime);
+
+	bool getDeviceInfo(device_info_t&);
+
+	/**
+	 * Set center frequency in Hz.
+	 * When the capture frequency is known (SigMF) the samples are shifted
+	 * so retuning within the captured span behaves like the dongle.
+	 */
+	bool setFrequency(uint32_t);
+	uint32_t getFrequency();
+
+	/** Raw files take any rate,  SigMF captures only their own. */
+	bool setSampleRate(uint32_t);
+	uint32_t getSampleRate();
+
+	int getTunerGain() { return _tunerGain; }
+	std::vector<int> getTunerGains() { return {}; }
+	bool setTunerGain(int gain) { _tunerGain = gain; return true; }
+
+	bool setOffsetTuning(bool) { return true; }
+	bool setACGMode(bool) { return true; }
+	bool setBiasTee(bool) { return true; }
+
+	bool setBlockLength(int blockLength);
+	int getBlockLength() { return _blockLength; }
+
+	bool resetBuffer() { return _isSetup; }
+
+	bool startStreaming(int ringBlocks = default_ringBlocks);
+	void stopStreaming() {};
+	bool isStreaming() { return _isSetup; }
+
+	bool getSamples(IQSampleVector& samples);
+	void releaseSamples(IQSampleVector& samples);
+	blockPoolStats_t blockStats() { return _blockPool.stats(); }
+	uint64_t droppedBlocks() { return 0; }		// the file waits for us
+
+private:
+
+	typedef enum  {
+		DATA_CU8 = 0,
+		DATA_CF32,
+	}datatype_t;
+
+	typedef struct {
+		uint64_t		sample_start;
+		uint32_t		frequency;
+	} capture_t;
+
+	bool						_isSetup;
+	bool						_realtime;
+	FILE*						_fp;
+	string 					_path;
+	datatype_t				_datatype;
+	uint32_t 				_sampleRate;
+	uint32_t 				_frequency;
+	int						_tunerGain;
+	int       				_blockLength;
+
+	vector<capture_t>		_captures;		// empty for raw files
+	uint64_t 				_sampleIndex;
+	uint32_t 				_captureFrequency;
+
+	vector<uint8_t>		_buf;
+	BlockPool<IQSample>	_blockPool;
+	int						_ringBlocks;
+
+	// emulated retune,  set from the tuning thread while getSamples() mixes
+	std::mutex				_mutex;
+	std::complex<double>	_phasor;
+	std::complex<double>	_phasorStep;
+
+	std::chrono::steady_clock::time_point _nextDeadline;
+
+	bool parseSigMF(string metaPath, int &error);
+	void updateShift();		// with _mutex held
+	bool readBlock(IQSampleVector& samples);
+};
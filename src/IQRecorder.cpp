@@ -0,0 +1,279 @@
+//
+//  IQRecorder.cpp
+//  carradio
+//
+
+#include <errno.h>
+#include <cstring>
+#include <fstream>
+#include <unistd.h>
+
+#include "IQRecorder.hpp"
+#include "CommonDefs.hpp"
+#include "ThreadPolicy.hpp"
+#include "json.hpp"
+
+typedef void * (*THREADFUNCPTR)(void *);
+
+static bool hasSuffix(const string &str, const string &suffix){
+	return str.size() >= suffix.size()
+		&& str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+IQRecorder::IQRecorder(){
+	_isRecording = false;
+	_fp = NULL;
+	_readyHead = 0;
+	_readyCount = 0;
+	_shouldQuit = false;
+	_bytesQueued = 0;
+	_bytesWritten = 0;
+	_bytesDropped = 0;
+	_droppedBlocks = 0;
+	_gap = false;
+}
+
+IQRecorder::~IQRecorder(){
+	stop();
+}
+
+bool IQRecorder::begin(string path, uint32_t sampleRate, uint32_t frequency,
+							  format_t format){
+	int error = 0;
+	return begin(path, sampleRate, frequency, format, error);
+}
+
+bool IQRecorder::begin(string path, uint32_t sampleRate, uint32_t frequency,
+							  format_t format, int &error){
+
+	if(_isRecording)
+		stop();
+
+	string dataPath;
+
+	_format = format;
+	_sampleRate = sampleRate;
+	_captures.clear();
+	_captures.push_back({0, 0, frequency});
+
+	if(format == FORMAT_SIGMF){
+		dataPath  = path + ".sigmf-data";
+		_metaPath = path + ".sigmf-meta";
+	}
+	else {
+		dataPath = hasSuffix(path, ".cu8") ? path : path + ".cu8";
+		_metaPath.clear();
+	}
+
+	_fp = fopen(dataPath.c_str(), "wb");
+	if(!_fp){
+		error = errno;
+		fprintf(stderr, "IQRecorder: failed to open %s - %s\n", dataPath.c_str(), strerror(errno));
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		// the ring is allocated here, write() only ever swaps blocks around.
+		_readyBlocks.clear();
+		_readyBlocks.resize(default_ringBlocks);
+		_freeBlocks.clear();
+		_freeBlocks.reserve(default_ringBlocks);
+		for(int i = 0; i < default_ringBlocks; i++){
+			vector<uint8_t> block;
+			block.reserve(default_blockSize);
+			_freeBlocks.push_back(std::move(block));
+		}
+		_readyHead = 0;
+		_readyCount = 0;
+		_bytesQueued = 0;
+		_bytesWritten = 0;
+		_bytesDropped = 0;
+		_droppedBlocks = 0;
+		_gap = false;
+		_shouldQuit = false;
+		_isRecording = true;
+	}
+
+	if(format == FORMAT_SIGMF)
+		writeMetaFile();
+
+	pthread_create(&_writerTID, NULL,
+						(THREADFUNCPTR) &IQRecorder::WriterThread, (void*)this);
+	ThreadPolicy::shared()->registerThread("IQRecorder", _writerTID);
+
+	return true;
+}
+
+void IQRecorder::stop(){
+
+	if(!_isRecording)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_shouldQuit = true;
+		_isRecording = false;
+	}
+	_cond.notify_all();
+	pthread_join(_writerTID, NULL);
+
+	fclose(_fp);
+	_fp = NULL;
+
+	if(_format == FORMAT_SIGMF)
+		writeMetaFile();
+
+	if(_droppedBlocks)
+		fprintf(stderr, "IQRecorder: %llu blocks dropped (disk too slow)\n",
+				  (unsigned long long)_droppedBlocks);
+}
+
+void IQRecorder::write(const uint8_t* buf, size_t len){
+
+	vector<uint8_t> block;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if(!_isRecording)
+			return;
+
+		if(_freeBlocks.empty()){
+			_droppedBlocks++;
+			_bytesDropped += len;
+			_gap = true;
+			return;
+		}
+
+		block = std::move(_freeBlocks.back());
+		_freeBlocks.pop_back();
+	}
+
+	block.assign(buf, buf + min(len, (size_t)default_blockSize));
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		// samples missing from the file,  start a segment that says so
+		if(_gap){
+			addCapture(_captures.back().frequency);
+			_gap = false;
+		}
+
+		_bytesQueued += block.size();
+		_bytesDropped += len - block.size();
+		_gap = len > block.size();
+		int tail = (_readyHead + _readyCount) % default_ringBlocks;
+		_readyBlocks[tail] = std::move(block);
+		_readyCount++;
+	}
+	_cond.notify_one();
+}
+
+void IQRecorder::setFrequency(uint32_t frequency){
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if(!_isRecording)
+		return;
+
+	addCapture(frequency);
+}
+
+void IQRecorder::addCapture(uint32_t frequency){
+
+	// cu8 is 2 bytes per sample
+	uint64_t sample_start = _bytesQueued / 2;
+	uint64_t global_index = (_bytesQueued + _bytesDropped) / 2;
+
+	if(_captures.back().sample_start == sample_start){
+		_captures.back().global_index = global_index;
+		_captures.back().frequency = frequency;
+	}
+	else
+		_captures.push_back({sample_start, global_index, frequency});
+}
+
+bool IQRecorder::writeMetaFile(){
+
+	nlohmann::json meta;
+
+	meta["global"] = {
+		{"core:datatype", 	"cu8"},
+		{"core:sample_rate", _sampleRate},
+		{"core:version", 		"1.0.0"},
+		{"core:recorder", 	"carradio"},
+	};
+
+	nlohmann::json captures = nlohmann::json::array();
+	for(auto &capture : _captures){
+		captures.push_back({
+			{"core:sample_start", capture.sample_start},
+			{"core:global_index", capture.global_index},
+			{"core:frequency", 	 capture.frequency},
+		});
+	}
+	meta["captures"] = captures;
+	meta["annotations"] = nlohmann::json::array();
+
+	std::ofstream ofs;
+
+	try{
+		ofs.open(_metaPath, std::ios_base::trunc);
+
+		if(ofs.fail())
+			return false;
+
+		ofs << meta.dump(4) << "\n";
+		ofs.close();
+	}
+	catch(std::ofstream::failure &writeErr) {
+		return false;
+	}
+
+	return true;
+}
+
+// MARK: -  Writer thread
+
+void IQRecorder::Writer(){
+
+	PRINT_CLASS_TID;
+
+	while(true){
+		vector<uint8_t> block;
+
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cond.wait(lock, [this]{ return _readyCount > 0 || _shouldQuit; });
+
+			// drain everything before quitting
+			if(_readyCount == 0)
+				break;
+
+			block = std::move(_readyBlocks[_readyHead]);
+			_readyHead = (_readyHead + 1) % default_ringBlocks;
+			_readyCount--;
+		}
+
+		size_t n = fwrite(block.data(), 1, block.size(), _fp);
+		if(n != block.size())
+			fprintf(stderr, "IQRecorder: write failed - %s\n", strerror(errno));
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_bytesWritten += n;
+			_freeBlocks.push_back(std::move(block));
+		}
+	}
+}
+
+void* IQRecorder::WriterThread(void *context){
+	IQRecorder* d = (IQRecorder*)context;
+
+	d->Writer();
+
+	return((void *)1);
+}
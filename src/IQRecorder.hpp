@@ -0,0 +1,99 @@
+//
+//  IQRecorder.hpp
+//  carradio
+//
+//  Tees raw cu8 blocks from the RtlSdr to disk.  write() only copies into a
+//  pre-allocated ring, a background thread does the file I/O so the USB
+//  callback never waits on the SD card.
+//
+
+#pragma once
+
+#include <stdio.h>
+#include <pthread.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+class IQRecorder {
+
+public:
+	typedef enum  {
+		FORMAT_CU8 = 0,		// raw interleaved unsigned 8 bit IQ
+		FORMAT_SIGMF,			// .sigmf-data  + .sigmf-meta
+	}format_t;
+
+	static constexpr int 	default_blockSize = 2 * 65536;
+	static constexpr int 	default_ringBlocks = 32;
+
+	IQRecorder();
+	~IQRecorder();
+
+	/**
+	 * Start recording.
+	 * path is the file name without extension for SigMF,  ".cu8" is
+	 * appended for raw recordings if not already present.
+	 */
+	bool begin(string path, uint32_t sampleRate, uint32_t frequency,
+				  format_t format = FORMAT_SIGMF);
+	bool begin(string path, uint32_t sampleRate, uint32_t frequency,
+				  format_t format, int &error);
+	void stop();
+
+	bool isRecording() { return _isRecording; }
+
+	/** Queue raw cu8 bytes for writing.  Never blocks. */
+	void write(const uint8_t* buf, size_t len);
+
+	/** Note a retune, SigMF gets a new capture segment. */
+	void setFrequency(uint32_t frequency);
+
+	uint64_t bytesWritten() { return _bytesWritten; }
+	uint64_t droppedBlocks() { return _droppedBlocks; }
+	uint64_t droppedBytes() { return _bytesDropped; }
+
+private:
+
+	bool					_isRecording;
+	format_t 			_format;
+	FILE*					_fp;
+	string 				_metaPath;
+	uint32_t 			_sampleRate;
+
+	// sample_start is where the segment starts in the file,  global_index
+	// where it starts in what the dongle sent,  they part after a drop.
+	typedef struct {
+		uint64_t		sample_start;
+		uint64_t		global_index;
+		uint32_t		frequency;
+	} capture_t;
+
+	vector<capture_t>	_captures;
+
+	std::mutex 					_mutex;
+	std::condition_variable 	_cond;
+	vector<vector<uint8_t>> 	_freeBlocks;
+	vector<vector<uint8_t>> 	_readyBlocks;		// fifo
+	int							_readyHead;
+	int							_readyCount;
+	bool							_shouldQuit;
+
+	uint64_t 			_bytesQueued;
+	uint64_t 			_bytesWritten;
+	uint64_t 			_bytesDropped;
+	uint64_t 			_droppedBlocks;
+	bool					_gap;				// dropped since the last queued block
+
+	void addCapture(uint32_t frequency);		// with _mutex held
+
+	pthread_t			_writerTID;
+
+	void Writer();		// C++ version of thread
+	static void* WriterThread(void *context);
+
+	bool writeMetaFile();
+};
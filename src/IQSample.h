@@ -12,7 +12,15 @@
 typedef std::complex<float> IQSample;
 typedef std::vector<IQSample> IQSampleVector;
 
+// Demodulated audio path precision.  Build with USE_FLOAT_SAMPLES=1
+// (cmake -DSAMPLE_FLOAT=ON) to run it in single precision, which doubles
+// the SIMD width of the FIR filters on the Pi.  Recursive filter and PLL
+// state stays in double either way.
+#if USE_FLOAT_SAMPLES
+typedef float Sample;
+#else
 typedef double Sample;
+#endif
 typedef std::vector<Sample> SampleVector;
 
 
@@ -20,12 +28,12 @@ typedef std::vector<Sample> SampleVector;
 inline void samples_mean_rms(const SampleVector& samples,
 									  double& mean, double& rms)
 {
-	 Sample vsum = 0;
-	 Sample vsumsq = 0;
+	 double vsum = 0;
+	 double vsumsq = 0;
 
 	 size_t n = samples.size();
 	 for (auto i = 0; i < n; i++) {
-		  Sample v = samples[i];
+		  double v = samples[i];
 		  vsum   += v;
 		  vsumsq += v * v;
 	 }
@@ -0,0 +1,162 @@
+//
+//  MultiChannelDecode.cpp
+//  carradio
+//
+
+#include <cassert>
+#include <cmath>
+
+#include "MultiChannelDecode.hpp"
+
+using namespace std;
+
+
+/* ****************  class MultiChannelDecoder  **************** */
+
+MultiChannelDecoder::MultiChannelDecoder(double sample_rate_if,
+													  const vector<channel_t>& channels,
+													  double sample_rate_pcm,
+													  double deemphasis,
+													  double freq_dev,
+													  double bandwidth_pcm,
+													  int squelch_level,
+													  unsigned int if_filter_order)
+
+	 // The cutoff of 1 / bins puts the -6 dB points one bin spacing either
+	 // side of the centre,  so bins are two spacings wide.  That much is
+	 // needed:  a channel half way between two bin centres is up to half
+	 // a spacing (9.4 kHz at 2.4 MS/s) off,  and a 12.5 kHz channel there
+	 // reaches 15.6 kHz out,  still inside the 18.75 kHz edge.  With 4x
+	 // oversampling what folds back at the bin rate comes from far down
+	 // the stopband.  Don't narrow the cutoff to one spacing wide.
+	 : m_channelizer(channelizer_bins, channelizer_decimation,
+						  channelizer_taps, 1.0 / channelizer_bins)
+	 , m_active(-1)
+	 , m_active_decoder(-1)
+{
+	 double bin_spacing = sample_rate_if / channelizer_bins;
+	 double bin_rate    = sample_rate_if / channelizer_decimation;
+	 double max_offset  = 0.5 * usable_span(sample_rate_if);
+
+	 for (unsigned int i = 0; i < channels.size(); i++) {
+		  const channel_t& ch = channels[i];
+
+		  if (fabs(ch.tuning_offset) > max_offset)
+				continue;
+
+		  // Nearest bin,  the decoder's fine tuner takes up the rest.
+		  int bin = lrint(ch.tuning_offset / bin_spacing);
+		  double residual = ch.tuning_offset - bin * bin_spacing;
+
+		  decoder_t d;
+		  d.channel  = i;
+		  d.priority = ch.priority;
+		  d.decoder.reset(new VhfDecoder(bin_rate,
+													residual,
+													sample_rate_pcm,
+													deemphasis,
+													ch.bandwidth_if,
+													freq_dev,
+													bandwidth_pcm,
+													1,
+													squelch_level,
+													if_filter_order));
+		  m_decoders.push_back(move(d));
+		  m_bins.push_back((bin + int(channelizer_bins)) % channelizer_bins);
+	 }
+}
+
+
+void MultiChannelDecoder::process(const IQSampleVector& samples_in,
+											 SampleVector& audio)
+{
+	 m_channelizer.process(samples_in, m_bins, m_buf_bins);
+
+	 // Every channel runs every block so its squelch and filters stay
+	 // current.  Squelched ones stop at their power meter.
+	 for (unsigned int i = 0; i < m_decoders.size(); i++)
+		  m_decoders[i].decoder->process(m_buf_bins[i], m_decoders[i].audio);
+
+	 select_active();
+
+	 if (m_active_decoder >= 0) {
+		  audio = m_decoders[m_active_decoder].audio;
+	 }
+	 else {
+		  // same amount of silence as a channel would have produced
+		  size_t n = m_decoders.empty() ? 0 : m_decoders[0].audio.size();
+		  audio.assign(n, 0.0);
+	 }
+}
+
+
+// Pick the channel to hear.
+void MultiChannelDecoder::select_active()
+{
+	 int best = -1;
+	 for (unsigned int i = 0; i < m_decoders.size(); i++) {
+		  if (m_decoders[i].decoder->isSquelched())
+				continue;
+
+		  // first in the list wins a tie
+		  if (best < 0 || m_decoders[i].priority > m_decoders[best].priority)
+				best = i;
+	 }
+
+	 // Stay with an open channel until it closes,  unless something more
+	 // important comes up.
+	 int current = m_active_decoder;
+	 if (current >= 0 && !m_decoders[current].decoder->isSquelched()
+		  && m_decoders[best].priority <= m_decoders[current].priority)
+		  best = current;
+
+	 m_active_decoder = best;
+	 m_active = (best < 0) ? -1 : m_decoders[best].channel;
+}
+
+
+double MultiChannelDecoder::get_if_level() const
+{
+	 if (m_active_decoder >= 0)
+		  return m_decoders[m_active_decoder].decoder->get_if_level();
+
+	 double level = 0;
+	 for (const auto& d : m_decoders)
+		  level = max(level, d.decoder->get_if_level());
+	 return level;
+}
+
+
+double MultiChannelDecoder::get_baseband_level() const
+{
+	 if (m_active_decoder >= 0)
+		  return m_decoders[m_active_decoder].decoder->get_baseband_level();
+
+	 return 0;
+}
+
+
+void MultiChannelDecoder::set_squelch_level(int level)
+{
+	 for (auto& d : m_decoders)
+		  d.decoder->set_squelch_level(level);
+}
+
+
+void MultiChannelDecoder::set_squelch_dwell(uint count)
+{
+	 for (auto& d : m_decoders)
+		  d.decoder->set_squelch_dwell(count);
+}
+
+
+void MultiChannelDecoder::reset()
+{
+	 for (auto& d : m_decoders)
+		  d.decoder->reset();
+
+	 m_active = -1;
+	 m_active_decoder = -1;
+}
+
+/* end */
@@ -0,0 +1,120 @@
+//
+//  MultiChannelDecode.hpp
+//  carradio
+//
+//  Decodes every scanner channel that fits in one capture at the same time.
+//  A polyphase channelizer splits the wideband IQ into bins, each channel
+//  runs its own VhfDecoder on its bin, and the squelch of each decoder
+//  together with the channel priority decides which one is heard.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Filter.hpp"
+#include "SDRDecoder.hpp"
+#include "VhfDecode.hpp"
+
+
+/** Narrowband FM decoder for several channels inside one capture. */
+class MultiChannelDecoder : public SDRDecoder
+{
+public:
+
+	 /** Channelizer bins across the capture,  power of 2. */
+	 static constexpr unsigned int channelizer_bins       = 128;
+
+	 /** Input samples per bin sample,  4x oversampled bins. */
+	 static constexpr unsigned int channelizer_decimation =  32;
+
+	 /** Prototype filter length in units of bins. */
+	 static constexpr unsigned int channelizer_taps       =   6;
+
+	 /** Part of the capture away from the band edges that is decoded. */
+	 static constexpr double usable_fraction              = 0.8;
+
+	 typedef struct {
+		  double  tuning_offset;    // Hz relative to the receiver LO
+		  double  bandwidth_if;     // half bandwidth of the IF in Hz
+		  int     priority;         // higher is heard first
+	 } channel_t;
+
+	 /**
+	  * Construct decoder.
+	  *
+	  * sample_rate_if   :: IQ sample rate in Hz.
+	  * channels         :: Channels to decode,  offsets outside the usable
+	  *                     part of the capture are never heard.
+	  * sample_rate_pcm  :: Audio sample rate.
+	  * deemphasis, freq_dev, bandwidth_pcm, squelch_level, if_filter_order
+	  *                  :: As for VhfDecoder,  the same for every channel.
+	  */
+	 MultiChannelDecoder(double sample_rate_if,
+								const std::vector<channel_t>& channels,
+								double sample_rate_pcm,
+								double deemphasis,
+								double freq_dev,
+								double bandwidth_pcm,
+								int squelch_level = 0,
+								unsigned int if_filter_order = 0);
+
+	 /**
+	  * Process IQ samples and return audio samples of the channel that is
+	  * heard,  interleaved left/right.  Silence while every channel is
+	  * squelched.
+	  */
+	 void process(const IQSampleVector& samples_in,
+					  SampleVector& audio);
+
+	 /** Index into channels of the channel being heard,  -1 if none. */
+	 int active_channel() const
+	 {
+		  return m_active;
+	 }
+
+	 /** Return RMS IF level of the channel being heard,  else the strongest. */
+	 double get_if_level() const;
+
+	 /** Return RMS baseband level of the channel being heard. */
+	 double get_baseband_level() const;
+
+	 bool canSquelch() const  { return true; };
+
+	 /** Squelched when no channel is open. */
+	 bool isSquelched() const  { return m_active < 0; };
+
+	 void set_squelch_level(int level);
+
+	 void set_squelch_dwell(uint count);
+
+	 void reset();
+
+	 /** Width in Hz of the part of a capture that can hold channels. */
+	 static double usable_span(double sample_rate_if)
+	 {
+		  return usable_fraction * sample_rate_if;
+	 }
+
+private:
+
+	 /** Pick the channel to hear from the squelch state of all of them. */
+	 void select_active();
+
+	 struct decoder_t {
+		  int                          channel;   // index into channels
+		  int                          priority;
+		  std::unique_ptr<VhfDecoder>  decoder;
+		  SampleVector                 audio;
+	 };
+
+	 PolyphaseChannelizer         m_channelizer;
+	 std::vector<decoder_t>       m_decoders;     // usable channels only
+	 std::vector<unsigned int>    m_bins;         // bin of each decoder
+	 std::vector<IQSampleVector>  m_buf_bins;
+	 int                          m_active;       // index into channels
+	 int                          m_active_decoder;
+};
+
+/* end */
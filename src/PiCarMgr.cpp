@@ -41,6 +41,8 @@
 #include "Utils.hpp"
 #include "TimeStamp.hpp"
 #include "timespec_util.h"
+#include "ThreadPolicy.hpp"
+#include "DSPTiming.hpp"
 
 #pragma clang diagnostic ignored "-Wc99-designator"
 
@@ -174,6 +176,7 @@ PiCarMgr::PiCarMgr(): _display(DisplayMgr::U8G2_OLED_DISPLAY){
 		{MENU_WAYPOINTS,	"Waypoints"},
 		{MENU_CANBUS,	"Engine Status"},
 		{MENU_DTC,		"Diagnostics"},
+		{MENU_SPECTRUM,	"Band Scope"},
  		{MENU_SETTINGS, "Settings"},
 		{MENU_DEBUG, 	"Debug"},
 		{MENU_TIME,		"Time"},
@@ -184,6 +187,7 @@ PiCarMgr::PiCarMgr(): _display(DisplayMgr::U8G2_OLED_DISPLAY){
 	
 	pthread_create(&_piCarLoopTID, NULL,
 						(THREADFUNCPTR) &PiCarMgr::PiCarLoopThread, (void*)this);
+	ThreadPolicy::shared()->registerThread("PiCarLoop", _piCarLoopTID);
 		
 	_stations.clear();
 	_preset_stations.clear();
@@ -243,6 +247,13 @@ bool PiCarMgr::begin(){
 		// read in any properties
 		_db.restorePropertiesFromFile();
 		
+		// scheduling for the threads the managers already started
+		{
+			nlohmann::json j;
+			if(_db.getJSONProperty(PROP_THREAD_POLICY,&j))
+				ThreadPolicy::shared()->configure(j);
+		}
+		
 		// start 1Wire devices
 		_w1.begin();
 		
@@ -265,12 +276,32 @@ bool PiCarMgr::begin(){
 		// SETUP CANBUS
 		_can.begin();
 		
+		// low latency audio keeps a short target fill instead of
+		// starting every stream a second deep
+		int audioTargetMs = 0;
+		if(_db.getIntProperty(PROP_AUDIO_TARGET_MS, &audioTargetMs) && audioTargetMs > 0)
+			_radio.setLowLatency(audioTargetMs);
+		else
+			audioTargetMs = 0;
+		
 		// find first RTS device
 		auto devices = RtlSdr::get_devices();
 		if(devices.size() > 0) {
 			if(!_radio.begin(devices[0].index, pcmrate))
 				throw Exception("failed to setup Radio ");
 		}
+		else {
+			// no dongle,  fall back to a recorded capture if there is one
+			string iqPath;
+			bool realtime = true;
+			
+			if(_db.getProperty(PROP_SDR_IQ_FILE, &iqPath) && !iqPath.empty()){
+				_db.getBoolProperty(PROP_SDR_IQ_REALTIME, &realtime);
+				
+				if(!_radio.beginIQFile(iqPath, realtime, pcmrate, error))
+					printf("failed to open IQ file %s\n", iqPath.c_str());
+			}
+		}
 		
 #if defined(__APPLE__)
 		const char* path_gps  = "/dev/cu.usbmodem14101";
@@ -281,8 +312,12 @@ bool PiCarMgr::begin(){
 		if(!_gps.begin(path_gps, B38400, error))
 			throw Exception("failed to setup GPS.  error: %d", error);
 		
-		// setup audio out
-		if(!_audio.begin(pcmrate, true ))
+		// setup audio out,  in low latency mode ALSA holds about half the
+		// target and the rest queues in the radio
+		unsigned int audioLatencyUs = audioTargetMs > 0
+					? audioTargetMs * 500 : AudioOutput::default_latencyUs;
+		
+		if(!_audio.begin(pcmrate, true, error, audioLatencyUs))
 			throw Exception("failed to setup Audio ");
 		
 		// quiet audio first
@@ -1944,6 +1979,20 @@ void PiCarMgr::idle(){
 		});
 	}
 	
+	// thread run time,  wakeup latency and deadline misses
+	{
+		map<string,string> threadStats;
+		if(ThreadPolicy::shared()->statsValues(threadStats))
+			_db.updateValues(threadStats);
+	}
+	
+	// radio chain stage timing
+	{
+		map<string,string> dspStats;
+		if(DSPTiming::statsValues(dspStats))
+			_db.updateValues(dspStats);
+	}
+	
 	if(_fan.isConnected()){
 		// handle input
 		_fan.rcvResponse([=]( map<string,string> results){
@@ -2086,6 +2135,10 @@ PiCarMgr::menu_mode_t PiCarMgr::currentMode(){
 		case DisplayMgr::MODE_DTC:
 			mode = MENU_DTC;
 			break;
+
+		case DisplayMgr::MODE_SPECTRUM:
+			mode = MENU_SPECTRUM;
+			break;
 			
 		default:
 			break;
@@ -2205,6 +2258,10 @@ void PiCarMgr::setDisplayMode(menu_mode_t menuMode){
 			_display.showDTC();
 			break;
 			
+		case MENU_SPECTRUM:
+			_display.showSpectrum();
+			break;
+			
 		case MENU_EXIT:
 			if(_radio.isOn()) {
 				if(_radio.isScannerMode())
@@ -2420,7 +2477,8 @@ void PiCarMgr::displayRadioMenu() {
 }
 
 void PiCarMgr::displayDebugMenu() {
-    vector<string> items = {"System Info", "Radio Debug", "Display Test"};
+    vector<string> items = {"System Info", "Radio Debug", "Display Test",
+        _radio.isIQRecording() ? "Stop IQ Recording" : "Record IQ"};
     
     _display.showMenuScreen(items, 0, "Debug Menu", 0, [=](bool didSucceed, uint selectedIndex, DisplayMgr::knob_action_t action) {
         if(didSucceed && action == DisplayMgr::KNOB_CLICK) {
@@ -2430,17 +2488,82 @@ void PiCarMgr::displayDebugMenu() {
                     break;
                     
                 case 1: // Radio Debug
-                    // Add radio debug functionality
+                    displayDSPTiming();
                     break;
                     
                 case 2: // Display Test
                     _display.showMessage("Display Test");
                     break;
+                    
+                case 3: // Record IQ
+                    toggleIQRecording();
+                    break;
             }
         }
     });
 }
 
+// SigMF capture of the dongle as it is tuned now,  named for the time and
+// frequency,  to replay through sdr_iq_file later.
+void PiCarMgr::toggleIQRecording() {
+	
+	if(_radio.isIQRecording()){
+		_radio.stopIQRecording();
+		_display.showMessage("IQ Recording Stopped", 2,[=](){
+			displayDebugMenu();
+		});
+		return;
+	}
+	
+	string prefix = "iq";
+	_db.getProperty(PROP_SDR_IQ_RECORD_PATH, &prefix);
+	
+	char stamp[32];
+	time_t now = time(NULL);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+	
+	string path = prefix + "-" + stamp + "-" + to_string(_radio.frequency());
+	bool success = _radio.startIQRecording(path);
+	
+	if(success)
+		printf("IQ recording to %s\n", path.c_str());
+	
+	_display.showMessage( success?"IQ Recording":"IQ Recording Failed", 2,[=](){
+		displayDebugMenu();
+	});
+}
+
+// p50 / p99 block time in us and percent of real time for each radio
+// stage,  as of the last values published from idle()
+void PiCarMgr::displayDSPTiming() {
+	
+	constexpr time_t timeout_secs = 10;
+	
+	vector<string> items;
+	
+	for(auto &s : DSPTiming::lastStats()){
+		char buf[64];
+		snprintf(buf, sizeof(buf), "%-9s %5.0f/%-5.0f %4.1f%%",
+					s.name.c_str(), s.p50Us, s.p99Us, s.rtPercent);
+		items.push_back(buf);
+	}
+	
+	if(items.empty())
+		items.push_back("No DSP stats yet");
+	
+	items.push_back("Exit");
+	
+	_display.showMenuScreen(items, (uint) items.size() - 1, "p50/p99 us  %RT", timeout_secs,
+									[=](bool didSucceed, uint selectedIndex, DisplayMgr::knob_action_t action) {
+		
+		// anything but Exit refreshes
+		if(didSucceed && action == DisplayMgr::KNOB_CLICK && selectedIndex != items.size() - 1)
+			displayDSPTiming();
+		else
+			displayDebugMenu();
+	});
+}
+
 vector<string> PiCarMgr::settingsMenuItems(){
 	string dim_entry = _autoDimmerMode ? "Dim Screen (auto)": "Dim Screen";
  
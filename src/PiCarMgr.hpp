@@ -206,6 +206,7 @@ private:
         MENU_TIME,
         MENU_SETTINGS,
         MENU_DTC,
+        MENU_SPECTRUM,
         MENU_EXIT
     } menu_mode_t;
 
@@ -234,6 +235,8 @@ private:
     void displayMenu();
     void displayRadioMenu();
     void displayDebugMenu();
+    void displayDSPTiming();
+    void toggleIQRecording();
     void displaySettingsMenu();
     void displayShutdownMenu();
     vector<string> settingsMenuItems();
@@ -33,6 +33,28 @@ inline static const string VAL_MODULATION_MODE	= "mode";
 inline static const string VAL_RADIO_ON			= "radioON";
 inline static const string VAL_AUTO					= "auto";
 
+inline static const string VAL_SCANNER_HOP_RATE		= "scanner_hops";		// retunes per second
+inline static const string VAL_SCANNER_TIME_TO_AUDIO	= "scanner_tta";		// ms from hunting to audio
+
+inline static const string VAL_AUDIO_BLOCK_ALLOCS	= "audio_block_allocs";	// heap allocations,  should stop rising
+inline static const string VAL_IQ_BLOCK_ALLOCS		= "iq_block_allocs";
+inline static const string VAL_IQ_DROPPED_BLOCKS	= "iq_dropped_blocks";	// USB transfers with no free block
+
+inline static const string VAL_AUDIO_FILL_MS		= "audio_fill_ms";		// queued + ALSA,  low latency mode
+inline static const string VAL_AUDIO_UNDERRUNS		= "audio_underruns";
+inline static const string VAL_AUDIO_DRIFT_PPM		= "audio_drift_ppm";	// SDR clock against sound card
+inline static const string VAL_AUDIO_RMS_DB		= "audio_rms_db";		// dBFS going out to ALSA
+inline static const string VAL_AUDIO_PEAK_DB		= "audio_peak_db";
+inline static const string VAL_AUDIO_CLIPPED		= "audio_clipped";		// samples at full scale
+inline static const string VAL_TUNE_TO_AUDIO_MS		= "tune_to_audio_ms";	// last retune,  until it is heard
+inline static const string VAL_RADIO_QUALITY_TIER	= "radio_quality_tier";	// 0 is full,  see QualityGovernor
+
+// thread_<name>_cpu,  _wake_us,  _work_ms and _misses per thread,  see ThreadPolicy
+inline static const string VAL_THREAD_PREFIX			= "thread_";
+
+// dsp_<stage>_p50_us,  _p99_us and _rt (percent of real time) per stage,  see DSPTiming
+inline static const string VAL_DSP_PREFIX				= "dsp_";
+
 
 // json data
  
@@ -92,6 +114,11 @@ inline static const string  PROP_SYNC_CLOCK_TO_GPS			= "clocksync_gps_secs";
 inline static const string  PROP_W1_MAP						= "w1Map";
 inline static const string  PROP_SQUELCH_LEVEL				= "squelch";
 inline static const string  PROP_GAIN_LEVEL					= "gain";
+inline static const string  PROP_SDR_IQ_FILE					= "sdr_iq_file";		// play capture when no dongle
+inline static const string  PROP_SDR_IQ_REALTIME			= "sdr_iq_realtime";
+inline static const string  PROP_SDR_IQ_RECORD_PATH		= "sdr_iq_record_path";	// capture file prefix
+inline static const string  PROP_AUDIO_TARGET_MS			= "audio_target_ms";	// low latency audio,  0 = off
+inline static const string  PROP_THREAD_POLICY				= "thread_policy";		// per thread sched,  priority,  cpus
 
 
 inline static const string  SERIAL_NUM							= "serial_num";
@@ -0,0 +1,138 @@
+//
+//  QualityGovernor.cpp
+//  carradio
+//
+
+#include "QualityGovernor.hpp"
+
+#include <algorithm>
+
+// no drop count seen yet,  the first one only sets the baseline
+static constexpr uint64_t noDropCount = UINT64_MAX;
+
+QualityGovernor::QualityGovernor(){
+	_tiers = 1;
+	_lastDropped = noDropCount;
+	_stepsDown = 0;
+	_stepsUp = 0;
+	reset();
+}
+
+void QualityGovernor::reset(){
+	_tier = 0;
+	_busySecs = 0;
+	_signalSecs = 0;
+	_maxQueued = 0;
+	_dropped = false;
+	_lastLoad = 0;
+	_stepCost.assign(_tiers, defaultStepCost);
+	_loadBeforeStep = 0;
+	_overWindows = 0;
+	_headroomSecs = 0;
+	_upSecs = minUpSecs;
+	_sinceUpSecs = retrySecs;
+}
+
+void QualityGovernor::setTiers(unsigned int tiers){
+
+	tiers = std::max(1u, tiers);
+	if(tiers == _tiers)
+		return;
+
+	// another kind of decoder,  what the steps cost doesn't carry over
+	_tiers = tiers;
+	_stepCost.assign(_tiers, defaultStepCost);
+	_loadBeforeStep = 0;
+
+	if(_tier >= _tiers)
+		_tier = _tiers - 1;
+
+	_overWindows = 0;
+	_headroomSecs = 0;
+}
+
+bool QualityGovernor::update(double busySecs, double signalSecs,
+									  size_t queued, size_t capacity, uint64_t dropped){
+
+	unsigned int wasTier = _tier;
+
+	_busySecs += busySecs;
+	_signalSecs += signalSecs;
+	_maxQueued = std::max(_maxQueued, queued);
+
+	if(_lastDropped != noDropCount && dropped > _lastDropped)
+		_dropped = true;
+	_lastDropped = dropped;
+
+	if(_signalSecs >= windowSecs)
+		endWindow(capacity);
+
+	return _tier != wasTier;
+}
+
+void QualityGovernor::endWindow(size_t capacity){
+
+	double load = _busySecs / _signalSecs;
+	double secs = _signalSecs;
+
+	_lastLoad = load;
+	_sinceUpSecs += secs;
+
+	// first window since a step down,  the same clock as the one before it
+	if(_loadBeforeStep > 0 && load > 0)
+		_stepCost[_tier] = std::min(std::max(_loadBeforeStep / load, 1.0), 4.0);
+	_loadBeforeStep = 0;
+
+	// a block dropped while the chain was idle is a stall,  not the CPU
+	bool full = capacity > 0 && _maxQueued * 2 >= capacity;
+	bool dropped = _dropped && load > upLoad;
+
+	if(load > downLoad || full || dropped){
+		_headroomSecs = 0;
+		_overWindows++;
+
+		if((dropped || _overWindows >= downWindows) && _tier + 1 < _tiers){
+
+			// the last step up was one too many,  wait longer next time
+			if(_sinceUpSecs < retrySecs)
+				_upSecs = std::min(_upSecs * 2, maxUpSecs);
+			else
+				_upSecs = minUpSecs;
+
+			_loadBeforeStep = load;
+			_overWindows = 0;
+			_tier++;
+			_stepsDown++;
+		}
+	}
+	else {
+		_overWindows = 0;
+
+		bool headroom = _tier > 0
+			&& load * _stepCost[_tier] < upLoad
+			&& _maxQueued <= 1 && !_dropped;
+
+		_headroomSecs = headroom ? _headroomSecs + secs : 0;
+
+		if(headroom && _headroomSecs >= _upSecs){
+			_headroomSecs = 0;
+			_sinceUpSecs = 0;
+			_tier--;
+			_stepsUp++;
+		}
+	}
+
+	_busySecs = 0;
+	_signalSecs = 0;
+	_maxQueued = 0;
+	_dropped = false;
+}
+
+QualityGovernor::stats_t QualityGovernor::stats(){
+	stats_t s;
+	s.tier 		= _tier;
+	s.load 		= _lastLoad;
+	s.stepsDown = _stepsDown;
+	s.stepsUp 	= _stepsUp;
+	return s;
+}
@@ -0,0 +1,96 @@
+//
+//  QualityGovernor.hpp
+//  carradio
+//
+//  Steps the decoder down through its quality tiers (SDRDecoder::
+//  quality_tiers()) when the radio chain can't keep up,  and back up
+//  once there is headroom again.  A Pi that throttles when it runs hot
+//  then loses stereo for a while,  instead of dropping IQ blocks and
+//  stuttering.
+//
+//  SDRProcessor reports every block:  how long the busiest stage took
+//  against the signal time of the block,  and how deep the IQ queues
+//  are.  Blocks are judged in windows of half a second.  A window is
+//  overloaded above downLoad or with the queue half full,  two of those
+//  in a row step down a tier,  and a window that dropped blocks steps
+//  down right away.
+//
+//  Stepping up costs more than the load seen at the cheaper tier.  The
+//  window before and the window after each step down give what the
+//  tier above costs against this one,  measured at the same clock,  and
+//  the load scaled by that has to stay under upLoad with nothing queued
+//  for upSecs before a step up.
+//  A step up that is taken back within a minute doubles upSecs for the
+//  next try,  so a marginal CPU settles on a tier instead of see-sawing.
+//
+
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+using namespace std;
+
+class QualityGovernor {
+
+public:
+
+	typedef struct {
+		unsigned int	tier;
+		double			load;				// busy time against signal time,  last window
+		uint64_t			stepsDown;
+		uint64_t			stepsUp;
+	} stats_t;
+
+	QualityGovernor();
+
+	// tiers of the decoder in use,  the tier carries over and is clamped
+	void setTiers(unsigned int tiers);
+
+	// back to full quality,  forget the loads
+	void reset();
+
+	// one block.  True when tier() changed,  the decoder should follow.
+	bool update(double busySecs, double signalSecs,
+					size_t queued, size_t capacity, uint64_t dropped);
+
+	unsigned int tier() { return _tier; };
+	double load() { return _lastLoad; };
+
+	stats_t stats();
+
+private:
+
+	static constexpr double windowSecs 	= 0.5;
+	static constexpr double downLoad 	= 0.85;
+	static constexpr int 	downWindows = 2;
+	static constexpr double upLoad 		= 0.65;
+	static constexpr double minUpSecs 	= 5;
+	static constexpr double maxUpSecs 	= 80;
+	static constexpr double retrySecs 	= 60;		// a step down this soon after a step up
+	static constexpr double defaultStepCost = 2;	// until a step down was measured
+
+	unsigned int		_tiers;
+	unsigned int		_tier;
+
+	// the window being filled
+	double				_busySecs;
+	double				_signalSecs;
+	size_t				_maxQueued;
+	uint64_t				_lastDropped;
+	bool					_dropped;
+
+	double				_lastLoad;
+	vector<double>		_stepCost;			// load of tier - 1 against tier
+	double				_loadBeforeStep;	// 0 unless a step down is being measured
+	int					_overWindows;
+	double				_headroomSecs;
+	double				_upSecs;
+	double				_sinceUpSecs;		// since the last step up
+
+	uint64_t				_stepsDown;
+	uint64_t				_stepsUp;
+
+	void endWindow(size_t capacity);
+};
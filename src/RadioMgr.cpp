@@ -19,6 +19,9 @@
 #include "PropValKeys.hpp"
 #include "FmDecode.hpp"
 #include "VhfDecode.hpp"
+#include "MultiChannelDecode.hpp"
+#include "timespec_util.h"
+#include "ThreadPolicy.hpp"
 
 #define DEBUG_DEMOD 0
 typedef void * (*THREADFUNCPTR)(void *);
@@ -28,11 +31,40 @@ RadioMgr::RadioMgr(){
 	_mode = MODE_UNKNOWN;
 	_mux = MUX_MONO;
 	_sdrDecoder = NULL;
+	_sdr = &_rtlSdr;
 	_frequency = 0;
 	_isOn = false;
 	_isSetup = false;
 	_scannerChannels.clear();
 	_scannerMode	= false;
+	_scanCluster.clear();
+	_scanClusterTuner = 0;
+	_tunerFrequency = 0;
+	_scanFreshTune = false;
+	_scanHopQueued = false;
+	_scanHunting = false;
+	_scanHops = 0;
+	_scanHuntStart = {0, 0};
+	_scanParkStart = {0, 0};
+	_scanFalseChannels.clear();
+	_scanStatsStart = {0, 0};
+	_blockStatsStart = {0, 0};
+	
+	_targetFillMs = 0;
+	_fillMs = 0;
+	_driftPpm = 0;
+	_underruns = 0;
+	_outputFlushed = false;
+	
+	_tuneCount = 0;
+	_tuneStart = {0, 0};
+	_tuneTag = 0;
+	_tunePending = false;
+	_audioLevel = 0;
+	_outputRms = 0;
+	_outputPeak = 0;
+	_clippedSamples = 0;
+	_pipelineStats = _pipeline.stats();
 	
 	_channelEventQueue= {};
 	
@@ -43,23 +75,37 @@ RadioMgr::RadioMgr(){
 	
 	_squelchLevel = 0;
 	
+	ThreadPolicy* threads = ThreadPolicy::shared();
+	
 	pthread_create(&_auxReaderTID, NULL,
 						(THREADFUNCPTR) &RadioMgr::AuxReaderThread, (void*)this);
+	threads->registerThread("AuxReader", _auxReaderTID);
 	
 	pthread_create(&_airplayReaderTID, NULL,
 						(THREADFUNCPTR) &RadioMgr::AirplayReaderThread, (void*)this);
+	threads->registerThread("AirplayReader", _airplayReaderTID);
 
 	pthread_create(&_sdrReaderTID, NULL,
 						(THREADFUNCPTR) &RadioMgr::SDRReaderThread, (void*)this);
+	threads->registerThread("SDRReader", _sdrReaderTID);
 	
 	pthread_create(&_sdrProcessorTID, NULL,
 						(THREADFUNCPTR) &RadioMgr::SDRProcessorThread, (void*)this);
+	threads->registerThread("SDRProcessor", _sdrProcessorTID);
+	
+	// SDRProcessor is the IF stage,  ThreadPolicy gives each stage a core
+	if(_pipeline.begin([this](SampleVector& audio, const DecoderPipeline::blockInfo_t& info){
+										postAudio(audio, info); }, _audioPool)){
+		threads->registerThread("SDRDemod", _pipeline.demodThread());
+	}
 	
 	pthread_create(&_outputProcessorTID, NULL,
 						(THREADFUNCPTR) &RadioMgr::OutputProcessorThread, (void*)this);
+	threads->registerThread("OutputProcessor", _outputProcessorTID);
 	
 	pthread_create(&_channelManagerTID, NULL,
 						(THREADFUNCPTR) &RadioMgr::ChannelManagerThread, (void*)this);
+	threads->registerThread("ChannelManager", _channelManagerTID);
 }
  
 RadioMgr::~RadioMgr(){
@@ -73,6 +119,9 @@ RadioMgr::~RadioMgr(){
 	pthread_join(_sdrReaderTID, NULL);
 	pthread_join(_sdrProcessorTID, NULL);
 	pthread_join(_outputProcessorTID, NULL);
+	
+	_pipeline.stop();
+	clearDecoderCache();
 }
  
 
@@ -84,35 +133,264 @@ bool RadioMgr::begin(uint32_t deviceIndex, int  pcmrate){
 
 bool RadioMgr::begin(uint32_t deviceIndex, int  pcmrate,  int &error){
 	
-	_channelEventQueue= {};
+	_isSetup = false;
+	_sdr = &_rtlSdr;
 
+	if(! _rtlSdr.begin(deviceIndex,error ) )
+		return false;
+	
+	if(! _sdr->setBiasTee(true))
+		return false;
+ 
+	return setupSource(pcmrate, RtlSdr::default_sampleRate);
+}
+
+bool RadioMgr::beginIQFile(string path, bool realtime, int  pcmrate,  int &error){
+	
 	_isSetup = false;
+	_sdr = &_iqFile;
+	
+	if(! _iqFile.begin(path, realtime, error))
+		return false;
+	
+	// SigMF captures carry their own rate
+	uint32_t sampleRate = _iqFile.getSampleRate();
+	if(sampleRate == 0)
+		sampleRate = RtlSdr::default_sampleRate;
+	
+	return setupSource(pcmrate, sampleRate);
+}
+
+void RadioMgr::setLowLatency(uint32_t targetMs){
+	_targetFillMs = targetMs;
+	_fillMs = targetMs;
+}
+
+bool RadioMgr::setupSource(int  pcmrate, uint32_t sampleRate){
+	
+	_channelEventQueue= {};
+	
+	// the default 64k blocks are 65ms at 1M and 270ms at 240k,
+	// more than the whole low latency budget
+	if(_targetFillMs > 0)
+		_sdr->setBlockLength(lowLatencyBlockLength);
+
 	_pcmrate = pcmrate;
 	_shouldReadSDR = false;
 	_shouldReadAux = false;
 	_shouldReadAirplay = false;
-
-	if(! _sdr.begin(deviceIndex,error ) )
-		return false;
 	
-	if(! _sdr.setBiasTee(true))
-		return false;
- 
 	// tSet Sample rate
-	if(! _sdr.setSampleRate(RtlSdr::default_sampleRate))
+	if(! _sdr->setSampleRate(sampleRate))
 		return false;
 	
 	// start with auto gain
-	if(! _sdr.setTunerGain( INT_MIN ))
+	if(! _sdr->setTunerGain( INT_MIN ))
 		return false;
 	
 	_AGC_active = true;
+	
+	// the first tune of each mode doesn't have to build its tables
+	prebuildDecoders();
 	 
 	_isSetup = true;
  
 	return true;
 }
 
+// MARK: -  Decoder cache
+
+// Build the decoder for a mode.  The station always sits a quarter of the
+// sample rate below the LO,  see setFrequencyandModeInternal().
+SDRDecoder* RadioMgr::makeDecoder(radio_mode_t mode, uint32_t rate, double ifBandwidth){
+	
+	rate_plan_t plan = ratePlanForMode(mode);
+	double tuning_offset = -0.25 * rate;
+	
+	// Narrowband audio needs far less than the dongle rate,
+	// downsample as far as the plan allows.  A power of two,  so the
+	// decoder's IQ front end can take its share of it at any rate.
+	unsigned int downsample = 1;
+	while(downsample * 2 <= rate / plan.basebandRate)
+		downsample *= 2;
+	fprintf(stderr, "baseband downsampling factor %u\n", downsample);
+	
+	// Prevent aliasing at very low output sample rates.
+	double bandwidth_pcm = min(FmDecoder::default_bandwidth_pcm,
+										0.45 * _pcmrate);
+	
+	if(mode == BROADCAST_FM)
+		return new FmDecoder(rate,
+									tuning_offset,
+									_pcmrate,
+									true,  // stereo
+									FmDecoder::default_deemphasis,     // deemphasis,
+									ifBandwidth,   							// bandwidth_if
+									FmDecoder::default_freq_dev,       // freq_dev
+									bandwidth_pcm,
+									downsample,
+									plan.ifFilterOrder
+									);
+	
+	return new VhfDecoder(rate,
+								 tuning_offset,
+								 _pcmrate,
+								 VhfDecoder::default_deemphasis,     // deemphasis,
+								 ifBandwidth,  							 // bandwidth_if
+								 VhfDecoder::default_freq_dev,       // freq_dev
+								 bandwidth_pcm,
+								 downsample,
+								 _squelchLevel,  // squelch level
+								 plan.ifFilterOrder
+								 );
+}
+
+// Decoder for a mode at the current sample rate,  reset for a new station.
+SDRDecoder* RadioMgr::cachedDecoder(radio_mode_t mode, double ifBandwidth){
+	
+	uint32_t rate = _sdr->getSampleRate();
+	
+	// UHF is VHF with other limits
+	decoderKey_t key = {mode == UHF ? VHF : mode, rate, (uint32_t) ifBandwidth};
+	
+	SDRDecoder* decoder = NULL;
+	auto it = _decoderCache.find(key);
+	
+	if(it == _decoderCache.end()){
+		decoder = makeDecoder(mode, rate, ifBandwidth);
+		_decoderCache[key] = decoder;
+	}
+	else {
+		decoder = it->second;
+		decoder->reset();
+	}
+	
+	decoder->set_squelch_level(_squelchLevel);
+	return decoder;
+}
+
+bool RadioMgr::isCachedDecoder(SDRDecoder* decoder){
+	
+	for(auto &entry : _decoderCache)
+		if(entry.second == decoder)
+			return true;
+	
+	return false;
+}
+
+// Broadcast FM and both VHF channel widths at the rates the plans pick.
+void RadioMgr::prebuildDecoders(){
+	
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::lock_guard<DecoderPipeline> hold(_pipeline);
+	
+	clearDecoderCache();
+	
+	// new rates,  new costs
+	_governor.reset();
+	
+	for(radio_mode_t mode : {BROADCAST_FM, VHF}){
+		
+		// a recording plays at the rate it was captured at.
+		uint32_t rate = _sdr == &_rtlSdr
+							? ratePlanForMode(mode).sampleRate
+							: _sdr->getSampleRate();
+		
+		vector<double> widths = {FmDecoder::default_bandwidth_if};
+		if(mode == VHF)
+			widths = {12500, 25000};
+		
+		for(double width : widths){
+			decoderKey_t key = {mode, rate, (uint32_t) width};
+			_decoderCache[key] = makeDecoder(mode, rate, width);
+		}
+	}
+}
+
+void RadioMgr::clearDecoderCache(){
+	
+	if(_sdrDecoder && isCachedDecoder(_sdrDecoder))
+		_sdrDecoder = NULL;
+	
+	for(auto &entry : _decoderCache)
+		delete entry.second;
+	
+	_decoderCache.clear();
+}
+
+// Drop IQ captured before a retune,  the blocks go back to the source.
+void RadioMgr::flushStaleBlocks(){
+	
+	std::lock_guard<std::mutex> lock(_retuneMutex);
+	
+	_tuneCount++;
+	_sdr->resetBuffer();
+	_source_buffer.flush([this](IQSampleVector& block){
+		_sdr->releaseSamples(block);
+	});
+}
+
+// MARK: -  Sample rate plans
+
+// Everything downstream of the dongle,  USB transfers, IQ conversion and
+// the decoders,  scales with the sample rate.  Narrowband modes get by
+// with the lowest rate the RTL2832 does well (225k - 300k).
+//
+//  mode            dongle     IQ front end      baseband      IF filter
+//  VHF / UHF       240k       /2  ->  120k      /2 -> 60k     10 taps
+//  BROADCAST_FM    1M         /2  ->  500k      /2 -> 250k     5 taps
+//  SCANNER         2.4M       128 bins /32 -> 75k per channel
+//
+// SCANNER is only used for a cluster of channels decoded together,
+// single scanner channels are tuned in their own mode.
+
+RadioMgr::rate_plan_t RadioMgr::ratePlanForMode(radio_mode_t mode){
+	
+	switch(mode){
+		case VHF:
+		case UHF:
+			return { 240000, 60.0e3, 10 };
+			
+		case BROADCAST_FM:
+			return { 1000000, 250.0e3, 5 };
+			
+		case SCANNER:
+			return { 2400000, 75.0e3, 0 };
+			
+		default:
+			return { (uint32_t)RtlSdr::default_sampleRate, 250.0e3, 0 };
+	}
+}
+
+bool RadioMgr::applyRatePlan(const rate_plan_t &plan){
+	
+	// a recording plays at the rate it was captured at.
+	if(_sdr != &_rtlSdr)
+		return true;
+	
+	uint32_t rate = _sdr->getSampleRate();
+	if(rate > plan.sampleRate - plan.sampleRate / 1000
+		&& rate < plan.sampleRate + plan.sampleRate / 1000)
+		return true;
+	
+	// a capture only has one rate
+	if(_recorder.isRecording()){
+		fprintf(stderr, "RadioMgr: sample rate now %u, IQ recording stopped\n", plan.sampleRate);
+		stopIQRecording();
+	}
+	
+	// streaming carries on,  the reader thread just sees the new rate.
+	if(! _sdr->setSampleRate(plan.sampleRate))
+		return false;
+	
+	// anything still queued was sampled at the old rate
+	_sdr->resetBuffer();
+	_source_buffer.flush();
+	
+	fprintf(stderr, "SDR sample rate %u\n", plan.sampleRate);
+	return true;
+}
+
 void RadioMgr::stop(){
 	
 	if(_isSetup  ){
@@ -123,7 +401,8 @@ void RadioMgr::stop(){
 		
 		_lineInput.stop();
 		_airplayInput.stop();
-		_sdr.stop();
+		stopIQRecording();
+		_sdr->stop();
 	}
 	
 	_isSetup = false;
@@ -140,7 +419,31 @@ void RadioMgr::stop(){
 
 
 bool RadioMgr::getDeviceInfo(RtlSdr::device_info_t& info){
-	return _sdr.getDeviceInfo(info);
+	return _sdr->getDeviceInfo(info);
+}
+
+bool RadioMgr::startIQRecording(string path, bool sigmf){
+	
+	// only the dongle has anything worth recording
+	if(!_isSetup || _sdr != &_rtlSdr)
+		return false;
+	
+	int error = 0;
+	if(!_recorder.begin(path, _sdr->getSampleRate(), _sdr->getFrequency(),
+							  sigmf ? IQRecorder::FORMAT_SIGMF : IQRecorder::FORMAT_CU8, error))
+		return false;
+	
+	_rtlSdr.setRecorder(&_recorder);
+	return true;
+}
+
+void RadioMgr::stopIQRecording(){
+	
+	if(!_recorder.isRecording())
+		return;
+	
+	_rtlSdr.setRecorder(NULL);
+	_recorder.stop();
 }
 
 bool RadioMgr::setON(bool isOn) {
@@ -160,19 +463,20 @@ bool RadioMgr::setON(bool isOn) {
 	
 	if(!isOn){
 		std::lock_guard<std::mutex> lock(_mutex);
+		std::lock_guard<DecoderPipeline> hold(_pipeline);
 		
 		_shouldReadSDR = false;
 		_shouldReadAux = false;
 		_shouldReadAirplay = false;
 
-		_sdr.resetBuffer();
-		_output_buffer.flush();
+		_sdr->resetBuffer();
+		flushOutput();
 		
-		// delete decoders
-		if(_sdrDecoder) {
+		// delete decoders,  cached ones are kept for turning back on
+		if(_sdrDecoder && !isCachedDecoder(_sdrDecoder))
 			delete _sdrDecoder;
-			_sdrDecoder = NULL;
-		}
+		_sdrDecoder = NULL;
+		
 		display->showTime();
 	}
 	else {
@@ -287,6 +591,12 @@ bool RadioMgr::setFrequencyandModeInternal( radio_mode_t newMode, uint32_t newFr
 	else if(force ||  (newFreq != _frequency) || newMode != _mode){
 	
 		std::lock_guard<std::mutex> lock(_mutex);
+		
+		// demod idle,  its blocks from the old station dropped
+		std::lock_guard<DecoderPipeline> hold(_pipeline);
+		
+		struct timespec tuneStart;
+		clock_gettime(CLOCK_MONOTONIC, &tuneStart);
 			
 //		printf("setFrequencyandModeInternal(%s %u) %d \n", modeString(newMode).c_str(), newFreq, force);
 
@@ -296,116 +606,163 @@ bool RadioMgr::setFrequencyandModeInternal( radio_mode_t newMode, uint32_t newFr
 		_frequency = newFreq;
 		_mode = newMode;
 		_mux =  MUX_MONO;
+		
+		// a scanner hop has landed,  its first block gets a snapshot
+		_scanHopQueued = false;
+		_scanFreshTune = true;
+		_scanParkStart = {0, 0};
 	 
-		// create proper decoder
-		if(_sdrDecoder) {
+		// cached decoders wait for the next tune,  scanner clusters don't
+		if(_sdrDecoder && !isCachedDecoder(_sdrDecoder))
 			delete _sdrDecoder;
-			_sdrDecoder = NULL;
-		}
+		_sdrDecoder = NULL;
+		
+		// an SDR mode that fails to set the dongle up leaves the radio
+		// quiet,  SDRProcessor must not go on with no decoder
+		auto failed = [&](){
+			_shouldReadSDR = false;
+			if(!wasMuted)
+				audio->setMute(false);
+			return false;
+		};
 		
 		if(_mode == AUX) {
-			_sdr.resetBuffer();
-			_output_buffer.flush();
+			_sdr->resetBuffer();
+			flushOutput();
 			_shouldReadSDR = false;
 			_shouldReadAux = true;
 			_shouldReadAirplay = false;
 			didUpdate = true;
 		}
 		else if(_mode == AIRPLAY) {
-			_sdr.resetBuffer();
-			_output_buffer.flush();
+			_sdr->resetBuffer();
+			flushOutput();
 			_shouldReadSDR = false;
 			_shouldReadAux = false;
 			_shouldReadAirplay = true;
 		}
 		else if(_mode == VHF || _mode == UHF) {
 	
-			_sdr.resetBuffer();
-			_output_buffer.flush();
+			_sdr->resetBuffer();
+			flushOutput();
+			
+			rate_plan_t plan = ratePlanForMode(_mode);
+			if(! applyRatePlan(plan))
+				return failed();
 			
 			// Intentionally tune at a higher frequency to avoid DC offset.
-			double tuner_freq = newFreq + 0.25 * _sdr.getSampleRate();
+			double tuner_freq = newFreq + 0.25 * _sdr->getSampleRate();
 			
-			if(! _sdr.setOffsetTuning(false))
-				return false;
+			if(! _sdr->setOffsetTuning(false))
+				return failed();
 	
-			if(! _sdr.setACGMode(false))
-				return false;
+			if(! _sdr->setACGMode(false))
+				return failed();
  
-			if(! _sdr.setFrequency(tuner_freq))
-				return false;
+			if(! _sdr->setFrequency(tuner_freq))
+				return failed();
 			
-			// changing FM frequencies means recreating the decoder
+			_tunerFrequency = tuner_freq;
 			
-			// The baseband signal is empty above 100 kHz, so we can
-			// downsample to ~ 200 kS/s without loss of information.
-			// This will speed up later processing stages.
-			unsigned int downsample = max(1, int(RtlSdr::default_sampleRate / 215.0e3));
-			fprintf(stderr, "baseband downsampling factor %u\n", downsample);
-			
-			// Prevent aliasing at very low output sample rates.
-			double bandwidth_pcm = min(FmDecoder::default_bandwidth_pcm,
-												0.45 * _pcmrate);
+			// blocks still queued from the last channel would pass for this one
+			flushStaleBlocks();
 			
+			// the offset from the LO is always the same,  so the decoder
+			// for this channel width only needs its state reset
 			double ifBandwdth = VhfDecoder::isNarrowBand(newFreq)
 								? 12500
 								: 25000;
 			
-			_sdrDecoder = new VhfDecoder(RtlSdr::default_sampleRate,
-												newFreq - tuner_freq,
-												_pcmrate,
-												  VhfDecoder::default_deemphasis,     // deemphasis,
-												  ifBandwdth,  							 // bandwidth_if
-												  VhfDecoder::default_freq_dev,       // freq_dev
-												bandwidth_pcm,
-												downsample,
-												_squelchLevel  // squelch level
-												);
+			_sdrDecoder = cachedDecoder(_mode, ifBandwdth);
 			
 			_shouldReadAux = false;
 			_shouldReadAirplay = false;
 
 			_shouldReadSDR = true;
 		}
-		else if(_mode == BROADCAST_FM) {
+		else if(_mode == SCANNER) {
 			
-			_sdr.resetBuffer();
-			_output_buffer.flush();
+			// a cluster of scanner channels,  newFreq is the LO
+			_sdr->resetBuffer();
+			flushOutput();
 			
-			if(! _sdr.setOffsetTuning(false))
-				return false;
-	 
-			if(! _sdr.setACGMode(false))
-						return false;
+			rate_plan_t plan = ratePlanForMode(_mode);
+			if(! applyRatePlan(plan))
+				return failed();
+			
+			if(! _sdr->setOffsetTuning(false))
+				return failed();
 	
-			// Intentionally tune at a higher frequency to avoid DC offset.
-			double tuner_freq = newFreq + 0.25 * _sdr.getSampleRate();
+			if(! _sdr->setACGMode(false))
+				return failed();
+ 
+			if(! _sdr->setFrequency(newFreq))
+				return failed();
 			
-			if(! _sdr.setFrequency(tuner_freq))
-				return false;
+			_tunerFrequency = newFreq;
 			
-			// changing FM frequencies means recreating the decoder
+			flushStaleBlocks();
 			
-			// The baseband signal is empty above 100 kHz, so we can
-			// downsample to ~ 200 kS/s without loss of information.
-			// This will speed up later processing stages.
-			unsigned int downsample = max(1, int(RtlSdr::default_sampleRate / 215.0e3));
-			fprintf(stderr, "baseband downsampling factor %u\n", downsample);
+			// earlier in the scan list is heard first
+			vector<MultiChannelDecoder::channel_t> channels;
+			for(auto offset : _scanCluster){
+				uint32_t freq = _scannerChannels[offset].second;
+				
+				MultiChannelDecoder::channel_t ch;
+				ch.tuning_offset = double(freq) - double(newFreq);
+				ch.bandwidth_if = VhfDecoder::isNarrowBand(freq) ? 12500 : 25000;
+				ch.priority = int(_scannerChannels.size() - offset);
+				channels.push_back(ch);
+			}
 			
 			// Prevent aliasing at very low output sample rates.
 			double bandwidth_pcm = min(FmDecoder::default_bandwidth_pcm,
 												0.45 * _pcmrate);
 			
-			_sdrDecoder = new FmDecoder(RtlSdr::default_sampleRate,
-												newFreq - tuner_freq,
-												_pcmrate,
-												true,  // stereo
-												FmDecoder::default_deemphasis,     // deemphasis,
-												FmDecoder::default_bandwidth_if,   // bandwidth_if
-												FmDecoder::default_freq_dev,       // freq_dev
-												bandwidth_pcm,
-												downsample
-												);
+			_sdrDecoder = new MultiChannelDecoder(_sdr->getSampleRate(),
+															  channels,
+															  _pcmrate,
+															  VhfDecoder::default_deemphasis,
+															  VhfDecoder::default_freq_dev,
+															  bandwidth_pcm,
+															  _squelchLevel,
+															  plan.ifFilterOrder);
+			
+			fprintf(stderr, "scanning %zu channels at once around %.4f MHz\n",
+					  channels.size(), newFreq * 1.0e-6);
+
+			_shouldReadAux = false;
+			_shouldReadAirplay = false;
+
+			_shouldReadSDR = true;
+		}
+		else if(_mode == BROADCAST_FM) {
+			
+			_sdr->resetBuffer();
+			flushOutput();
+			
+			rate_plan_t plan = ratePlanForMode(_mode);
+			if(! applyRatePlan(plan))
+				return failed();
+			
+			if(! _sdr->setOffsetTuning(false))
+				return failed();
+	 
+			if(! _sdr->setACGMode(false))
+						return failed();
+	
+			// Intentionally tune at a higher frequency to avoid DC offset.
+			double tuner_freq = newFreq + 0.25 * _sdr->getSampleRate();
+			
+			if(! _sdr->setFrequency(tuner_freq))
+				return failed();
+			
+			_tunerFrequency = tuner_freq;
+			
+			flushStaleBlocks();
+			
+			// same offset from the LO on every station,  reuse the decoder
+			_sdrDecoder = cachedDecoder(_mode, FmDecoder::default_bandwidth_if);
 			
 			_shouldReadAux = false;
 			_shouldReadAirplay = false;
@@ -414,6 +771,16 @@ bool RadioMgr::setFrequencyandModeInternal( radio_mode_t newMode, uint32_t newFr
 		}
 		
 		
+		_audioPool.setBlockLength(audioBlockLength());
+		
+		// clock runs until the first block of the new station is played
+		if(_shouldReadSDR){
+			uint32_t tag = _tuneTag + 1;
+			_tuneTag = tag ? tag : 1;
+			_tuneStart = tuneStart;
+			_tunePending = true;
+		}
+		
 		if(!wasMuted)
 			audio->setMute(false);
 		
@@ -467,7 +834,7 @@ std::vector<int> RadioMgr::getTunerGains(){
 	std::vector<int> gains = {};
 	
 	if(_isSetup)
-		gains = _sdr.getTunerGains();
+		gains = _sdr->getTunerGains();
  
 	return gains;
 }
@@ -476,7 +843,7 @@ bool RadioMgr::setTunerGain(int val){
 	if(_isSetup)
 	{
 		_AGC_active = val == 0;
-		return _sdr.setTunerGain(val );
+		return _sdr->setTunerGain(val );
  	}
 	else
 		return false;
@@ -485,7 +852,7 @@ bool RadioMgr::setTunerGain(int val){
 int RadioMgr::getTunerGain(){
 	if(_isSetup){
 		if(_AGC_active) return 0;
-		else  return _sdr.getTunerGain();
+		else  return _sdr->getTunerGain();
  	}
 	else
 		return INT_MIN;
@@ -710,9 +1077,18 @@ bool RadioMgr::scanChannels( vector < RadioMgr::channel_t >  channels ){
 	
 	_scannerChannels = channels;
 	_scannerMode = channels.size() > 0;
+	
+	{
+		// offsets mean other channels now
+		std::lock_guard<std::mutex> lock(_mutex);
+		_scanFalseChannels.clear();
+	}
+	planScanCluster();
 		
 	if(_scannerMode){
 		_currentScanOffset = 0;
+		_scanHops = 0;
+		clock_gettime(CLOCK_MONOTONIC, &_scanStatsStart);
 		pauseScan(false);
 	}
 	
@@ -738,8 +1114,9 @@ void RadioMgr::pauseScan(bool shouldPause){
 	DisplayMgr*		display 	= PiCarMgr::shared()->display();
 
 	if(!_scanningPaused){
-		channel_t channel = _scannerChannels[_currentScanOffset];
-		queueSetFrequencyandMode(channel.first, channel.second, true);
+		_scanHunting = false;
+		scanHunting();
+		hopScanner(_currentScanOffset);
 	}
 	else {
 		display->LEDeventScannerStop();
@@ -803,18 +1180,270 @@ bool RadioMgr::tuneNextScannerChannel(){
 	if(!_scannerMode )
 		return false;
  
-	uint  nextOffset =  (_currentScanOffset + 1) % _scannerChannels.size();
+	uint count = _scannerChannels.size();
 	
-	channel_t channel = _scannerChannels[nextOffset];
-	_currentScanOffset = nextOffset;
+	for(uint i = 1; i <= count; i++){
+		uint  nextOffset =  (_currentScanOffset + i) % count;
+		
+		// the cluster is a single stop,  and we may be on it already
+		if(isInScanCluster(nextOffset) && _mode == SCANNER)
+			continue;
+		
+		hopScanner(nextOffset);
+		return true;
+	}
 	
-	RadioMgr::radio_mode_t   mode = channel.first;;
-	uint32_t  					  freq = channel.second;
+	// every channel is in the cluster,  nothing to step to.
+	return true;
+};
+
+
+// Find the largest group of VHF/UHF scanner channels that fit in one
+// capture.  Those are decoded together by a MultiChannelDecoder and
+// the scan steps over them as one stop.
+void RadioMgr::planScanCluster(){
 	
-	queueSetFrequencyandMode(mode, freq, true);
+	_scanCluster.clear();
+	_scanClusterTuner = 0;
+	
+	if(!_sdr)
+		return;
+	
+	// a recording has the rate it was captured at.
+	double rate = (_sdr == &_rtlSdr)
+						? ratePlanForMode(SCANNER).sampleRate
+						: _sdr->getSampleRate();
+	
+	// keep the channels off the DC spike in the middle
+	double dcGuard = rate / MultiChannelDecoder::channelizer_bins;
+	double halfSpan = 0.5 * MultiChannelDecoder::usable_span(rate);
+	
+	vector<uint> offsets;
+	for(uint i = 0; i < _scannerChannels.size(); i++){
+		radio_mode_t mode = _scannerChannels[i].first;
+		if(mode == VHF || mode == UHF)
+			offsets.push_back(i);
+	}
+	
+	sort(offsets.begin(), offsets.end(), [this](uint a, uint b){
+		return _scannerChannels[a].second < _scannerChannels[b].second;
+	});
+	
+	// widest window over the sorted frequencies,  leaving room to move
+	// the LO off a channel
+	uint bestFirst = 0, bestCount = 0;
+	for(uint first = 0, last = 0; first < offsets.size(); first++){
+		if(last < first)
+			last = first;
+		
+		double lo = _scannerChannels[offsets[first]].second;
+		while(last + 1 < offsets.size()
+				&& _scannerChannels[offsets[last + 1]].second - lo <= 2 * (halfSpan - dcGuard))
+			last++;
+		
+		if(last - first + 1 > bestCount){
+			bestFirst = first;
+			bestCount = last - first + 1;
+		}
+	}
+	
+	vector<uint> cluster(offsets.begin() + bestFirst, offsets.begin() + bestFirst + bestCount);
+	if(cluster.size() < 2)
+		return;
+	
+	double lo = _scannerChannels[cluster.front()].second;
+	double hi = _scannerChannels[cluster.back()].second;
+	
+	// Centre the LO,  then nudge it by up to a bin for the spot that
+	// puts the fewest channels on DC.
+	double tuner = 0.5 * (lo + hi);
+	uint fewest = UINT_MAX;
+	
+	for(int step = 0; step <= 8 && fewest > 0; step++){
+		double shift = ((step & 1) ? 1 : -1) * ((step + 1) / 2) * dcGuard / 4;
+		double candidate = 0.5 * (lo + hi) + shift;
+		
+		uint onDC = 0;
+		for(auto offset : cluster){
+			if(fabs(_scannerChannels[offset].second - candidate) < dcGuard)
+				onDC++;
+		}
+		
+		if(onDC < fewest){
+			fewest = onDC;
+			tuner = candidate;
+		}
+	}
+	
+	// channels stuck on DC are scanned on their own
+	cluster.erase(remove_if(cluster.begin(), cluster.end(), [&](uint offset){
+		return fabs(_scannerChannels[offset].second - tuner) < dcGuard;
+	}), cluster.end());
+	
+	// one channel is better served by tuning it in its own mode
+	if(cluster.size() < 2)
+		return;
+	
+	sort(cluster.begin(), cluster.end());
+	_scanCluster = cluster;
+	_scanClusterTuner = lrint(tuner);
+}
+
+bool RadioMgr::isInScanCluster(uint offset){
+	return find(_scanCluster.begin(), _scanCluster.end(), offset) != _scanCluster.end();
+}
+
+void RadioMgr::hopScanner(uint offset){
+	
+	_currentScanOffset = offset;
+	_scanHopQueued = true;
+	_scanHops++;
+	
+	if(isInScanCluster(offset)){
+		queueSetFrequencyandMode(SCANNER, _scanClusterTuner, true);
+	}
+	else {
+		channel_t channel = _scannerChannels[offset];
+		queueSetFrequencyandMode(channel.first, channel.second, true);
+	}
+}
+
+
+// Look at every scanner channel inside the snapshot of the capture.
+// Stay if the channel we are on has a signal,  else go straight to one
+// that does,  else on to the first channel the snapshot did not cover.
+// Returns true if a hop was queued.
+
+bool RadioMgr::scanForActiveChannel(const vector<float>& power){
+	
+	double rate = _sdr->getSampleRate();
+	double halfSpan = 0.5 * MultiChannelDecoder::usable_span(rate);
+	uint count = _scannerChannels.size();
+	
+	vector<bool> covered(count, false);
+	
+	// starting with the channel we are on
+	for(uint i = 0; i < count; i++){
+		uint offset = (_currentScanOffset + i) % count;
+		
+		radio_mode_t mode = _scannerChannels[offset].first;
+		uint32_t 	 freq = _scannerChannels[offset].second;
+		
+		if(mode != VHF && mode != UHF)
+			continue;
+		
+		// same noise bandwidth the decoder squelches on
+		double ifBandwdth = VhfDecoder::isNarrowBand(freq) ? 12500 : 25000;
+		double offsetHz = double(freq) - double(_tunerFrequency);
+		
+		// past the band edges,  or sitting on the DC spike
+		if(fabs(offsetHz) > halfSpan || fabs(offsetHz) < ifBandwdth)
+			continue;
+		
+		covered[offset] = true;
+		
+		if(isFalseScanChannel(offset))
+			continue;
+		
+		double bandPower = PowerSpectrum::band_power(power, offsetHz / rate, ifBandwdth / rate);
+		int level = int(10 * log10(max(bandPower, 1.0e-20)));
+		
+		if(level > _squelchLevel){
+			if(i == 0){
+				scanHeard();
+				return false;
+			}
+			
+			hopScanner(offset);
+			return true;
+		}
+	}
+	
+	scanHunting();
+	
+	for(uint i = 1; i < count; i++){
+		uint offset = (_currentScanOffset + i) % count;
+		if(!covered[offset]){
+			hopScanner(offset);
+			return true;
+		}
+	}
+	
+	// the snapshot covered the whole list,  nowhere else to look
+	return false;
+}
+
+// The snapshot kept us on this channel but the squelch hasn't opened.
+// True once that has gone on for scanFalseDwellMs,  the channel is then
+// left out of the snapshot for scanFalseHoldMs.
+bool RadioMgr::scanParkedTooLong(){
+	
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	if(_scanParkStart.tv_sec == 0 && _scanParkStart.tv_nsec == 0){
+		_scanParkStart = now;
+		return false;
+	}
+	
+	if(timespec_to_ms(timespec_sub(now, _scanParkStart)) < scanFalseDwellMs)
+		return false;
+	
+	_scanFalseChannels[_currentScanOffset] = timespec_add(now, timespec_from_ms(scanFalseHoldMs));
+	_scanParkStart = {0, 0};
 	return true;
+}
+
+bool RadioMgr::isFalseScanChannel(uint offset){
 	
-};
+	auto it = _scanFalseChannels.find(offset);
+	if(it == _scanFalseChannels.end())
+		return false;
+	
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	if(timespec_to_ms(timespec_sub(it->second, now)) > 0)
+		return true;
+	
+	_scanFalseChannels.erase(it);
+	return false;
+}
+
+// Time to first audio runs from when the scan starts looking to the
+// first block with a signal on the channel it is on.
+
+void RadioMgr::scanHunting(){
+	if(!_scanHunting){
+		_scanHunting = true;
+		clock_gettime(CLOCK_MONOTONIC, &_scanHuntStart);
+	}
+}
+
+void RadioMgr::scanHeard(){
+	if(_scanHunting){
+		_scanHunting = false;
+		
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long ms = timespec_to_ms(timespec_sub(now, _scanHuntStart));
+		
+		PiCarMgr::shared()->db()->updateValue(VAL_SCANNER_TIME_TO_AUDIO, int(ms));
+	}
+}
+
+void RadioMgr::updateScanStats(){
+	
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long ms = timespec_to_ms(timespec_sub(now, _scanStatsStart));
+	
+	if(ms >= 1000){
+		PiCarMgr::shared()->db()->updateValue(VAL_SCANNER_HOP_RATE, _scanHops * 1000.0 / ms);
+		_scanHops = 0;
+		_scanStatsStart = now;
+	}
+}
 
 bool RadioMgr::scannerLocked(){
 	return _scannerMode;
@@ -844,16 +1473,28 @@ void RadioMgr::AuxReader(){
 		}
 	
 		if(!aux_setup){
-			_lineInput.begin(_pcmrate, true) ;
+			// no capture device,  try again in a while
+			if(!_lineInput.begin(_pcmrate, true)){
+				usleep(200000);
+				continue;
+			}
 			aux_setup = true;
 		}
 
 		if(_lineInput.isConnected()){
 			
 			// get input
+			_audioPool.get(samples);
 			if( _lineInput.getSamples(samples)){
 				_output_buffer.push(move(samples));
 			}
+			else{
+				// snd_pcm_wait() failed rather than timed out
+				usleep(10000);
+			}
+		}
+		else{
+			usleep(200000);
 		}
 	}
 		
@@ -893,6 +1534,7 @@ void RadioMgr::AirplayReader(){
 	PRINT_CLASS_TID;
 
 	static bool airplay_setup = false;
+	bool airplay_shown = false;		// display told about this try
 	 
 	SampleVector samples;
 	while(!_shouldQuit){
@@ -904,6 +1546,7 @@ void RadioMgr::AirplayReader(){
 				_airplayInput.stop();
 				airplay_setup = false;
 			}
+			airplay_shown = false;
 				usleep(200000);
 				continue;
 		}
@@ -911,18 +1554,22 @@ void RadioMgr::AirplayReader(){
 		if(!airplay_setup){
 			airplay_setup = _airplayInput.begin();
 
-			DisplayMgr*		display 	= PiCarMgr::shared()->display();
-			display->showAirplayChange();
- 
-			if(airplay_setup){
-				usleep(200000);
-				continue;
+			// once per switch to AirPlay,  not on every retry of the pipe
+			if(airplay_setup || !airplay_shown){
+				DisplayMgr*		display 	= PiCarMgr::shared()->display();
+				display->showAirplayChange();
+				airplay_shown = true;
 			}
+ 
+			// set up or not,  give the pipe a while
+			usleep(200000);
+			continue;
 		}
 		
  		if(_airplayInput.isConnected()){
 
 			// get input
+			_audioPool.get(samples);
 			if( _airplayInput.getSamples(samples)){
 				_output_buffer.push(move(samples));
 			}
@@ -930,6 +1577,9 @@ void RadioMgr::AirplayReader(){
 				usleep(200000);
 			}
 		}
+		else{
+			usleep(200000);
+		}
 	}
  }
 
@@ -969,20 +1619,41 @@ void RadioMgr::SDRReader(){
 	while(!_shouldQuit){
 			// radio is off sleep for awhile.
 			if(!_isSetup || !_shouldReadSDR){
+				if(_sdr->isStreaming())
+					_sdr->stopStreaming();
 				usleep(200000);
 				continue;
 			}
+		
+		// blocks arrive from the SDR source and go back to it from SDRProcessor
+		if(!_sdr->isStreaming() && !_sdr->startStreaming()){
+			usleep(200000);
+			continue;
+		}
 	 
-		if (!_sdr.getSamples(iqsamples)) {
+		uint32_t tune = _tuneCount;
+		
+		if (!_sdr->getSamples(iqsamples)) {
 			//			 fprintf(stderr, "ERROR: getSamples\n");
 			continue;
 		}
 		
 		//		printf("read: %ld\n", iqsamples.size());
 		
-		_source_buffer.push(move(iqsamples));
+		{
+			std::lock_guard<std::mutex> lock(_retuneMutex);
+			
+			// retuned while we waited,  the block may be from the old channel
+			if(tune != _tuneCount){
+				_sdr->releaseSamples(iqsamples);
+				continue;
+			}
+			
+			_source_buffer.push(move(iqsamples));
+		}
 	}
 	
+	_sdr->stopStreaming();
 	_source_buffer.push_end();
 }
 
@@ -1012,22 +1683,14 @@ void RadioMgr::SDRReaderThreadCleanup(void *context){
 // MARK: -  SDRProcessor  thread
 
  
-/** Simple linear gain adjustment. */
-void adjust_gain(SampleVector& samples, double gain)
-{
-	 for (size_t i = 0, n = samples.size(); i < n; i++) {
-		  samples[i] *= gain;
-	 }
-}
-
 void RadioMgr::SDRProcessor(){
 	
 	PRINT_CLASS_TID;
 	
 	bool inbuf_length_warning = false;
 	SampleVector audiosamples;
-	double audio_level = 0;
-	bool got_stereo = false;
+	PowerSpectrum	scanSpectrum(scanSnapshotBins);
+	vector<float>	scanPower;
 	
 	for (unsigned int block = 0; !_shouldQuit;  block++) {
 			
@@ -1037,50 +1700,82 @@ void RadioMgr::SDRProcessor(){
 		}
 		
 		// Check for overflow of source buffer.
-		if (!inbuf_length_warning &&
-			 _source_buffer.queued_samples() > 10 * RtlSdr::default_sampleRate) {
+		if (!inbuf_length_warning && _source_buffer.dropped_blocks() > 0) {
 			fprintf(stderr,
-					  "\nWARNING: Input buffer is growing (system too slow)\n");
+					  "\nWARNING: Input buffer overflow, dropping IQ blocks (system too slow)\n");
 			inbuf_length_warning = true;
 		}
 		
 		// Pull next block from source buffer.
 		IQSampleVector iqsamples = _source_buffer.pull();
+		uint32_t tune = _tuneCount;
 		if (iqsamples.empty())
 			continue;
 		
-		if(_mode == VHF ||  _mode == UHF || _mode == BROADCAST_FM){
+		// the block has to be done before the next one is captured
+		double blockSecs = iqsamples.size() / (double) _sdr->getSampleRate();
+		ThreadPolicy::workStart(blockSecs);
+		
+		struct timespec blockStart;
+		clock_gettime(CLOCK_MONOTONIC, &blockStart);
+		
+		if(_mode == VHF ||  _mode == UHF || _mode == BROADCAST_FM || _mode == SCANNER){
 			
 			/// this block is critical.  dont change frequencies in the middle of a process.
 			std::lock_guard<std::mutex> lock(_mutex);
 			
-			if(!_shouldReadSDR)
+			// retuned while the block waited for the lock,  or the retune failed
+			if(!_shouldReadSDR || tune != _tuneCount || !_sdrDecoder){
+				_sdr->releaseSamples(iqsamples);
 				continue;
+			}
+
+			// band scope,  only copies when the display wants a row
+			_spectrum.feed(iqsamples, _sdr->getSampleRate(), _tunerFrequency);
+
+			// Scanner just hopped,  or the channel went quiet.  One look at
+			// the whole capture instead of a few blocks of squelch per hop.
+			if(_scannerMode && !_scanningPaused && !_scanHopQueued
+				&& (_mode == VHF || _mode == UHF) && _squelchLevel != 0
+				&& (_scanFreshTune || _sdrDecoder->isSquelched())){
+				
+				_scanFreshTune = false;
+				scanSpectrum.process(iqsamples, scanPower);
+				
+				if(scanForActiveChannel(scanPower)){
+					_sdr->releaseSamples(iqsamples);
+					PiCarMgr::shared()->display()->LEDeventScannerStep();
+					updateScanStats();
+					continue;
+				}
+			}
 			
-				// Decode FM signal.
-			_sdrDecoder->process(iqsamples, audiosamples);
+			// a new decoder,  or the governor moved
+			applyQualityTier();
 			
-			// Measure audio level.
-			double audio_mean, audio_rms;
-			samples_mean_rms(audiosamples, audio_mean, audio_rms);
-			audio_level = 0.95 * audio_level + 0.05 * audio_rms;
+			// Throw away first block. It is noisy because IF filters
+			// are still starting up.
+			bool settling = block == 0;
 			
-			// Set nominal audio volume.
-			adjust_gain(audiosamples, 0.5);
+			// Decode FM signal.
+			bool pipelined = _pipeline.isRunning() && _sdrDecoder->can_split();
+			DecoderPipeline::blockInfo_t info = {};
 			
-			if(_mode == BROADCAST_FM) {
-				// Stereo indicator change
-				bool detect = dynamic_cast<FmDecoder *>(_sdrDecoder)->stereo_detected();
-				_mux = detect? MUX_STEREO:MUX_MONO;
+			if(pipelined){
+				// IF chain here,  the demod and postAudio() follow on their own core
+				_pipeline.process(_sdrDecoder, iqsamples, settling);
+			}
+			else {
+				_audioPool.get(audiosamples);
+				_sdrDecoder->process(iqsamples, audiosamples);
 				
-				if (detect != got_stereo) {
-					got_stereo = detect;
-					//				display->showRadioChange();
-				}
+				info.ifLevel = _sdrDecoder->get_if_level();
+				info.basebandLevel = _sdrDecoder->get_baseband_level();
+				info.stereo = _sdrDecoder->stereo_detected();
 			}
 			
-			_IF_Level = 20*log10(_sdrDecoder->get_if_level());
-			_baseband_level =  20*log10(_sdrDecoder->get_baseband_level()) + 3.01;
+			// give the block back to the SDR source
+			_sdr->releaseSamples(iqsamples);
 //
 //			if(_scannerMode){
 //				// time to change channels.
@@ -1099,17 +1794,40 @@ void RadioMgr::SDRProcessor(){
 				
 				wasScanning = true;
 				
+				if(_mode == SCANNER) {
+					// show the cluster channel being heard
+					int active = dynamic_cast<MultiChannelDecoder *>(_sdrDecoder)->active_channel();
+					if(active >= 0 && (size_t) active < _scanCluster.size()
+						&& _scanCluster[active] != _currentScanOffset){
+						_currentScanOffset = _scanCluster[active];
+						display->showScannerChange(false);
+					}
+					
+					if(active >= 0)
+						scanHeard();
+				}
+				
+				updateScanStats();
+				
 				bool isSQLD = isSquelched();
 				
+				// single VHF/UHF channels are stepped by the snapshot above
+				bool snapshotScan = (_mode == VHF || _mode == UHF) && _squelchLevel != 0;
+				
 				if(isSQLD){
 					if(!_scanningPaused) {
-						tuneNextScannerChannel();
+						if(!_scanHopQueued && (!snapshotScan || scanParkedTooLong())){
+							scanHunting();
+							tuneNextScannerChannel();
+						}
 						sqlCount = 0;
 						display->LEDeventScannerStep();
 					}
 				}
-				else
+				else {
+					_scanParkStart = {0, 0};
 					sqlCount++;
+				}
 				
 				if(sqlCount == 3){
 					display->LEDeventScannerHold();
@@ -1123,14 +1841,8 @@ void RadioMgr::SDRProcessor(){
 				sqlCount = 0;
 			}
 
-			// Throw away first block. It is noisy because IF filters
-			// are still starting up.
-			if (block > 0) {
-				
-				// Write samples to output.
-				// Buffered write.
-				_output_buffer.push(move(audiosamples));
-			}
+			if (!settling && !pipelined)
+				postAudio(audiosamples, info);
  
 			
 #if DEBUG_DEMOD
@@ -1142,7 +1854,7 @@ void RadioMgr::SDRProcessor(){
 					 //					  (tuner_freq + _sdrDecoder->get_tuning_offset()) * 1.0e-6,
 					 20*log10(_sdrDecoder->get_if_level()),
 					 20*log10(_sdrDecoder->get_baseband_level()) + 3.01,
-					 20*log10(audio_level) + 3.01);
+					 20*log10(_audioLevel) + 3.01);
 			
 			
 			//			// Show stereo status.
@@ -1158,9 +1870,15 @@ void RadioMgr::SDRProcessor(){
 			
 #endif
 			
+			struct timespec blockEnd;
+			clock_gettime(CLOCK_MONOTONIC, &blockEnd);
+			struct timespec busy = timespec_sub(blockEnd, blockStart);
+			governQuality(busy.tv_sec + busy.tv_nsec * 1.0e-9, blockSecs);
 			
+			ThreadPolicy::workDone();
 		}
 		else {
+			_sdr->releaseSamples(iqsamples);
 			usleep(200000);
 			continue;
 		}
@@ -1171,6 +1889,74 @@ void RadioMgr::SDRProcessor(){
  
 
 
+// The decoder follows the governor.  Called with _mutex held.
+void RadioMgr::applyQualityTier(){
+	
+	_governor.setTiers(_sdrDecoder->quality_tiers());
+	
+	if(_sdrDecoder->quality_tier() == _governor.tier())
+		return;
+	
+	// the demod stage works on the same decoder,  wait it out.  What was
+	// in flight is dropped,  a short gap we are already having.
+	std::lock_guard<DecoderPipeline> hold(_pipeline);
+	_sdrDecoder->set_quality_tier(_governor.tier());
+}
+
+// Load is the busiest stage,  this thread or the demod stage of the
+// pipeline since the last block.  Blocks lost by the dongle's ring or
+// either queue count as drops.
+void RadioMgr::governQuality(double busySecs, double signalSecs){
+	
+	SampleRing<IQSample>::stats_t source = _source_buffer.stats();
+	uint64_t dropped = source.dropped + _sdr->droppedBlocks();
+	
+	DecoderPipeline::stats_t pipe = _pipeline.stats();
+	busySecs = max(busySecs, pipe.demodSecs - _pipelineStats.demodSecs);
+	dropped += pipe.overflows;
+	_pipelineStats = pipe;
+	
+	unsigned int from = _governor.tier();
+	
+	if(_governor.update(busySecs, signalSecs, source.queued, source.capacity, dropped)){
+		unsigned int to = _governor.tier();
+		
+		fprintf(stderr, "DSP load %.0f%%,  quality %s -> %s\n",
+				  _governor.load() * 100,
+				  _sdrDecoder->quality_tier_name(from),
+				  _sdrDecoder->quality_tier_name(to));
+		
+		PiCarMgr::shared()->db()->updateValue(VAL_RADIO_QUALITY_TIER, (int) to);
+	}
+}
+
+// Decoder levels and the output queue.  Called by SDRProcessor,  or by
+// the pipeline's demod stage for split decoders.  The levels come with
+// the block,  the decoder itself may be busy with the next one.  Gain
+// and metering are done with the int16 packing on the way out,  see
+// meterOutput().
+void RadioMgr::postAudio(SampleVector& audio, const DecoderPipeline::blockInfo_t& info){
+	
+	if(_mode == BROADCAST_FM) {
+		// Stereo indicator change
+		_mux = info.stereo ? MUX_STEREO:MUX_MONO;
+	}
+	
+	_IF_Level = 20*log10(info.ifLevel);
+	_baseband_level =  20*log10(info.basebandLevel) + 3.01;
+	
+	// first audio of a new tune,  tagged for OutputProcessor
+	uint32_t tag = 0;
+	if(_tunePending && !audio.empty()){
+		_tunePending = false;
+		tag = _tuneTag;
+	}
+	
+	// Write samples to output.
+	// Buffered write.
+	_output_buffer.push(move(audio), tag);
+}
+
 void* RadioMgr::SDRProcessorThread(void *context){
 	RadioMgr* d = (RadioMgr*)context;
 
@@ -1194,11 +1980,134 @@ void RadioMgr::SDRProcessorThreadCleanup(void *context){
 }
 // MARK: -  Audio Output processor  thread
 
+// Largest audio block the current mode hands to OutputProcessor.
+size_t RadioMgr::audioBlockLength(){
+	
+	if(_mode == AUX)
+		return AudioLineInput::default_blockLength;
+	
+	if(_mode == AIRPLAY)
+		return AirplayInput::default_blockLength;
+	
+	// one IQ block at the PCM rate,  left/right interleaved,  with room
+	// for the resampler's odd sample and the drift resampler's few extra.
+	uint32_t rate = _sdr->getSampleRate();
+	if(rate == 0)
+		return 0;
+	
+	size_t frames = uint64_t(_sdr->getBlockLength()) * _pcmrate / rate;
+	return 2 * (frames + 16);
+}
+
+// Frames of audio the low latency output aims to keep queued.
+size_t RadioMgr::targetFillFrames(){
+	
+	double ms = _targetFillMs;
+	
+	// a whole SDR block has to fit with room to spare,  or every block
+	// would run the output dry before the next one is decoded.
+	if(_mode != AUX && _mode != AIRPLAY){
+		uint32_t rate = _sdr->getSampleRate();
+		if(rate > 0)
+			ms = max(ms, 1500.0 * _sdr->getBlockLength() / rate);
+	}
+	
+	return ms * _pcmrate / 1000;
+}
+
+// Audio of the last station or source is dropped,  the drift resampler's
+// history and the fill belong to it.  The clock difference (_driftPpm) is
+// the same whatever plays,  it stays.
+void RadioMgr::flushOutput(){
+	_output_buffer.flush();
+	_outputFlushed = true;
+}
+
+// Steer the drift resampler so queued + ALSA audio stays at the target.
+// Gains are per second so the loop behaves the same for every block size.
+void RadioMgr::trackOutputFill(double frames, double blockFrames){
+	
+	double target = targetFillFrames() * 1000.0 / _pcmrate;
+	double dt = blockFrames / _pcmrate;
+	
+	_fillMs += min(dt / 0.5, 1.0) * (frames * 1000.0 / _pcmrate - _fillMs);
+	
+	// proportional for the offset,  integral for the clock difference
+	double err = (_fillMs - target) / target;
+	_driftPpm = min(max(_driftPpm + 50.0 * dt * err, -maxDriftPpm / 2), maxDriftPpm / 2);
+	
+	double ppm = min(max(_driftPpm + 4000.0 * err, -maxDriftPpm), maxDriftPpm);
+	_driftResampler.set_ratio(1.0 - ppm * 1e-6);
+}
+
+// The first block of a new tune is about to be written,  it is heard once
+// ALSA has played what it already holds.
+void RadioMgr::updateTuneLatency(uint32_t tag, int delayFrames){
+	
+	// untagged,  or a tune that was already retuned away from
+	if(tag == 0 || tag != _tuneTag)
+		return;
+	
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	long ms = timespec_to_ms(timespec_sub(now, _tuneStart))
+				+ long(max(delayFrames, 0)) * 1000 / _pcmrate;
+	
+	PiCarMgr::shared()->db()->updateValue(VAL_TUNE_TO_AUDIO_MS, (int) ms);
+}
+
+// What went out to ALSA.  _audioLevel is the decoder's level before the gain,
+// line in and AirPlay leave it alone.
+void RadioMgr::meterOutput(const AudioPost::levels_t &levels, bool rawAudio){
+	
+	if(levels.count == 0)
+		return;
+	
+	if(!rawAudio)
+		_audioLevel = 0.95 * _audioLevel + 0.05 * levels.rms / sdrGain;
+	_outputRms = 0.95 * _outputRms + 0.05 * levels.rms;
+	_outputPeak = max(_outputPeak, levels.peak);
+	_clippedSamples += levels.clipped;
+}
+
+void RadioMgr::updateOutputStats(){
+	
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	if(timespec_to_ms(timespec_sub(now, _blockStatsStart)) >= 1000){
+		PiCarDB*	db = PiCarMgr::shared()->db();
+		
+		db->updateValue(VAL_AUDIO_BLOCK_ALLOCS, (int) _audioPool.stats().allocations);
+		db->updateValue(VAL_IQ_BLOCK_ALLOCS, (int) _sdr->blockStats().allocations);
+		db->updateValue(VAL_IQ_DROPPED_BLOCKS, (int) _sdr->droppedBlocks());
+		
+		if(_targetFillMs > 0){
+			db->updateValue(VAL_AUDIO_FILL_MS, (int) round(_fillMs));
+			db->updateValue(VAL_AUDIO_UNDERRUNS, (int) _underruns);
+			db->updateValue(VAL_AUDIO_DRIFT_PPM, round(_driftPpm * 10) / 10);
+		}
+		
+		// dBFS,  the peak since the last update
+		if(_outputRms > 0)
+			db->updateValue(VAL_AUDIO_RMS_DB, round(200 * log10(_outputRms)) / 10);
+		if(_outputPeak > 0)
+			db->updateValue(VAL_AUDIO_PEAK_DB, round(200 * log10(_outputPeak)) / 10);
+		db->updateValue(VAL_AUDIO_CLIPPED, (int) _clippedSamples);
+		_outputPeak = 0;
+		
+		_blockStatsStart = now;
+	}
+}
+
  
 void RadioMgr::OutputProcessor(){
   
 	PRINT_CLASS_TID;
 	
+	SampleVector resampled;
+	
 	while(!_shouldQuit){
 		
 		if(!_isSetup){
@@ -1206,32 +2115,70 @@ void RadioMgr::OutputProcessor(){
 			continue;
 		}
 		
+		AudioOutput*	 audio  = PiCarMgr::shared()->audio();
+		
+		// AUX and AirPlay blocks are raw frames,  decoder output is L/R
+		bool rawAudio = _mode == AUX || _mode == AIRPLAY;
+		size_t frameLength = rawAudio ? 1 : 2;
+		
 		if (_output_buffer.queued_samples() == 0) {
 			 // The buffer is empty. Perhaps the output stream is consuming
 			 // samples faster than we can produce them. Wait until the buffer
 			 // is back at its nominal level to make sure this does not happen
 			 // too often.
 			
-			
-			// revisit this..  the 2 is for stereo..
-			
-			_output_buffer.wait_buffer_fill(_pcmrate * 2);
-			
-			
+			if(_targetFillMs > 0){
+				// ALSA still playing means the next block is on its way,
+				// only a drained output restarts at the target fill.
+				if(audio->delayFrames() <= 0)
+					_output_buffer.wait_buffer_fill(targetFillFrames() * frameLength);
+			}
+			else {
+				// revisit this..  the 2 is for stereo..
+				_output_buffer.wait_buffer_fill(_pcmrate * 2);
+			}
 		}
 		// Get samples from buffer and write to output.
-		SampleVector samples =_output_buffer.pull();
-		AudioOutput*	 audio  = PiCarMgr::shared()->audio();
+		uint32_t tag = 0;
+		SampleVector samples =_output_buffer.pull(tag);
 		
-		if(_mode	== AUX ){
-			audio->writeAudio(samples);
+		if(_outputFlushed.exchange(false)){
+			_driftResampler.reset();
+			_fillMs = _targetFillMs;
 		}
-		else if(_mode	== AIRPLAY ){
-			audio->writeAudio(samples);
+		
+		// time to ALSA,  not counting the write that waits for room
+		ThreadPolicy::workStart(samples.size() / frameLength / (double) _pcmrate);
+		
+		AudioPost::levels_t levels;
+		
+		if(rawAudio){
+			ThreadPolicy::workDone();
+			if(!audio->writeAudio(samples, levels))
+				_underruns++;
 		}
 		else {
-			audio->writeIQ(samples);
+			int delay = audio->delayFrames();
+			updateTuneLatency(tag, delay);
+			
+			if(_targetFillMs > 0){
+				if(delay >= 0)
+					trackOutputFill((_output_buffer.queued_samples() + samples.size()) / frameLength + delay,
+										 samples.size() / frameLength);
+				
+				_driftResampler.process(samples, resampled);
+				samples.swap(resampled);
+			}
+			
+			ThreadPolicy::workDone();
+			if(!audio->writeIQ(samples, sdrGain, levels))
+				_underruns++;
 		}
+		
+		meterOutput(levels, rawAudio);
+		
+		_audioPool.put(samples);
+		updateOutputStats();
 	}
 	
  }
@@ -1287,10 +2234,16 @@ void RadioMgr::ChannelManager(){
 		
 		//		pthread_mutex_lock (&_mutex);
 		channelEventQueueItem_t item = {MODE_UNKNOWN,0, false};
-		if(_channelEventQueue.size()){
+		
+		// spinning the knob queues up stations nobody will listen to,
+		// only tune the last one.
+		bool force = false;
+		while(_channelEventQueue.size()){
 			item = _channelEventQueue.front();
 			_channelEventQueue.pop();
+			force |= item.force;
 		}
+		item.force = force;
 		
 		pthread_mutex_unlock (&_channelmutex);
 	 
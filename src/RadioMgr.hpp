@@ -12,18 +12,30 @@
 #include <stdlib.h>
 #include <mutex>
 #include <bitset>
+#include <queue>
+#include <map>
+#include <tuple>
+#include <atomic>
 #include <time.h>
 #include <unistd.h>
 
 #include <sys/time.h>
 #include "RtlSdr.hpp"
+#include "IQFileSource.hpp"
+#include "IQRecorder.hpp"
 #include "SDRDecoder.hpp"
+#include "Filter.hpp"
 
-#include "DataBuffer.hpp"
+#include "SampleRing.hpp"
+#include "BlockPool.hpp"
 #include "ErrorMgr.hpp"
 #include "CommonDefs.hpp"
 #include "AudioLineInput.hpp"
 #include "AirplayInput.hpp"
+#include "SpectrumEngine.hpp"
+#include "DecoderPipeline.hpp"
+#include "QualityGovernor.hpp"
+#include "AudioPost.hpp"
 
 using namespace std;
 
@@ -50,17 +62,41 @@ public:
 	
  
 	typedef pair<RadioMgr::radio_mode_t,uint32_t> channel_t;
+	
+	// dongle rate and decoder setup for a mode
+	typedef struct {
+		uint32_t			sampleRate;			// dongle rate in S/s
+		double			basebandRate;		// decimate down to about this before audio
+		unsigned int	ifFilterOrder;		// IF FIR order at the channel rate,  0 = decoder default
+	} rate_plan_t;
+	
+	static rate_plan_t ratePlanForMode(radio_mode_t mode);
 	 
 	RadioMgr();
 	~RadioMgr();
 	
 	bool begin(uint32_t deviceIndex  = 0, int  pcmrate = 48000);
 	bool begin(uint32_t deviceIndex, int  pcmrate,  int &error);
+	
+	// play a recorded .cu8 / SigMF capture instead of the dongle
+	bool beginIQFile(string path, bool realtime, int  pcmrate,  int &error);
 	void stop();
 	
+	// hold the audio output near targetMs of buffering,  trimming the
+	// rate to follow the sound card clock.  0 is the classic second deep
+	// start.  Call before begin(),  it picks the SDR block length.
+	void setLowLatency(uint32_t targetMs);
+	bool isLowLatency() { return _targetFillMs > 0; };
+	
 	bool isConnected() ;
 
 	bool getDeviceInfo(RtlSdr::device_info_t&);
+	bool isIQFileSource() { return _sdr == &_iqFile; };
+
+	// record the raw dongle stream,  path has no extension for SigMF
+	bool startIQRecording(string path, bool sigmf = true);
+	void stopIQRecording();
+	bool isIQRecording() { return _recorder.isRecording(); };
 	
 	static string freqSuffixString(double hz);
 	static string hertz_to_string(double hz, int precision = 1);
@@ -111,6 +147,9 @@ public:
 	
 	bool hasAirplay();
 	
+	// band scope rows for the display
+	SpectrumEngine* spectrum() { return &_spectrum; };
+	
 	bool queueGetFrequencyandMode(radio_mode_t &mode, uint32_t &freq) {
 		mode = _mode;
 		freq = _frequency;
@@ -122,7 +161,10 @@ private:
 
 	bool					_isSetup;
  
-	RtlSdr				_sdr;
+	RtlSdr				_rtlSdr;
+	IQFileSource		_iqFile;
+	SDRSource*			_sdr;			// one of the above
+	IQRecorder			_recorder;
 	int					_pcmrate;
 	radio_mode_t 		_mode;
 	uint32_t				_frequency;
@@ -136,15 +178,87 @@ private:
 	
 	bool 					_AGC_active;
 	 
-	// Create source data queue.
-	DataBuffer<IQSample> _source_buffer;
+	// Create source data queue,  no deeper than the SDR ring it borrows from.
+	// Both queues drop the oldest block when the reader falls behind.
+	SampleRing<IQSample> _source_buffer {SDRSource::default_ringBlocks};
+	
+	// output data queue,  a bit over 3 seconds of 2.4 MS/s blocks
+	static constexpr size_t outputRingBlocks = 128;
+	SampleRing<Sample>   _output_buffer {outputRingBlocks};
 	
-	// output data queue
-	DataBuffer<Sample>   _output_buffer;
+	// audio blocks go round from the readers / decoder to OutputProcessor
+	// and back,  sized by audioBlockLength() for the mode
+	BlockPool<Sample>		_audioPool {0, outputRingBlocks};
+	
+	struct timespec		_blockStatsStart;
+	
+	// low latency output,  see setLowLatency()
+	static constexpr int		lowLatencyBlockLength = 16384;	// IQ samples
+	static constexpr double	maxDriftPpm = 2000;
+	
+	uint32_t				_targetFillMs;			// 0 = off
+	DriftResampler		_driftResampler;
+	double				_fillMs;				// smoothed,  queued + ALSA
+	double				_driftPpm;				// integral of the fill error
+	uint64_t				_underruns;
+	atomic<bool>		_outputFlushed;		// OutputProcessor restarts the resampler
+	
+	// decoder output is packed at this gain,  AUX and AirPlay as they come
+	static constexpr float	sdrGain = 0.5;
+	double				_outputRms;				// smoothed,  1.0 is full scale
+	double				_outputPeak;			// since the last stats
+	uint64_t				_clippedSamples;
+	
+	size_t audioBlockLength();
+	size_t targetFillFrames();
+	void flushOutput();
+	void trackOutputFill(double frames, double blockFrames);
+	void meterOutput(const AudioPost::levels_t &levels, bool rawAudio);
+	void updateOutputStats();
 
 
  	mutable std::mutex _mutex;		// when changing frequencies and modes.
 	SDRDecoder*			_sdrDecoder;
+	
+	// FM and VHF/UHF decoders are built once per sample rate and IF
+	// bandwidth and reset on a retune,  the LO moves instead of the
+	// tuning offset.  Scanner clusters are built for each cluster.
+	typedef std::tuple<radio_mode_t, uint32_t, uint32_t> decoderKey_t;	// mode, rate, IF bw
+	map<decoderKey_t, SDRDecoder*> _decoderCache;
+	
+	SDRDecoder* makeDecoder(radio_mode_t mode, uint32_t rate, double ifBandwidth);
+	SDRDecoder* cachedDecoder(radio_mode_t mode, double ifBandwidth);
+	bool isCachedDecoder(SDRDecoder*);
+	void prebuildDecoders();
+	void clearDecoderCache();
+	
+	// IQ blocks from before a retune are dropped by the reader and the
+	// processor when the count moved under them.
+	std::mutex			_retuneMutex;
+	atomic<uint32_t>	_tuneCount;
+	void flushStaleBlocks();
+	
+	// tune to audio latency,  taken when the first block decoded after a
+	// tune goes out to ALSA.  That block carries the tune's tag through
+	// _output_buffer,  every other block carries 0.
+	struct timespec		_tuneStart;
+	atomic<uint32_t>	_tuneTag;				// of the tune being timed,  0 before the first
+	bool						_tunePending;			// no block decoded yet
+	void updateTuneLatency(uint32_t tag, int delayFrames);
+	
+	// decoders that can_split() run the demod and postAudio() on a core of
+	// its own,  the IF chain stays on SDRProcessor
+	DecoderPipeline		_pipeline;
+	double					_audioLevel;
+	void postAudio(SampleVector& audio, const DecoderPipeline::blockInfo_t& info);
+	
+	// when the decode can't keep up the decoder steps down to cheaper
+	// quality tiers,  and back up once there is headroom again
+	QualityGovernor		_governor;
+	DecoderPipeline::stats_t	_pipelineStats;		// at the last block
+	void applyQualityTier();
+	void governQuality(double busySecs, double signalSecs);
+	
 	AudioLineInput		_lineInput;
 	AirplayInput		_airplayInput;
  
@@ -152,7 +266,46 @@ private:
 	uint									_currentScanOffset;
 	bool									_scannerMode;
 	bool									_scanningPaused;
+	
+	// scanner channels decoded together from one capture
+	vector <uint>						_scanCluster;			// offsets into _scannerChannels
+	uint32_t								_scanClusterTuner;	// LO frequency for the cluster
+	
+	void planScanCluster();
+	bool isInScanCluster(uint offset);
+	
+	// FFT snapshot of the capture after each scanner hop
+	static constexpr unsigned int scanSnapshotBins = 1024;
+	
+	uint32_t								_tunerFrequency;		// LO of the current decoder
+	
+	SpectrumEngine						_spectrum;
+	bool									_scanFreshTune;		// tuned,  no snapshot yet
+	bool									_scanHopQueued;		// hop not at the channel manager yet
+	bool									_scanHunting;
+	struct timespec					_scanHuntStart;
+	struct timespec					_scanStatsStart;
+	uint									_scanHops;
+	
+	// The snapshot can see power the decoder's squelch won't open on,  an
+	// off center carrier or splash from next door.  A channel the squelch
+	// stays shut on that long is hopped off and left out of the snapshot
+	// for a while.
+	static constexpr long				scanFalseDwellMs = 1000;
+	static constexpr long				scanFalseHoldMs = 30000;
+	struct timespec					_scanParkStart;		// squelch shut since,  0 when open
+	map<uint, struct timespec>		_scanFalseChannels;	// offset,  left out until
+	
+	bool scanParkedTooLong();
+	bool isFalseScanChannel(uint offset);
+	bool scanForActiveChannel(const vector<float>& power);
+	void hopScanner(uint offset);
+	void scanHeard();
+	void scanHunting();
+	void updateScanStats();
  
+	bool setupSource(int  pcmrate, uint32_t sampleRate);
+	bool applyRatePlan(const rate_plan_t &plan);
 	bool setFrequencyandModeInternal(radio_mode_t, uint32_t freq = 0, bool force = false);
 
 	void queueSetFrequencyandMode(radio_mode_t, uint32_t freq = 0, bool force = false);
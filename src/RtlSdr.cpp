@@ -6,8 +6,16 @@
 //
 #include <climits>
 #include <cstring>
+#include <unistd.h>
  
 #include "RtlSdr.hpp"
+#include "IQConverter.hpp"
+#include "IQRecorder.hpp"
+#include "ThreadPolicy.hpp"
+#include "DSPTiming.hpp"
+
+// u8 to IQSample conversion,  published by PiCarMgr
+static DSPStage s_sdr_conv("sdr_conv");
 
 
 // MARK: -   RtlSdr
@@ -16,7 +24,14 @@ RtlSdr::RtlSdr(){
 	_isSetup = false;
 	_dev = NULL;
 	_blockLength = default_blockLength;
+	_blockPool.setBlockLength(_blockLength);
 	
+	_isStreaming = false;
+	_ringBlocks = 0;
+	_readyHead = 0;
+	_readyCount = 0;
+	_droppedBlocks = 0;
+	_recorder = NULL;
 }
 
 RtlSdr::~RtlSdr(){
@@ -28,6 +43,10 @@ bool RtlSdr::begin(uint32_t dev_index,  int &error){
 	bool success = false;
 	int r;
 	
+	// pick the fastest uint8 -> IQSample conversion for this CPU, once.
+	static std::once_flag convertOnce;
+	std::call_once(convertOnce, [](){ IQConverter::selectFastest(true); });
+	
 	r = rtlsdr_open(&_dev, dev_index);
 	if( r < 0){
 		error = r;
@@ -42,6 +61,7 @@ bool RtlSdr::begin(uint32_t dev_index,  int &error){
 
 void RtlSdr::stop(){
 	if(_isSetup){
+		stopStreaming();
 		rtlsdr_close(_dev);
 	};
 	
@@ -197,6 +217,12 @@ bool RtlSdr::setFrequency(uint32_t frequency) {
 	if (r < 0) {
 		throw Exception("rtlsdr_set_center_freq failed");
 	}
+	
+	{
+		std::lock_guard<std::mutex> lock(_recorderMutex);
+		if(_recorder)
+			_recorder->setFrequency(frequency);
+	}
 
 	success = true;
 	return success;
@@ -220,6 +246,21 @@ bool RtlSdr::setSampleRate(uint32_t sample_rate) {
 	return success;
 }
 
+bool RtlSdr::setBlockLength(int blockLength) {
+	
+	// the async transfers are sized when streaming starts
+	if(_isStreaming)
+		return false;
+	
+	blockLength = max(blockLength, 4096);
+	blockLength = min(blockLength, 1024 * 1024);
+	blockLength -= blockLength % 256;
+	
+	_blockLength = blockLength;
+	_blockPool.setBlockLength(_blockLength);
+	return true;
+}
+
 bool RtlSdr::resetBuffer() {
 	
 	bool success = false;
@@ -228,6 +269,18 @@ bool RtlSdr::resetBuffer() {
 	if (!_isSetup ||  !_dev)
 		 return false;
 
+	// while streaming the USB side keeps running, just drop the stale blocks.
+	if(_isStreaming){
+		std::lock_guard<std::mutex> lock(_ringMutex);
+		
+		while(_readyCount > 0){
+			_blockPool.put(_readyBlocks[_readyHead]);
+			_readyHead = (_readyHead + 1) % _ringBlocks;
+			_readyCount--;
+		}
+		return true;
+	}
+	
 	r = rtlsdr_reset_buffer(_dev);
 	if (r < 0) {
 		throw Exception("rtlsdr_reset_buffer failed ");
@@ -249,9 +302,30 @@ bool RtlSdr::getSamples(IQSampleVector& samples)
 	 if (!_isSetup ||  !_dev)
 		  return false;
 
-	 vector<uint8_t> buf(2 * _blockLength);
+	 if (_isStreaming) {
+		  std::unique_lock<std::mutex> lock(_ringMutex);
+
+		  // dont wait forever, the reader needs to notice when we stop.
+		  if (!_ringCond.wait_for(lock, std::chrono::milliseconds(500),
+										  [this]{ return _readyCount > 0 || !_isStreaming; }))
+				return false;
+
+		  if (_readyCount == 0)
+				return false;
 
-	 r = rtlsdr_read_sync(_dev, buf.data(), 2 * _blockLength, &n_read);
+		  // hand back whatever storage the caller had before taking the block.
+		  if (samples.capacity() >= (size_t)_blockLength)
+				_blockPool.put(samples);
+
+		  samples = std::move(_readyBlocks[_readyHead]);
+		  _readyHead = (_readyHead + 1) % _ringBlocks;
+		  _readyCount--;
+		  return true;
+	 }
+
+	 _syncBuf.resize(2 * _blockLength);
+
+	 r = rtlsdr_read_sync(_dev, _syncBuf.data(), 2 * _blockLength, &n_read);
 	 if (r < 0) {
 		 fprintf(stderr, "rtlsdr_read_sync failed\n");
  		  return false;
@@ -262,18 +336,171 @@ bool RtlSdr::getSamples(IQSampleVector& samples)
  		  return false;
 	 }
 
-	 samples.resize(_blockLength);
-	 for (int i = 0; i < _blockLength; i++) {
-		  int32_t re = buf[2*i];
-		  int32_t im = buf[2*i+1];
-		  samples[i] = IQSample( (re - 128) / IQSample::value_type(128),
-										 (im - 128) / IQSample::value_type(128) );
+	 {
+		  std::lock_guard<std::mutex> lock(_recorderMutex);
+		  if (_recorder)
+				_recorder->write(_syncBuf.data(), n_read);
 	 }
 
+	 samples.resize(_blockLength);
+	 
+	 DSPTimer conv(s_sdr_conv, _blockLength / (double) getSampleRate());
+	 IQConverter::convert(_syncBuf.data(), _blockLength, samples.data());
+
 	 return true;
 }
 
 
+void RtlSdr::setRecorder(IQRecorder* recorder){
+	std::lock_guard<std::mutex> lock(_recorderMutex);
+	_recorder = recorder;
+}
+
+
+void RtlSdr::releaseSamples(IQSampleVector& samples){
+	
+	if(samples.capacity() < (size_t)_blockLength)
+		return;
+	
+	_blockPool.put(samples);
+}
+
+
+// MARK: -   Async streaming
+
+bool RtlSdr::startStreaming(int ringBlocks){
+	
+	std::lock_guard<std::mutex> streamLock(_streamMutex);
+	
+	if (!_isSetup ||  !_dev)
+		 return false;
+	
+	if(_isStreaming)
+		return true;
+	
+	if(rtlsdr_reset_buffer(_dev) < 0)
+		return false;
+	
+	{
+		std::lock_guard<std::mutex> lock(_ringMutex);
+		
+		// allocate the ring once, blocks that were handed out come back
+		// through releaseSamples()
+		if(ringBlocks != _ringBlocks){
+			_blockPool.clear();
+			_readyBlocks.clear();
+			_ringBlocks = ringBlocks;
+			_blockPool.setMaxFree(_ringBlocks);
+		}
+		
+		_readyBlocks.resize(_ringBlocks);
+		
+		while(_readyCount > 0){
+			_blockPool.put(_readyBlocks[_readyHead]);
+			_readyHead = (_readyHead + 1) % _ringBlocks;
+			_readyCount--;
+		}
+		_readyHead = 0;
+		
+		_blockPool.fill(_ringBlocks);
+		
+		_isStreaming = true;
+	}
+	
+	if(pthread_create(&_asyncTID, NULL, &RtlSdr::AsyncReaderThread, (void*)this) != 0){
+		_isStreaming = false;
+		return false;
+	}
+	
+	ThreadPolicy::shared()->registerThread("RtlSdrAsync", _asyncTID);
+	
+	return true;
+}
+
+void RtlSdr::stopStreaming(){
+	
+	std::lock_guard<std::mutex> streamLock(_streamMutex);
+	
+	if(!_isStreaming)
+		return;
+	
+	rtlsdr_cancel_async(_dev);
+	pthread_join(_asyncTID, NULL);
+	
+	{
+		std::lock_guard<std::mutex> lock(_ringMutex);
+		_isStreaming = false;
+	}
+	_ringCond.notify_all();
+}
+
+void* RtlSdr::AsyncReaderThread(void *context){
+	RtlSdr* d = (RtlSdr*)context;
+	
+	PRINT_CLASS_TID;
+	
+	int r = rtlsdr_read_async(d->_dev, &RtlSdr::asyncCallbackWrapper, d,
+									  0, 2 * d->_blockLength);
+	if(r < 0)
+		fprintf(stderr, "rtlsdr_read_async failed (%d)\n", r);
+	
+	return NULL;
+}
+
+void RtlSdr::asyncCallbackWrapper(unsigned char *buf, uint32_t len, void *context){
+	RtlSdr* d = (RtlSdr*)context;
+	d->asyncCallback(buf, len);
+}
+
+// called on the librtlsdr thread for every completed USB transfer.
+void RtlSdr::asyncCallback(unsigned char *buf, uint32_t len){
+	
+	IQSampleVector block;
+	
+	{
+		std::lock_guard<std::mutex> lock(_recorderMutex);
+		if(_recorder)
+			_recorder->write(buf, len);
+	}
+	
+	{
+		std::lock_guard<std::mutex> lock(_ringMutex);
+		
+		// never allocate here,  the ring is all there is
+		if(!_blockPool.get(block, false)){
+
+			if(_readyCount == _ringBlocks){
+				// nobody is reading, recycle the oldest block
+				block = std::move(_readyBlocks[_readyHead]);
+				_readyHead = (_readyHead + 1) % _ringBlocks;
+				_readyCount--;
+				_droppedBlocks++;
+			}
+			else {
+				// every block is downstream,  these samples are lost
+				_droppedBlocks++;
+				return;
+			}
+		}
+	}
+	
+	size_t count = min((size_t)_blockLength, (size_t)len / 2);
+	block.resize(count);
+	
+	DSPTimer conv(s_sdr_conv, count / (double) getSampleRate());
+	IQConverter::convert(buf, count, block.data());
+	conv.stop();
+	
+	{
+		std::lock_guard<std::mutex> lock(_ringMutex);
+		int tail = (_readyHead + _readyCount) % _ringBlocks;
+		_readyBlocks[tail] = std::move(block);
+		_readyCount++;
+	}
+	_ringCond.notify_one();
+}
+
+
 
 //
 //bool RtlSdr::configure(uint32_t sample_rate,
@@ -14,27 +14,23 @@
 #include <string>
 #include <vector>
 #include <complex>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <pthread.h>
 
 #include "IQSample.h"
+#include "SDRSource.hpp"
 #include "CommonDefs.hpp"
 #include "rtl-sdr.h"
 
 using namespace std;
 
+class IQRecorder;
 
-typedef std::complex<float> IQSample;
-typedef std::vector<IQSample> IQSampleVector;
-
-class RtlSdr
+class RtlSdr : public SDRSource
 {
 public:
-	typedef struct  {
-		uint32_t index;
-		string 	name;
-		string   vendor;
-		string   product;
-		string   serial;
-	} device_info_t;
 	
 	static constexpr int 	default_blockLength = 65536;
 	static constexpr double default_sampleRate = 1.0e6;
@@ -79,6 +75,10 @@ public:
 	// Enable or disable the bias tee
 	bool setBiasTee(bool);
  
+	// samples per block, a multiple of 256 so the USB transfers stay whole
+	bool setBlockLength(int);
+	int getBlockLength() { return _blockLength; }
+	
 	// reset buffer to start streaming
 	bool resetBuffer();
 	
@@ -90,6 +90,30 @@ public:
 	 */
 	bool getSamples(IQSampleVector& samples);
 	
+	/**
+	 * Start asynchronous streaming.
+	 *
+	 * Samples are read with rtlsdr_read_async and converted straight from the
+	 * USB transfer buffers into a fixed ring of pre-allocated blocks.
+	 * While streaming, getSamples() hands out the oldest ready block and
+	 * releaseSamples() gives its storage back to the ring, so there is no
+	 * heap traffic per block.
+	 */
+	bool startStreaming(int ringBlocks = default_ringBlocks);
+	void stopStreaming();
+	bool isStreaming() { return _isStreaming; }
+	
+	/** Return the storage of a block from getSamples() to the ring. */
+	void releaseSamples(IQSampleVector& samples);
+	
+	blockPoolStats_t blockStats() { return _blockPool.stats(); }
+	
+	/** Number of blocks dropped because no free ring block was available. */
+	uint64_t droppedBlocks() { return _droppedBlocks; }
+	
+	/** Tee raw cu8 blocks to a recorder, NULL to stop. */
+	void setRecorder(IQRecorder* recorder);
+	
 	
 	//	/**
 	//	 * Configure RTL-SDR tuner and prepare for streaming.
@@ -121,6 +145,25 @@ private:
 	struct rtlsdr_dev * 	_dev;
 	uint32_t 				_devIndex;
 	int       				_blockLength;
-	
-	
+	vector<uint8_t>		_syncBuf;
+	
+	// async streaming ring
+	std::atomic<bool>		_isStreaming;		// read outside _ringMutex
+	pthread_t				_asyncTID;
+	std::mutex 				_streamMutex;		// start / stop
+	std::mutex 				_ringMutex;
+	std::condition_variable _ringCond;
+	int						_ringBlocks;
+	BlockPool<IQSample>	_blockPool;			// free blocks,  at most _ringBlocks
+	vector<IQSampleVector> _readyBlocks;		// fifo of _ringBlocks slots
+	int						_readyHead;
+	int						_readyCount;
+	std::atomic<uint64_t>	_droppedBlocks;	// counted on the librtlsdr thread
+	
+	IQRecorder*				_recorder;
+	std::mutex 				_recorderMutex;
+	
+	void asyncCallback(unsigned char *buf, uint32_t len);
+	static void asyncCallbackWrapper(unsigned char *buf, uint32_t len, void *context);
+	static void* AsyncReaderThread(void *context);
 };
@@ -27,6 +27,8 @@ public:
 	
 	virtual double get_baseband_level() const = 0;
 	
+	virtual bool 	stereo_detected() const { return false; };
+	
 	virtual  bool 	canSquelch () const = 0;
 	
 	virtual  bool 	isSquelched() const = 0;
@@ -34,5 +36,37 @@ public:
 	virtual void 	set_squelch_level(int level)  = 0;
 	
 	virtual void 	set_squelch_dwell(uint count)  = 0;
+	
+	/** Forget the last station before the decoder is used for another.
+	 *  Filter tables are kept,  that is what makes it cheaper than a new one.
+	 */
+	virtual void 	reset() = 0;
+	
+	/** Decoders that can run as pipeline stages (see DecoderPipeline)
+	 *  split process() into an IF chain and a demodulator.  Each half
+	 *  may run on its own thread as long as only one thread calls it.
+	 */
+	virtual bool 	can_split() const { return false; };
+	
+	/** IF chain,  IQ in,  filtered channel rate IQ out. */
+	virtual void 	process_if(const IQSampleVector& samples_in,
+									IQSampleVector& samples_if) {};
+	
+	/** Demodulator,  process_if() output in,  audio out. */
+	virtual void 	process_demod(const IQSampleVector& samples_if,
+										SampleVector& audio) {};
+	
+	/** Decoders that can trade audio quality for CPU have tiers above 0,
+	 *  each cheaper than the one before.  RadioMgr steps down through
+	 *  them when the decode falls behind (see QualityGovernor).
+	 */
+	virtual unsigned int quality_tiers() const { return 1; };
+	
+	virtual unsigned int quality_tier() const { return 0; };
+	
+	virtual void 	set_quality_tier(unsigned int tier) {};
+	
+	/** Short name of a tier for the log. */
+	virtual const char* quality_tier_name(unsigned int tier) const { return "full"; };
  
 };
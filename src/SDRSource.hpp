@@ -0,0 +1,78 @@
+//
+//  SDRSource.hpp
+//  carradio
+//
+//  Interface RadioMgr uses to pull IQ blocks, implemented by the RTL-SDR
+//  dongle (RtlSdr) and by recorded captures (IQFileSource).
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "IQSample.h"
+#include "BlockPool.hpp"
+
+class SDRSource {
+
+public:
+	typedef struct  {
+		uint32_t 		index;
+		std::string 	name;
+		std::string   	vendor;
+		std::string   	product;
+		std::string   	serial;
+	} device_info_t;
+
+	static constexpr int 	default_ringBlocks = 32;
+
+	/** Destructor.
+	 *  Virtual to allow for subclassing.
+	 */
+	virtual ~SDRSource() {};
+
+	virtual void stop() = 0;
+
+	virtual bool getDeviceInfo(device_info_t&) = 0;
+
+	/** Set / return center frequency in Hz. */
+	virtual bool setFrequency(uint32_t) = 0;
+	virtual uint32_t getFrequency() = 0;
+
+	/** Set / return sample frequency in Hz. */
+	virtual bool setSampleRate(uint32_t) = 0;
+	virtual uint32_t getSampleRate() = 0;
+
+	/** tuner gain settings in units of 0.1 dB. */
+	virtual int getTunerGain() = 0;
+	virtual std::vector<int> getTunerGains() = 0;
+	virtual bool setTunerGain(int) = 0;
+
+	virtual bool setOffsetTuning(bool) = 0;
+	virtual bool setACGMode(bool) = 0;
+	virtual bool setBiasTee(bool) = 0;
+
+	/** Samples per block,  can only be changed while not streaming. */
+	virtual bool setBlockLength(int) = 0;
+	virtual int getBlockLength() = 0;
+
+	// drop any samples queued up before a retune
+	virtual bool resetBuffer() = 0;
+
+	virtual bool startStreaming(int ringBlocks = default_ringBlocks) = 0;
+	virtual void stopStreaming() = 0;
+	virtual bool isStreaming() = 0;
+
+	/** Fetch the next block of samples, false on error or timeout. */
+	virtual bool getSamples(IQSampleVector& samples) = 0;
+
+	/** Return the storage of a block from getSamples(). */
+	virtual void releaseSamples(IQSampleVector& samples) = 0;
+
+	/** Counters of the pool behind getSamples() / releaseSamples(). */
+	virtual blockPoolStats_t blockStats() = 0;
+
+	/** Blocks the source lost because nobody took them in time. */
+	virtual uint64_t droppedBlocks() = 0;
+};
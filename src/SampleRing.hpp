@@ -0,0 +1,333 @@
+//
+//  SampleRing.hpp
+//  carradio
+//
+//  Bounded lock-free queue of sample blocks between two threads,  the
+//  replacement for DataBuffer in RadioMgr.
+//
+//  Slots carry a sequence number (Vyukov style) so a block is only
+//  written once the reader is done with the slot.  Head and tail are
+//  claimed with CAS rather than plain stores:  that lets the writer drop
+//  the oldest block on overflow and lets flush() run from the channel
+//  manager,  and it keeps the AUX / AirPlay / SDR writers of the output
+//  queue safe while they hand over on a mode switch.
+//
+//  The reader only sleeps (futex) when it finds the queue empty or short
+//  of a fill level,  and the writer only makes the wake up syscall when
+//  the reader said it was sleeping.
+//
+//  Each block can carry a Tag,  copied in and out with it,  for what
+//  has to stay with that block:  a retune epoch,  levels,  a tune count.
+//
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+template <class Element, class Tag = uint32_t>
+class SampleRing
+{
+public:
+
+	typedef enum  {
+		DROP_OLDEST = 0,			// radio: late audio is worse than a gap
+		DROP_NEWEST,
+	}overflow_t;
+
+	typedef struct {
+		uint64_t		pushed;				// blocks
+		uint64_t		pulled;
+		uint64_t		dropped;
+		size_t		queued;
+		size_t		highWater;			// most blocks queued at once
+		size_t		capacity;
+	} stats_t;
+
+	/** Constructor,  capacity in blocks is rounded up to a power of 2. */
+	SampleRing(size_t capacity, overflow_t policy = DROP_OLDEST)
+	: m_policy(policy)
+	, m_head(0)
+	, m_tail(0)
+	, m_qlen(0)
+	, m_pushes(0)
+	, m_waiting(false)
+	, m_end_marked(false)
+	, m_pushed(0)
+	, m_pulled(0)
+	, m_dropped(0)
+	, m_high_water(0)
+	{
+		size_t n = 1;
+		while(n < capacity) n <<= 1;
+
+		m_mask = n - 1;
+		m_slots = vector<slot_t>(n);
+		for(size_t i = 0; i < n; i++)
+			m_slots[i].seq.store(i, memory_order_relaxed);
+	}
+
+	/**
+	 * Add a block to the queue.  What comes back in samples is storage the
+	 * caller can reuse,  the dropped block when the queue overflowed.
+	 * Return false if the block itself was dropped.  tag goes along with
+	 * the block,  see pull(Tag&).
+	 */
+	bool push(vector<Element>&& samples, const Tag& tag = Tag())
+	{
+		if (samples.empty())
+			return true;
+
+		vector<Element> dropped;
+		slot_t* slot;
+		size_t pos;
+
+		while(true) {
+			pos = m_head.load(memory_order_relaxed);
+			slot = &m_slots[pos & m_mask];
+			intptr_t dif = (intptr_t)slot->seq.load(memory_order_acquire) - (intptr_t)pos;
+
+			if (dif == 0) {
+				if (m_head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+					break;
+			}
+			else if (dif < 0) {
+				// the reader is still swapping out of this slot
+				if (pos - m_tail.load(memory_order_acquire) <= m_mask) {
+					sched_yield();
+					continue;
+				}
+
+				if (m_policy == DROP_NEWEST) {
+					m_dropped++;
+					return false;
+				}
+
+				if (take(dropped))
+					m_dropped++;
+			}
+		}
+
+		size_t n = samples.size();
+		m_qlen.fetch_add(n);
+
+		slot->data.swap(samples);
+		slot->tag = tag;
+		slot->seq.store(pos + 1, memory_order_release);
+
+		m_pushed++;
+
+		size_t queued = queued_blocks();
+		if (queued > m_high_water.load(memory_order_relaxed))
+			m_high_water.store(queued, memory_order_relaxed);
+
+		if (!dropped.empty())
+			samples.swap(dropped);
+
+		wake();
+		return true;
+	}
+
+	/** Mark the end of the data stream. */
+	void push_end()
+	{
+		m_end_marked = true;
+		wake();
+	}
+
+	/** Return number of samples in queue. */
+	size_t queued_samples() const
+	{
+		return m_qlen.load(memory_order_relaxed);
+	}
+
+	/** Return number of blocks in queue. */
+	size_t queued_blocks() const
+	{
+		size_t tail = m_tail.load(memory_order_relaxed);
+		size_t head = m_head.load(memory_order_relaxed);
+		return head > tail ? head - tail : 0;
+	}
+
+	/** Blocks thrown away to overflow since construction. */
+	uint64_t dropped_blocks() const
+	{
+		return m_dropped.load(memory_order_relaxed);
+	}
+
+	stats_t stats() const
+	{
+		stats_t s;
+		s.pushed 	= m_pushed.load(memory_order_relaxed);
+		s.pulled 	= m_pulled.load(memory_order_relaxed);
+		s.dropped 	= m_dropped.load(memory_order_relaxed);
+		s.queued 	= queued_blocks();
+		s.highWater = m_high_water.load(memory_order_relaxed);
+		s.capacity 	= m_mask + 1;
+		return s;
+	}
+
+	/**
+	 * If the queue is non-empty, remove a block from the queue and
+	 * return the samples. If the end marker has been reached, return
+	 * an empty vector. If the queue is empty, wait until more data is pushed
+	 * or until the end marker is pushed.
+	 */
+	vector<Element> pull()
+	{
+		Tag tag;
+		return pull(tag);
+	}
+
+	/** The same,  and the tag the block was pushed with. */
+	vector<Element> pull(Tag& tag)
+	{
+		vector<Element> ret;
+
+		while(true) {
+			uint32_t seen = m_pushes.load();
+
+			if (take(ret, &tag)) {
+				m_pulled++;
+				break;
+			}
+
+			if (m_end_marked)
+				break;
+
+			wait(seen);
+		}
+
+		return ret;
+	}
+
+	/** Throw away everything queued. */
+	void flush()
+	{
+		vector<Element> block;
+		while (take(block))
+			block.clear();
+	}
+
+	/** Throw away everything queued,  handing each block to release(). */
+	template <class Release>
+	void flush(Release release)
+	{
+		vector<Element> block;
+		while (take(block))
+			release(block);
+	}
+
+	/** Return true if the end has been reached at the Pull side. */
+	bool pull_end_reached() const
+	{
+		return m_qlen.load() == 0 && m_end_marked;
+	}
+
+	/** Wait until the buffer contains minfill samples or an end marker. */
+	void wait_buffer_fill(size_t minfill)
+	{
+		while(true) {
+			uint32_t seen = m_pushes.load();
+
+			if (m_qlen.load() >= minfill || m_end_marked)
+				break;
+
+			wait(seen);
+		}
+	}
+
+private:
+
+	struct slot_t {
+		atomic<size_t>		seq;
+		vector<Element>	data;
+		Tag					tag;
+	};
+
+	/** Claim the oldest block,  false if the queue is empty. */
+	bool take(vector<Element>& out, Tag* tag = NULL)
+	{
+		slot_t* slot;
+		size_t pos;
+
+		while(true) {
+			pos = m_tail.load(memory_order_relaxed);
+			slot = &m_slots[pos & m_mask];
+			intptr_t dif = (intptr_t)slot->seq.load(memory_order_acquire) - (intptr_t)(pos + 1);
+
+			if (dif == 0) {
+				if (m_tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+					break;
+			}
+			else if (dif < 0)
+				return false;
+		}
+
+		out.swap(slot->data);
+		slot->data.clear();
+		if (tag)
+			*tag = slot->tag;
+		slot->seq.store(pos + m_mask + 1, memory_order_release);
+
+		m_qlen.fetch_sub(out.size());
+		return true;
+	}
+
+	void wake()
+	{
+		m_pushes.fetch_add(1);
+
+		if (m_waiting.exchange(false)) {
+#if defined(__linux__)
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_pushes),
+					  FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+		}
+	}
+
+	/** Sleep until the next push after seen. */
+	void wait(uint32_t seen)
+	{
+		m_waiting.store(true);
+
+		// a push that came in before we said we were waiting
+		if (m_pushes.load() != seen)
+			return;
+
+#if defined(__linux__)
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_pushes),
+				  FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+#else
+		usleep(1000);
+#endif
+	}
+
+	const overflow_t		m_policy;
+	size_t					m_mask;
+	vector<slot_t>			m_slots;
+
+	alignas(64) atomic<size_t>		m_head;
+	alignas(64) atomic<size_t>		m_tail;
+
+	atomic<size_t>			m_qlen;
+	atomic<uint32_t>		m_pushes;		// futex word,  bumped on every push
+	atomic<bool>			m_waiting;
+	atomic<bool>			m_end_marked;
+
+	atomic<uint64_t>		m_pushed;
+	atomic<uint64_t>		m_pulled;
+	atomic<uint64_t>		m_dropped;
+	atomic<size_t>			m_high_water;
+};
@@ -0,0 +1,222 @@
+//
+//  SpectrumEngine.cpp
+//  carradio
+//
+
+#include "SpectrumEngine.hpp"
+
+#include <cmath>
+#include <algorithm>
+#include <sys/syscall.h>
+
+#include "timespec_util.h"
+#include "CommonDefs.hpp"
+#include "ThreadPolicy.hpp"
+
+typedef void * (*THREADFUNCPTR)(void *);
+
+SpectrumEngine::SpectrumEngine() : _spectrum(fftBins) {
+	_active = false;
+	_frameMs = default_frameMs;
+	_rowCB = nullptr;
+	_lastFeed = {0,0};
+	_dropped = 0;
+
+	_pending = false;
+	_inputRate = 0;
+	_inputFreq = 0;
+
+	_smoothedFreq = 0;
+	_smoothedRate = 0;
+	_seq = 0;
+
+	_rows.resize(waterfallRows);
+	_rowCount = 0;
+
+	_isRunning = true;
+
+	pthread_create(&_TID, NULL,
+						(THREADFUNCPTR) &SpectrumEngine::SpectrumWorkerThread, (void*)this);
+	
+	// whatever is left over after the radio and the display
+	ThreadPolicy::shared()->registerThread("SpectrumEngine", _TID);
+}
+
+SpectrumEngine::~SpectrumEngine(){
+
+	pthread_mutex_lock (&_mutex);
+	_isRunning = false;
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock (&_mutex);
+
+	pthread_join(_TID, NULL);
+}
+
+
+void SpectrumEngine::setActive(bool active, uint64_t frameMs, rowCallback_t cb){
+
+	pthread_mutex_lock (&_mutex);
+	_frameMs = frameMs;
+	_rowCB = cb;
+	_pending = false;
+	pthread_mutex_unlock (&_mutex);
+
+	if(active){
+		// start from a clean waterfall
+		std::lock_guard<std::mutex> lock(_rowMutex);
+		_rowCount = 0;
+	}
+
+	_active = active;
+}
+
+
+bool SpectrumEngine::getLatestRow(row_t &row){
+	std::lock_guard<std::mutex> lock(_rowMutex);
+
+	if(_rowCount == 0)
+		return false;
+
+	row = _rows[(_rowCount - 1) % waterfallRows];
+	return true;
+}
+
+
+bool SpectrumEngine::getRows(vector<row_t> &rows){
+	std::lock_guard<std::mutex> lock(_rowMutex);
+
+	rows.clear();
+	uint32_t first = _rowCount > waterfallRows ? _rowCount - waterfallRows : 0;
+
+	for(uint32_t i = first; i < _rowCount; i++)
+		rows.push_back(_rows[i % waterfallRows]);
+
+	return !rows.empty();
+}
+
+
+// Called for every SDR block.  Nothing here may wait:  when the display
+// isn't looking,  it is too early for the next row or the thread is
+// still busy with the last one the block is simply passed over.
+
+void SpectrumEngine::feed(const IQSampleVector& samples, uint32_t sampleRate, uint32_t centerFreq){
+
+	if(!_active)
+		return;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(timespec_to_ms(timespec_sub(now, _lastFeed)) < (long)_frameMs)
+		return;
+
+	if(pthread_mutex_trylock(&_mutex) != 0)
+		return;
+
+	if(_pending){
+		_dropped++;
+		pthread_mutex_unlock (&_mutex);
+		return;
+	}
+
+	// the newest samples are enough for one row
+	size_t count = min<size_t>(samples.size(), framesPerRow * fftBins);
+	_input.assign(samples.end() - count, samples.end());
+	_inputRate = sampleRate;
+	_inputFreq = centerFreq;
+	_pending = true;
+	_lastFeed = now;
+
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock (&_mutex);
+}
+
+
+void SpectrumEngine::computeRow(){
+
+	if(_spectrum.process(_work, _power, framesPerRow) == 0)
+		return;
+
+	// retuned or new rate,  don't smear the old picture in
+	bool restart = (_inputFreq != _smoothedFreq || _inputRate != _smoothedRate);
+	_smoothedFreq = _inputFreq;
+	_smoothedRate = _inputRate;
+
+	constexpr unsigned int binsPerColumn = fftBins / columns;
+
+	row_t row;
+
+	for(unsigned int c = 0; c < columns; c++){
+
+		// strongest bin,  so a narrow carrier still shows in its column
+		float peak = 0;
+		for(unsigned int j = c * binsPerColumn; j < (c + 1) * binsPerColumn; j++){
+			// FFT order has negative frequencies in the upper half
+			peak = max(peak, _power[(j + fftBins / 2) % fftBins]);
+		}
+
+		float dB = 10 * log10(max(peak, 1.0e-12f));
+		_smoothed[c] = restart ? dB : 0.5f * _smoothed[c] + 0.5f * dB;
+		row.dB[c] = _smoothed[c];
+	}
+
+	row.centerFreq = _inputFreq;
+	row.span = _inputRate;
+	row.seq = ++_seq;
+
+	std::lock_guard<std::mutex> lock(_rowMutex);
+	_rows[_rowCount % waterfallRows] = row;
+	_rowCount++;
+}
+
+
+void SpectrumEngine::SpectrumWorker(){
+
+	PRINT_CLASS_TID;
+
+	while(true){
+
+		pthread_mutex_lock (&_mutex);
+
+		while(_isRunning && !_pending)
+			pthread_cond_wait(&_cond, &_mutex);
+
+		if(!_isRunning){
+			pthread_mutex_unlock (&_mutex);
+			break;
+		}
+
+		_work.swap(_input);
+		pthread_mutex_unlock (&_mutex);
+
+		computeRow();
+
+		pthread_mutex_lock (&_mutex);
+		_pending = false;
+		rowCallback_t cb = _active ? _rowCB : nullptr;
+		pthread_mutex_unlock (&_mutex);
+
+		if(cb)
+			cb();
+	}
+}
+
+
+void* SpectrumEngine::SpectrumWorkerThread(void *context){
+	SpectrumEngine* d = (SpectrumEngine*)context;
+
+	//   the pthread_cleanup_push needs to be balanced with pthread_cleanup_pop
+	pthread_cleanup_push(   &SpectrumEngine::SpectrumWorkerThreadCleanup ,context);
+
+	d->SpectrumWorker();
+
+	pthread_exit(NULL);
+
+	pthread_cleanup_pop(0);
+	return((void *)1);
+}
+
+
+void SpectrumEngine::SpectrumWorkerThreadCleanup(void *context){
+
+	//	printf("cleanup SpectrumEngine\n");
+}
@@ -0,0 +1,103 @@
+//
+//  SpectrumEngine.hpp
+//  carradio
+//
+//  Band scope / waterfall rows from the SDR IQ stream.
+//
+//  SDRProcessor hands every block to feed(),  which takes a copy of the
+//  newest samples only when the display wants a row and the last one is
+//  done,  and never waits on a lock.  The FFT work happens on a low
+//  priority thread that publishes rows of power levels,  one per
+//  display column.
+//
+
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "IQSample.h"
+#include "Filter.hpp"
+
+using namespace std;
+
+class SpectrumEngine {
+
+public:
+	static constexpr unsigned int columns 			= 128;		// display width
+	static constexpr unsigned int fftBins 			= 512;		// 4 bins per column
+	static constexpr unsigned int framesPerRow 	= 8;
+	static constexpr unsigned int waterfallRows 	= 48;
+	static constexpr uint64_t		default_frameMs = 200;		// the VFD link manages ~5 fps
+
+	typedef struct {
+		float				dB[columns];			// lowest frequency first
+		uint32_t			centerFreq;				// Hz
+		uint32_t			span;						// Hz across the row
+		uint32_t			seq;
+	} row_t;
+
+	typedef std::function<void()> rowCallback_t;
+
+	SpectrumEngine();
+	~SpectrumEngine();
+
+	// display side
+	void setActive(bool active, uint64_t frameMs = default_frameMs, rowCallback_t cb = nullptr);
+	bool isActive() { return _active; };
+
+	bool getLatestRow(row_t &row);
+	bool getRows(vector<row_t> &rows);		// oldest first
+
+	// SDRProcessor side,  returns at once
+	void feed(const IQSampleVector& samples, uint32_t sampleRate, uint32_t centerFreq);
+
+	uint32_t droppedRows() { return _dropped; };
+
+private:
+
+	void computeRow();
+
+	atomic<bool>		_active;
+	uint64_t				_frameMs;
+	rowCallback_t		_rowCB;
+	struct timespec	_lastFeed;
+	atomic<uint32_t>	_dropped;
+
+	// handed from feed() to the thread,  under _mutex
+	bool					_pending;
+	IQSampleVector		_input;
+	uint32_t				_inputRate;
+	uint32_t				_inputFreq;
+
+	// thread only
+	PowerSpectrum		_spectrum;
+	vector<float>		_power;
+	IQSampleVector		_work;
+	float					_smoothed[columns];
+	uint32_t				_smoothedFreq;
+	uint32_t				_smoothedRate;
+	uint32_t				_seq;
+
+	// published rows
+	mutable std::mutex	_rowMutex;
+	vector<row_t>		_rows;					// ring of waterfallRows
+	uint32_t				_rowCount;
+
+	void SpectrumWorker();		// C++ version of thread
+	// C wrappers for SpectrumWorker;
+	static void* SpectrumWorkerThread(void *context);
+	static void SpectrumWorkerThreadCleanup(void *context);
+	bool 					_isRunning = false;
+
+	pthread_cond_t 		_cond = PTHREAD_COND_INITIALIZER;
+	pthread_mutex_t 	_mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_t			_TID;
+};
@@ -0,0 +1,395 @@
+//
+//  ThreadPolicy.cpp
+//  carradio
+//
+
+#include "ThreadPolicy.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <fstream>
+#include <filesystem> // C++17
+
+#include "timespec_util.h"
+#include "PropValKeys.hpp"
+
+ThreadPolicy *ThreadPolicy::sharedInstance = NULL;
+thread_local ThreadPolicy::thread_t* ThreadPolicy::_self = NULL;
+
+// Audio first:  OutputProcessor feeds ALSA,  the readers keep the dongle
+// from overflowing,  then the decode stages.  Line in and AirPlay never run
+// with the radio,  their readers sit below the decode stages so a reader
+// that lost its device can't take a core from them.
+// Cores only apply with four or more of them.
+static const map<string, ThreadPolicy::policy_t> defaultPolicies = {
+	{ "OutputProcessor",	{ SCHED_FIFO, 	60, {} }},
+	{ "RtlSdrAsync",		{ SCHED_FIFO, 	55, {} }},
+	{ "SDRReader",			{ SCHED_FIFO, 	55, {} }},
+	{ "AuxReader",			{ SCHED_FIFO, 	45, {} }},
+	{ "AirplayReader",		{ SCHED_FIFO, 	45, {} }},
+	{ "SDRProcessor",		{ SCHED_FIFO, 	50, {1} }},
+	{ "SDRDemod",			{ SCHED_FIFO, 	50, {2} }},
+	{ "ChannelManager",	{ SCHED_OTHER, 	0, {} }},
+	{ "DisplayUpdate",		{ SCHED_OTHER, 	0, {0} }},
+	{ "LEDUpdate",			{ SCHED_OTHER, 	0, {0} }},
+	{ "MetaReader",			{ SCHED_OTHER, 	5, {0} }},
+	{ "SpectrumEngine",		{ SCHED_OTHER, 	10, {0} }},
+	{ "CANBusMgr",			{ SCHED_OTHER, 	0, {0} }},
+	{ "GPSmgr",				{ SCHED_OTHER, 	0, {0} }},
+	{ "W1Mgr",				{ SCHED_OTHER, 	5, {0} }},
+	{ "IQRecorder",			{ SCHED_OTHER, 	0, {0} }},
+};
+
+static inline uint64_t timespec_to_ns(const struct timespec &ts){
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+ThreadPolicy::ThreadPolicy(){
+	_threads.clear();
+	_policies.clear();
+	_cpuCount = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	_lastValues = {0, 0};
+}
+
+ThreadPolicy::~ThreadPolicy(){
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	for(auto &[name, t] : _threads)
+		delete t;
+	_threads.clear();
+}
+
+void ThreadPolicy::registerThread(string name, pthread_t tid){
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	// the kernel keeps 15 characters of a thread name
+	name = name.substr(0, 15);
+
+	thread_t* t = NULL;
+	if(_threads.count(name)){
+		t = _threads[name];
+	}
+	else {
+		t = new thread_t;
+		t->name = name;
+		t->workMaxNs = 0;
+		t->blocks = 0;
+		t->misses = 0;
+		_threads[name] = t;
+	}
+
+	t->pthread = tid;
+	t->tid = 0;
+	t->warned = false;
+	t->runNs = 0;
+	t->waitNs = 0;
+	t->slices = 0;
+	t->workStart = {0, 0};
+	t->deadlineSecs = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t->lastStats);
+
+#if defined(__linux__)
+	pthread_setname_np(tid, name.c_str());
+	t->tid = findTid(name);
+	readSchedStat(t->tid, t->runNs, t->waitNs, t->slices);
+#endif
+
+	apply(t);
+}
+
+bool ThreadPolicy::configure(nlohmann::json j){
+
+	if(!j.is_object())
+		return false;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	for(auto it = j.begin(); it != j.end(); it++){
+		if(!it.value().is_object())
+			continue;
+
+		string name = it.key().substr(0, 15);
+		nlohmann::json entry = it.value();
+
+		// what is not given stays as it was
+		policy_t policy = policyForName(name);
+
+		if(entry.contains("sched") && entry["sched"].is_string()){
+			string sched = entry["sched"];
+			if(sched == "fifo")
+				policy.sched = SCHED_FIFO;
+			else if(sched == "other")
+				policy.sched = SCHED_OTHER;
+			else {
+				fprintf(stderr, "thread_policy %s: unknown sched \"%s\"\n",
+						  name.c_str(), sched.c_str());
+				continue;
+			}
+		}
+
+		if(entry.contains("priority") && entry["priority"].is_number_integer())
+			policy.priority = entry["priority"];
+
+		if(entry.contains("cpus") && entry["cpus"].is_array()){
+			policy.cpus.clear();
+			for(auto &cpu : entry["cpus"]){
+				if(cpu.is_number_integer())
+					policy.cpus.push_back(cpu);
+			}
+		}
+
+		_policies[name] = policy;
+	}
+
+	for(auto &[name, t] : _threads)
+		apply(t);
+
+	return true;
+}
+
+ThreadPolicy::policy_t ThreadPolicy::policyForName(string name){
+
+	name = name.substr(0, 15);
+
+	if(_policies.count(name))
+		return _policies[name];
+
+	policy_t policy = {SCHED_OTHER, 0, {}};
+	if(defaultPolicies.count(name)){
+		policy = defaultPolicies.at(name);
+
+		// too few cores to give the audio path its own
+		if(_cpuCount < 4)
+			policy.cpus.clear();
+	}
+
+	return policy;
+}
+
+bool ThreadPolicy::apply(thread_t* t){
+
+#if defined(__linux__)
+	policy_t policy = policyForName(t->name);
+	bool success = true;
+
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	if(policy.sched == SCHED_FIFO){
+		param.sched_priority = min(max(policy.priority,
+												 sched_get_priority_min(SCHED_FIFO)),
+											sched_get_priority_max(SCHED_FIFO));
+	}
+
+	int err = pthread_setschedparam(t->pthread, policy.sched, &param);
+	if(err != 0){
+		// no real time without CAP_SYS_NICE,  run as we are
+		if(!t->warned)
+			fprintf(stderr, "thread %s: sched %s %d failed: %s\n", t->name.c_str(),
+					  policy.sched == SCHED_FIFO ? "fifo" : "other", policy.priority, strerror(err));
+		success = false;
+	}
+
+	if(policy.sched == SCHED_OTHER && t->tid > 0){
+		if(setpriority(PRIO_PROCESS, t->tid, policy.priority) != 0){
+			if(!t->warned)
+				fprintf(stderr, "thread %s: nice %d failed: %s\n", t->name.c_str(),
+						  policy.priority, strerror(errno));
+			success = false;
+		}
+	}
+
+	// cores that exist,  none of them means any core
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+
+	int pinned = 0;
+	for(int cpu : policy.cpus){
+		if(cpu >= 0 && cpu < _cpuCount && cpu < CPU_SETSIZE){
+			CPU_SET(cpu, &cpuset);
+			pinned++;
+		}
+	}
+
+	if(pinned == 0){
+		for(int cpu = 0; cpu < _cpuCount && cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(cpu, &cpuset);
+	}
+
+	err = pthread_setaffinity_np(t->pthread, sizeof(cpu_set_t), &cpuset);
+	if(err != 0){
+		if(!t->warned)
+			fprintf(stderr, "thread %s: affinity failed: %s\n", t->name.c_str(), strerror(err));
+		success = false;
+	}
+
+	if(!success)
+		t->warned = true;
+
+	return success;
+#else
+	return false;
+#endif
+}
+
+// kernel thread id of the newest thread with this name
+pid_t ThreadPolicy::findTid(string name){
+
+	pid_t found = 0;
+
+	try {
+		for(auto &entry : std::filesystem::directory_iterator("/proc/self/task")){
+			std::ifstream ifs(entry.path() / "comm");
+			string comm;
+			if(ifs.is_open() && getline(ifs, comm) && comm == name){
+				pid_t tid = (pid_t) atoi(entry.path().filename().c_str());
+				if(tid > found)
+					found = tid;
+			}
+		}
+	}
+	catch(std::filesystem::filesystem_error &err) {
+	}
+
+	return found;
+}
+
+// run time,  run queue wait and time slices,  /proc/<pid>/task/<tid>/schedstat
+bool ThreadPolicy::readSchedStat(pid_t tid, uint64_t &runNs, uint64_t &waitNs, uint64_t &slices){
+
+	if(tid <= 0)
+		return false;
+
+	std::ifstream ifs("/proc/self/task/" + to_string(tid) + "/schedstat");
+	if(!ifs.is_open())
+		return false;
+
+	uint64_t run = 0, wait = 0, count = 0;
+	if(!(ifs >> run >> wait >> count))
+		return false;
+
+	runNs = run;
+	waitNs = wait;
+	slices = count;
+	return true;
+}
+
+// MARK: -  block deadlines
+
+ThreadPolicy::thread_t* ThreadPolicy::threadForSelf(){
+
+	if(_self)
+		return _self;
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	pthread_t me = pthread_self();
+	for(auto &[name, t] : _threads){
+		if(pthread_equal(t->pthread, me)){
+			_self = t;
+			break;
+		}
+	}
+
+	// not registered yet,  the creator gets there after we start
+	return _self;
+}
+
+void ThreadPolicy::workStart(double deadlineSecs){
+	thread_t* t = shared()->threadForSelf();
+	if(!t)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &t->workStart);
+	t->deadlineSecs = deadlineSecs;
+}
+
+void ThreadPolicy::workDone(){
+	thread_t* t = shared()->threadForSelf();
+	if(!t || (t->workStart.tv_sec == 0 && t->workStart.tv_nsec == 0))
+		return;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	uint64_t ns = timespec_to_ns(now) - timespec_to_ns(t->workStart);
+	t->workStart = {0, 0};
+
+	if(ns > t->workMaxNs)
+		t->workMaxNs = ns;
+
+	t->blocks++;
+	if(t->deadlineSecs > 0 && ns > t->deadlineSecs * 1.0e9)
+		t->misses++;
+}
+
+// MARK: -  stats
+
+vector<ThreadPolicy::threadStats_t> ThreadPolicy::stats(){
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	vector<threadStats_t> result;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for(auto &[name, t] : _threads){
+
+		threadStats_t s = {name, t->tid, 0, 0, 0, t->blocks, t->misses};
+
+		uint64_t runNs, waitNs, slices;
+		if(readSchedStat(t->tid, runNs, waitNs, slices)){
+
+			double wallNs = timespec_to_ns(now) - timespec_to_ns(t->lastStats);
+			if(wallNs > 0)
+				s.cpuPercent = 100.0 * (runNs - t->runNs) / wallNs;
+
+			if(slices > t->slices)
+				s.wakeAvgUs = (waitNs - t->waitNs) / 1000.0 / (slices - t->slices);
+
+			t->runNs = runNs;
+			t->waitNs = waitNs;
+			t->slices = slices;
+		}
+
+		t->lastStats = now;
+		s.workMaxMs = t->workMaxNs.exchange(0) * 1.0e-6;
+
+		result.push_back(s);
+	}
+
+	return result;
+}
+
+bool ThreadPolicy::statsValues(map<string,string> &values){
+
+	struct timespec now, diff;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	diff = timespec_sub(now, _lastValues);
+
+	if(_lastValues.tv_sec != 0 && diff.tv_sec < statsInterval)
+		return false;
+
+	_lastValues = now;
+
+	char buf[32];
+	for(auto &s : stats()){
+		string key = VAL_THREAD_PREFIX + s.name;
+
+		snprintf(buf, sizeof(buf), "%.1f", s.cpuPercent);
+		values[key + "_cpu"] = buf;
+
+		snprintf(buf, sizeof(buf), "%.0f", s.wakeAvgUs);
+		values[key + "_wake_us"] = buf;
+
+		if(s.blocks > 0){
+			snprintf(buf, sizeof(buf), "%.2f", s.workMaxMs);
+			values[key + "_work_ms"] = buf;
+			values[key + "_misses"] = to_string(s.deadlineMisses);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,132 @@
+//
+//  ThreadPolicy.hpp
+//  carradio
+//
+//  One place for how the threads of carradio are scheduled.  Each
+//  manager registers its threads by name as it creates them,  and the
+//  policy for that name is applied:  thread name,  SCHED_FIFO priority
+//  or SCHED_OTHER nice,  and the cores it may run on.
+//
+//  The built in policy puts the audio path (readers,  SDR decode and
+//  OutputProcessor) on SCHED_FIFO ahead of display redraw,  CAN,  GPS,
+//  one wire and the database,  and with four cores or more gives the
+//  decode stages cores 1 and 2 and leaves everything else on core 0.
+//  The thread_policy property overrides it per thread name:
+//
+//  	"thread_policy": {
+//  		"OutputProcessor": { "sched": "fifo", "priority": 60, "cpus": [3] },
+//  		"DisplayUpdate":   { "sched": "other", "priority": 5 }
+//  	}
+//
+//  priority is 1-99 for fifo and the nice value for other.
+//
+//  Run time and wakeup latency come from the kernel (schedstat) for
+//  every thread.  Block loops also bracket each block with workStart()
+//  and workDone(),  which counts the blocks that took longer than they
+//  last,  the deadline a real time audio thread must not miss.
+//
+
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "json.hpp"
+
+using namespace std;
+
+class ThreadPolicy {
+
+public:
+
+	typedef struct {
+		int				sched;			// SCHED_OTHER or SCHED_FIFO
+		int				priority;		// FIFO priority,  or nice for SCHED_OTHER
+		vector<int>		cpus;				// empty is any core
+	} policy_t;
+
+	typedef struct {
+		string			name;
+		pid_t				tid;
+		double			cpuPercent;		// of one core,  since the last stats
+		double			wakeAvgUs;		// run queue wait per time slice
+		double			workMaxMs;		// longest block,  workDone() threads
+		uint64_t			blocks;
+		uint64_t			deadlineMisses;
+	} threadStats_t;
+
+	static ThreadPolicy *shared() {
+		if(!sharedInstance){
+			sharedInstance = new ThreadPolicy;
+		}
+		return sharedInstance;
+	}
+
+	ThreadPolicy();
+	~ThreadPolicy();
+
+	// name a thread and apply its policy,  again for a thread that was
+	// recreated under the same name.  Names are cut to 15 characters.
+	void registerThread(string name, pthread_t tid);
+
+	// per name policies from the properties file,  applied right away
+	bool configure(nlohmann::json j);
+
+	// bracket a block of work on a registered thread,  deadlineSecs is
+	// how long the block lasts in real time
+	static void workStart(double deadlineSecs);
+	static void workDone();
+
+	vector<threadStats_t> stats();
+
+	// PiCarDB values for the stats,  false until statsInterval has passed
+	bool statsValues(map<string,string> &values);
+
+private:
+
+	static constexpr int 	statsInterval = 2;		// seconds
+
+	typedef struct {
+		string				name;
+		pthread_t			pthread;
+		pid_t					tid;
+		bool					warned;				// policy refused,  said so once
+
+		// schedstat at the last stats()
+		uint64_t				runNs;
+		uint64_t				waitNs;
+		uint64_t				slices;
+		struct timespec	lastStats;
+
+		// workStart() / workDone()
+		struct timespec	workStart;
+		double				deadlineSecs;
+		atomic<uint64_t>	workMaxNs;
+		atomic<uint64_t>	blocks;
+		atomic<uint64_t>	misses;
+	} thread_t;
+
+	static ThreadPolicy *sharedInstance;
+
+	mutable std::mutex		_mutex;
+	map<string, thread_t*>	_threads;
+	map<string, policy_t>	_policies;			// from configure()
+	int							_cpuCount;
+	struct timespec			_lastValues;
+
+	static thread_local thread_t* _self;
+
+	policy_t policyForName(string name);
+	bool apply(thread_t* t);
+	pid_t findTid(string name);
+	bool readSchedStat(pid_t tid, uint64_t &runNs, uint64_t &waitNs, uint64_t &slices);
+	thread_t* threadForSelf();
+};
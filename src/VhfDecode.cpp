@@ -3,10 +3,18 @@
 #include <cmath>
 
 #include "VhfDecode.hpp"
+#include "DSPTiming.hpp"
 
 using namespace std;
 
 
+// Stage timing,  published by PiCarMgr.
+static DSPStage s_vhf_meter("vhf_meter");
+static DSPStage s_vhf_front("vhf_front");
+static DSPStage s_vhf_if("vhf_if");
+static DSPStage s_vhf_demod("vhf_demod");
+
+
 #pragma clang diagnostic ignored "-Wconversion"
 
 
@@ -36,15 +44,20 @@ using namespace std;
 //}
 
 
-/** Compute RMS level over a small prefix of the specified sample vector. */
-static IQSample::value_type rms_level_approx(const IQSampleVector& samples)
+/**
+ * Compute RMS level over a small prefix of the specified sample vector,
+ * optionally starting skip samples in.
+ */
+static IQSample::value_type rms_level_approx(const IQSampleVector& samples,
+															unsigned int skip = 0)
 {
 	 unsigned int n = samples.size();
+	 skip = min(skip, n / 2);
 	 n = (n + 63) / 64;
 
 	 IQSample::value_type level = 0;
 	 for (unsigned int i = 0; i < n; i++) {
-		  const IQSample& s = samples[i];
+		  const IQSample& s = samples[skip + i];
 		  IQSample::value_type re = s.real(), im = s.imag();
 		  level += re * re + im * im;
 	 }
@@ -63,15 +76,22 @@ VhfDecoder::VhfDecoder(double sample_rate_if,
 							double freq_dev,
 							double bandwidth_pcm,
 							unsigned int downsample,
-							int squelch_level  )
+							int squelch_level,
+							unsigned int if_filter_order)
 
 	 // Initialize member fields
 	 : m_sample_rate_if(sample_rate_if)
-	 , m_sample_rate_baseband(sample_rate_if / downsample)
+	 // IQ rate has to hold the IF filter and the Carson bandwidth of the
+	 // audio.
+	 , m_if_decim(DecimatingFrontEnd::decimation_for(sample_rate_if,
+						  max(4 * bandwidth_if, 2 * (freq_dev + bandwidth_pcm)),
+						  max(1u, downsample)))
+	 , m_downsample(max(1u, downsample) / m_if_decim)
+	 , m_sample_rate_channel(sample_rate_if / m_if_decim)
+	 , m_sample_rate_baseband(m_sample_rate_channel / m_downsample)
 	 , m_tuning_table_size(64)
 	 , m_tuning_shift(lrint(-64.0 * tuning_offset / sample_rate_if))
 	 , m_freq_dev(freq_dev)
-	 , m_downsample(downsample)
 	 , m_if_level(0)
 	 , m_baseband_mean(0)
 	 , m_baseband_level(0)
@@ -80,25 +100,31 @@ VhfDecoder::VhfDecoder(double sample_rate_if,
 	 , m_is_squelched(false)
 	 , m_signal_hits(0)
 	 , m_squelch_hits(0)
+	 , m_chain_idle(false)
 
-	 // Construct FineTuner
-	 , m_finetuner(m_tuning_table_size, m_tuning_shift)
+	 // Construct ChannelPowerMeter,  same noise bandwidth as the IF filter
+	 , m_powermeter(m_tuning_table_size, m_tuning_shift,
+						 lrint(sample_rate_if / (2 * bandwidth_if)))
+
+	 // Construct DecimatingFrontEnd
+	 , m_frontend(m_tuning_table_size, m_tuning_shift, m_if_decim)
 
 	 // Construct LowPassFilterFirIQ
-	 , m_iffilter(10, bandwidth_if / sample_rate_if)
+	 , m_iffilter(if_filter_order ? if_filter_order : 10,
+					  bandwidth_if / m_sample_rate_channel)
 
 	 // Construct PhaseDiscriminator
-	 , m_phasedisc(freq_dev / sample_rate_if)
+	 , m_phasedisc(freq_dev / m_sample_rate_channel)
 
 	 // Construct DownsampleFilter for baseband
-	 , m_resample_baseband(8 * downsample, 0.4 / downsample, downsample, true)
+	 , m_resample_baseband(8 * m_downsample, 0.4 / m_downsample, m_downsample)
 
-	 // Construct DownsampleFilter for mono channel
+	 // Construct PolyphaseResampler for mono channel
 	 , m_resample_mono(
+		  m_sample_rate_baseband,                             // sample_rate_in
+		  sample_rate_pcm,                                    // sample_rate_out
 		  int(m_sample_rate_baseband / 1000.0),               // filter_order
-		  bandwidth_pcm / m_sample_rate_baseband,             // cutoff
-		  m_sample_rate_baseband / sample_rate_pcm,           // downsample
-	  false)                                              // integer_factor
+		  bandwidth_pcm / m_sample_rate_baseband)             // cutoff
 
 	 // Construct HighPassFilterIir
 	 , m_dcblock_mono(30.0 / sample_rate_pcm)
@@ -110,49 +136,70 @@ VhfDecoder::VhfDecoder(double sample_rate_if,
 {
 //	printf("VhfDecoder PCM at %f\n", sample_rate_pcm);
 
-	 // nothing more to do
+	 // the front end and the baseband resampler share the downsampling
+	 assert(m_if_decim * m_downsample == max(1u, downsample));
 }
 
 
 void VhfDecoder::process(const IQSampleVector& samples_in,
 								SampleVector& audio)
 {
-	// Fine tuning.
-	m_finetuner.process(samples_in, m_buf_iftuned);
+	double block_secs = samples_in.size() / m_sample_rate_if;
+	
+	// Dead channels never reach the IF chain.  The power meter only looks
+	// at a few short stretches of the block at the input rate.
+	if (m_squelch_level != 0) {
+		DSPTimer meter(s_vhf_meter, block_secs);
+		double meter_rms = m_powermeter.process(samples_in);
+		meter.stop();
+		
+		int meter_level = int (20*log10(max(meter_rms, 1.0e-10)));
+		
+		if (meter_level <= m_squelch_level + squelch_meter_margin) {
+			m_if_level = 0.95 * m_if_level + 0.05 * meter_rms;
+			update_squelch(false);
+			m_chain_idle = true;
+			
+			// same amount of silence the chain would have produced
+			uint64_t decim = uint64_t(m_if_decim) * m_downsample
+								  * m_resample_mono.decimation();
+			m_buf_mono.assign(samples_in.size() * uint64_t(m_resample_mono.interpolation())
+									/ decim, 0.0);
+			mono_to_left_right(m_buf_mono, audio);
+			return;
+		}
+	}
+	
+	// Samples were skipped,  the filters still hold the last block that
+	// went through.  Measure past that and don't let the discriminator
+	// see the jump.
+	unsigned int settle = 0;
+	if (m_chain_idle) {
+		settle = if_settle_samples;
+		m_phasedisc.reset();
+		m_chain_idle = false;
+	}
+	
+	// Fine tuning and decimation to the channel rate.
+	DSPTimer front(s_vhf_front, block_secs);
+	m_frontend.process(samples_in, m_buf_iftuned);
+	front.stop();
 	
 	// Low pass filter to isolate station.
+	DSPTimer iffilter(s_vhf_if, block_secs);
 	m_iffilter.process(m_buf_iftuned, m_buf_iffiltered);
 	
 	// Measure IF level.
-	double if_rms = rms_level_approx(m_buf_iffiltered);
+	double if_rms = rms_level_approx(m_buf_iffiltered, settle);
 	m_if_level = 0.95 * m_if_level + 0.05 * if_rms;
+	iffilter.stop();
 	
 	// rms level is faster responding for triggering squelch
 	int current_level  = int (20*log10(if_rms));
 	
 	bool hasSignal =  m_squelch_level == 0 || current_level >   m_squelch_level;
 	
-	if(hasSignal){
-		m_signal_hits++;
-		m_squelch_hits = 0;
-		m_is_squelched	 = false;
-	}
-	else {
-		m_squelch_hits++;
-		
-		if(m_signal_hits){
-			// if we already had a signal we wait m_squelch_dwell before marking as squelched
-			if (m_squelch_hits > m_squelch_dwell){
-				m_signal_hits = 0;
-				m_is_squelched	 = true;
-			}
-		}
-		
-		// if we havnt had a signal yet. then wait a few tries before marking as squelched
-		else 	if(m_squelch_hits > 2){
-			m_is_squelched	 = true;
-		}
- 	}
+	update_squelch(hasSignal);
 
 	if(!hasSignal){
 		// squelch output
@@ -165,13 +212,16 @@ void VhfDecoder::process(const IQSampleVector& samples_in,
 	{
 		
  //		printf("ON rms: %.5f\t if: %.5f\t squelch: %3d <  %3d\n", if_rms, m_if_level, current_level ,m_squelch_level);
+		DSPTimer demod(s_vhf_demod, block_secs);
+		
 		// Extract carrier frequency.
 		m_phasedisc.process(m_buf_iffiltered, m_buf_baseband);
 		
 		// Downsample baseband signal to reduce processing.
+		// Swap rather than move so both buffers keep their storage.
 		if (m_downsample > 1) {
-			SampleVector tmp(move(m_buf_baseband));
-			m_resample_baseband.process(tmp, m_buf_baseband);
+			m_buf_discrim.swap(m_buf_baseband);
+			m_resample_baseband.process(m_buf_discrim, m_buf_baseband);
 		}
 		
 		// Measure baseband level.
@@ -192,6 +242,48 @@ void VhfDecoder::process(const IQSampleVector& samples_in,
 }
 
 
+// Forget the last station.  Marking the chain idle has the next block
+// measured past what the filters still hold,  as after a squelched stretch.
+void VhfDecoder::reset()
+{
+	 m_if_level       = 0;
+	 m_baseband_mean  = 0;
+	 m_baseband_level = 0;
+
+	 m_is_squelched   = false;
+	 m_signal_hits    = 0;
+	 m_squelch_hits   = 0;
+	 m_chain_idle     = true;
+}
+
+
+// Update squelch state from one block.
+void VhfDecoder::update_squelch(bool hasSignal)
+{
+	if(hasSignal){
+		m_signal_hits++;
+		m_squelch_hits = 0;
+		m_is_squelched	 = false;
+	}
+	else {
+		m_squelch_hits++;
+		
+		if(m_signal_hits){
+			// if we already had a signal we wait m_squelch_dwell before marking as squelched
+			if (m_squelch_hits > m_squelch_dwell){
+				m_signal_hits = 0;
+				m_is_squelched	 = true;
+			}
+		}
+		
+		// if we havnt had a signal yet. then wait a few tries before marking as squelched
+		else 	if(m_squelch_hits > 2){
+			m_is_squelched	 = true;
+		}
+ 	}
+}
+
+
 // Duplicate mono signal in left/right channels.
 void VhfDecoder::mono_to_left_right(const SampleVector& samples_mono,
 											  SampleVector& audio)
@@ -54,8 +54,13 @@ public:
 	  *                     (75 kHz for broadcast FM)
 	  * bandwidth_pcm    :: Half bandwidth of audio signal in Hz
 	  *                     (15 kHz for broadcast FM)
-	  * downsample       :: Downsampling factor to apply after FM demodulation.
-	  *                     Set to 1 to disable.
+	  * downsample       :: Total downsampling factor ahead of the audio stage.
+	  *                     The IQ front end takes as much of it as the IF
+	  *                     bandwidth allows, the rest is applied after FM
+	  *                     demodulation.  Set to 1 to disable.
+	  * squelch_level    :: IF level in dB below which audio is muted,
+	  *                     0 to disable.
+	  * if_filter_order  :: IF filter order at the channel rate, 0 for 10.
 	  */
 	VhfDecoder(double sample_rate_if,  //
 				  double tuning_offset,   //
@@ -65,7 +70,8 @@ public:
 				  double freq_dev=default_freq_dev,
 				  double bandwidth_pcm=default_bandwidth_pcm,
 				  unsigned int downsample=1,
-				  int squelch_level  = 0);
+				  int squelch_level  = 0,
+				  unsigned int if_filter_order = 0);
 
 	 /**
 	  * Process IQ samples and return audio samples.
@@ -113,22 +119,41 @@ public:
 	void set_squelch_dwell(uint count){
 		m_squelch_dwell = count;
 	}
+	
+	/** Forget the last station,  for reuse after a retune. */
+	void reset();
 
 	static bool isNarrowBand(double frequency);
 
+	 /**
+	  * Blocks the channel power meter puts at or below squelch level plus
+	  * this many dB skip the IF chain.  Negative so the spread of the
+	  * estimate errs towards running the chain, which then makes the
+	  * actual squelch decision.
+	  */
+	 static constexpr int squelch_meter_margin = -3;
+
+	 /** Channel rate samples it takes the IF chain to flush old input. */
+	 static constexpr unsigned int if_settle_samples = 64;
+
 private:
  
+	 /** Update squelch state from one block. */
+	 void update_squelch(bool hasSignal);
+
 	 /** Duplicate mono signal in left/right channels. */
 	 void mono_to_left_right(const SampleVector& samples_mono,
 									 SampleVector& audio);
  
 	 // Data members.
 	 const double    m_sample_rate_if;
+	 const unsigned int m_if_decim;
+	 const unsigned int m_downsample;
+	 const double    m_sample_rate_channel;
 	 const double    m_sample_rate_baseband;
 	 const int       m_tuning_table_size;
 	 const int       m_tuning_shift;
 	 const double    m_freq_dev;
-	 const unsigned int m_downsample;
 	 double          m_if_level;
 	 double          m_baseband_mean;
 	 double          m_baseband_level;
@@ -137,17 +162,20 @@ private:
 	 bool      	     m_is_squelched;
  	 uint 			  m_signal_hits;
   	 uint 			  m_squelch_hits;
+	 bool            m_chain_idle;
 
 	 IQSampleVector  m_buf_iftuned;
 	 IQSampleVector  m_buf_iffiltered;
 	 SampleVector    m_buf_baseband;
+	 SampleVector    m_buf_discrim;      // before baseband downsampling
 	 SampleVector    m_buf_mono;
 
-	FineTuner           m_finetuner;
+	ChannelPowerMeter   m_powermeter;
+	DecimatingFrontEnd  m_frontend;
 	LowPassFilterFirIQ  m_iffilter;
 	PhaseDiscriminator  m_phasedisc;
 	 DownsampleFilter    m_resample_baseband;
-	 DownsampleFilter    m_resample_mono;
+	 PolyphaseResampler  m_resample_mono;
 	 HighPassFilterIir   m_dcblock_mono;
 	 HighPassFilterIir   m_dcblock_stereo;
 	 LowPassFilterRC     m_deemph_mono;
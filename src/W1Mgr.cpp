@@ -21,6 +21,7 @@
 
 #include "ErrorMgr.hpp"
 #include "timespec_util.h"
+#include "ThreadPolicy.hpp"
 
 
 typedef void * (*THREADFUNCPTR)(void *);
@@ -34,6 +35,7 @@ W1Mgr::W1Mgr() {
 
 	pthread_create(&_TID, NULL,
 										  (THREADFUNCPTR) &W1Mgr::W1ReaderThread, (void*)this);
+	ThreadPolicy::shared()->registerThread("W1Mgr", _TID);
 
 	
 }